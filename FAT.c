@@ -18,6 +18,8 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <string.h>
 
 
 
@@ -26,15 +28,148 @@
 #include "mfs.h"
 #include "FAT.h"
 #include "vcb_.h"
+#include "elevator.h"
+#include "geometry.h"
+#include "trace.h"
+#include "metrics.h"
 
-// Declaration of the file allocation table array and the blocks per FAT variable.
-int * fat_array = NULL;
 
-// updates the FAT on disk. It uses the LBAwrite method to perform the write operation
+// One page of the FAT in memory. The cache lock covers the pins and the
+// lists, the page number and the hash links change with the hash lock
+// taken for writing as well. The entries and the dirty flag are changed
+// under the lock of the group of the entry, with the page pinned so it
+// stays loaded.
+typedef struct fat_page
+	{
+	uint32_t page;			// page of the FAT it holds, NO_PAGE when none
+	int pins;			// users that keep the page loaded
+	int dirty;			// changed since it was last written, atomic
+	int loading;			// 1 while the page is read, atomic
+	int referenced;			// read without the cache lock since the eviction passed it, atomic
+	uint32_t * entries;
+	struct fat_page * hash_next;
+	struct fat_page * lru_prev;	// toward the most recently used page
+	struct fat_page * lru_next;
+	} fat_page;
+
+#define NO_PAGE 0xFFFFFFFF
+
+// Pages are found through the hash and dropped from the tail of the LRU list.
+// A page being read is in the hash marked loading, so two threads never load
+// it twice, and the read itself is done without the cache lock. Walking a
+// chain only takes the hash lock for reading, see get_next_block.
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t hash_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_cond_t page_loaded = PTHREAD_COND_INITIALIZER;
+static fat_page * page_hash[FAT_HASH_BUCKETS];
+static fat_page * lru_head = NULL;	// most recently used
+static fat_page * lru_tail = NULL;
+static int frame_count = 0;
+static uint32_t page_entries = 0;	// entries in a page, a power of 2
+static uint32_t page_shift = 0;		// log2 of page_entries
+static uint32_t page_blocks = 0;	// blocks a page takes on disk
+static uint32_t block_bytes = 0;	// bytes of a block of the FAT, one cluster
+static fat_cache_stats cache_stats;
+
+// One allocation group, a run of FAT_GROUP_BLOCKS blocks with its own lock
+// and free count. Every change to an entry holds the lock of the group of
+// that entry. Reading the next block of a chain does not, a chain is only
+// changed by the one thread that holds the lock of its file.
+typedef struct fat_group
+	{
+	pthread_mutex_t lock;
+	uint32_t start;		// first block of the group
+	uint32_t end;		// one past the last block of the group
+	uint32_t free_count;	// free blocks in the group
+	uint32_t hint;		// where the next search for a free block starts
+	uint32_t discard_start;	// first free block of the run being discarded
+	uint32_t discard_end;	// one past its last, allocation skips the run
+	} fat_group;
+
+static fat_group * groups = NULL;
+static int group_count = 0;
+// sum of the free counts of the groups, read without their locks, atomic
+static uint32_t total_free = 0;
+
+// The free counts are kept on disk in the summary after the FAT, one
+// uint32_t per group. A flag per block of the summary says whether one of
+// its counts changed since the last FAT write.
+static uint8_t * summary_dirty = NULL;
+
+// group a thread allocates from, handed out round robin on first use
+static __thread int thread_group = -1;
+static int next_thread_group = 0;
+
+// FAT writes go out one at a time, so the pages of one write stay together
+static pthread_mutex_t fat_io_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// A run of blocks freed from a chain that waits to be discarded
+typedef struct fat_discard
+	{
+	uint32_t start;
+	uint32_t count;
+	} fat_discard;
+
+// Runs freed since the last batch, a block that follows the last run
+// makes it longer. The flusher sends the batch, the thread that frees
+// blocks only does when FAT_DISCARD_BATCH runs wait.
+static pthread_mutex_t discard_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fat_discard * discard_runs = NULL;
+static int discard_count = 0;
+static int discard_capacity = 0;
+static int discard_supported = 1;	// cleared when the host can't punch holes, atomic
+// discards are sent by one thread at a time, so a group has at most one
+// run being discarded
+static pthread_mutex_t discard_send_mutex = PTHREAD_MUTEX_INITIALIZER;
+// runs of free blocks looked up under the group locks at a time
+#define FAT_DISCARD_RUNS 64
+// longest run discarded at once, allocation skips the run until it is sent
+#define FAT_DISCARD_RUN_BLOCKS (8 * FAT_GROUP_BLOCKS)
+// set under discard_mutex while a run is kept from allocation
+static int discard_claimed = 0;
+static pthread_cond_t discard_sent = PTHREAD_COND_INITIALIZER;
+
+// free blocks promised to data that is buffered but has no blocks yet,
+// other allocations can't use them
+static uint32_t blocks_promised = 0;
+static pthread_mutex_t promise_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int setup_cache(uint32_t block_size);
+static void fill_entries(uint32_t * entries, uint64_t first, uint64_t count, uint64_t number_of_blocks);
+static void free_cache();
+static void free_groups();
+static int build_groups(const uint32_t * counts);
+static int group_of(uint32_t block);
+static int home_group();
+static void change_free_count(int g, int delta);
+static fat_page * pin_page(uint32_t page);
+static void unpin_page(fat_page * frame);
+static uint32_t * entry_of(uint32_t block, fat_page ** held);
+static int write_page(const uint32_t * entries, uint32_t page);
+static int take_from_group(int g, uint32_t * out, int wanted);
+static int take_blocks(int first_group, uint32_t * out, int wanted);
+static void set_entry(uint32_t block, uint32_t value);
+static uint32_t count_unpromised();
+static void write_fat();
+static void lock_all_groups();
+static void unlock_all_groups();
+static void queue_discard(uint32_t block);
+static void run_discards(int force);
+static long discard_free_runs(uint32_t start, uint32_t end, long * runs);
+static int collect_free_runs(uint32_t * from, uint32_t end, fat_discard * found, int max);
+static long discard_run(fat_discard run, long * runs);
+static int in_discard(const fat_group * grp, uint32_t block);
+static int wait_for_discard();
+
+// updates the FAT on disk. It queues the write with elv_write between two barriers
 // if write fails, logs an error message.
 
 /**
- * This Function is used to initalize the FAT system
+ * This Function is used to initalize the FAT system. The FAT is built a run
+ * of pages at a time with bulk fills, so the whole table is never in
+ * memory, and only the pages that differ from what the volume holds are
+ * written. On a new sparse volume that is the pages of the reserved blocks
+ * and of the last block.
  *
  * @param number_of_blocks - A uint64_t of number of blocks needed for the fat
  * @param block_size - A uint64_t of block size for each indiviual block for the fat
@@ -47,45 +182,63 @@ int * fat_array = NULL;
 int fat_init(uint64_t number_of_blocks, uint64_t block_size) {
     printf("[ FAT INIT ] : Initializing FAT with %ld blocks and block size of %ld\n", number_of_blocks, block_size);
 
-    //Calulating the bytes per fat using the numbers of blocks and 4 bytes
-    int bytes_per_fat = number_of_blocks * sizeof (uint32_t);
-    printf("[ FAT INIT ] : Calculated bytes_per_fat as %d\n", bytes_per_fat);
-
-    //blocks per fat, basically converting the bytes per fat to block representation
-    int blocks_per_fat = to_blocks(bytes_per_fat);
-    printf("[ FAT INIT ] : Calculated blocks_per_fat as %d\n", blocks_per_fat);
-
-    printf("[ FAT INIT ] : Trying to allocate %d blocks of size %d\n", blocks_per_fat, block_size);
-
-    //allocating memory using the two sizes for the fat array
-    fat_array = (int*) malloc(blocks_per_fat * block_size);
-
-    if (!fat_array) {
+    if (setup_cache(block_size) != 0) {
+        return -1;
+    }
+    uint64_t run_bytes = (uint64_t) FAT_INIT_PAGES * page_blocks * block_size;
+    uint32_t * wanted = malloc(run_bytes);
+    uint32_t * on_disk = malloc(run_bytes);
+    if (wanted == NULL || on_disk == NULL) {
         fprintf(stderr, "[ FAT INIT ] : Failed to allocate memory for FAT.\n");
+        free(wanted);
+        free(on_disk);
+        free_cache();
         return -1;
     }
 
-    printf("[ FAT_INIT ] : Starting to populate fat_array.\n");
-    //Populate the fat array
-    for (int i = 0; i < number_of_blocks; i++) {
-        if (i == 0 || i == number_of_blocks - 1) {
-            //Setting the EOF_Block for the block
-            fat_array[i] = EOF_BLOCK;
-            //            printf("[ FAT_INIT ] : Setting EOF_BLOCK for block %d.\n", i);
-            continue;
+    uint64_t pages = (vcb->FAT_size + page_blocks - 1) / page_blocks;
+    uint64_t written = 0;
+    int ret = 0;
+    for (uint64_t p = 0; p < pages && ret == 0; p += FAT_INIT_PAGES) {
+        uint64_t run_pages = pages - p < FAT_INIT_PAGES ? pages - p : FAT_INIT_PAGES;
+        uint64_t first_block = p * page_blocks;
+        uint64_t blocks = vcb->FAT_size - first_block < run_pages * page_blocks
+            ? vcb->FAT_size - first_block : run_pages * page_blocks;
+
+        fill_entries(wanted, p * page_entries, run_pages * page_entries, number_of_blocks);
+        memset(on_disk, 0, run_bytes);
+        if (elv_read(on_disk, blocks, FAT_BLOCK_START_LOCATION + first_block) != blocks) {
+            // what the volume holds is unknown, every page is written
+            memset(on_disk, 0xAA, run_bytes);
         }
-        if (i <= 153) {
-            //Setting if the block is reserved
-            fat_array[i] = RESERVED_BLOCK;
-            //                printf("[ FAT_INIT ] : Setting RESERVED_BLOCK for block %d.\n", i);
-        } else {
-            //Otherwise set it to a free block
-            fat_array[i] = FREE_BLOCK;
-            //              printf("[ FAT_INIT ] : Setting FREE_BLOCK for block %d.\n", i);
+
+        for (uint64_t k = 0; k < run_pages; k++) {
+            uint32_t * page = wanted + k * page_entries;
+            if (memcmp(page, on_disk + k * page_entries, page_entries * sizeof(uint32_t)) == 0) {
+                continue;
+            }
+            if (write_page(page, p + k) != 0) {
+                ret = -1;
+                break;
+            }
+            written++;
         }
+    }
+    free(wanted);
+    free(on_disk);
+    if (ret != 0) {
+        free_cache();
+        return -1;
+    }
+    printf("[ FAT INIT ] : Wrote %llu of %llu pages of the FAT.\n", (ull_t) written, (ull_t) pages);
 
+    if (build_groups(NULL) != 0) {
+        free_cache();
+        return -1;
     }
 
+    // every count of the summary is new
+    memset(summary_dirty, 1, vcb->summary_size);
     printf("[ FAT INIT ] : FAT is being updated on disk\n");
     update_fat_on_disk();
 
@@ -94,225 +247,1703 @@ int fat_init(uint64_t number_of_blocks, uint64_t block_size) {
 }
 
 /**
- * This Function is used to read FAT from disk and stores it in memory
+ * This helper function fills a run of entries of a new FAT. Everything is
+ * free, then the reserved run is filled over and the two ends are marked.
  *
- * @param path - A directory entry pointer dir that we want to free
+ * @param entries - receives the entries
+ * @param first - the block of the first entry
+ * @param count - how many entries
+ * @param number_of_blocks - blocks of the volume, entries past it stay free
  *
- * @return - succesfully read fat from disk and allocated memory return 0
- *         - if failed to allocate memory for fat return -1
+ * @return - void
+ */
+static void fill_entries(uint32_t * entries, uint64_t first, uint64_t count, uint64_t number_of_blocks) {
+    uint64_t end = first + count;
+
+    // FREE_BLOCK is all zero bits and RESERVED_BLOCK all one bits
+    memset(entries, 0, count * sizeof(uint32_t));
+    if (first < vcb->reserved_blocks_count) {
+        uint64_t to = vcb->reserved_blocks_count < end ? vcb->reserved_blocks_count : end;
+        memset(entries, 0xFF, (to - first) * sizeof(uint32_t));
+    }
+
+    // block 0 holds the VCB and the last block ends the volume
+    if (first == 0) {
+        entries[0] = EOF_BLOCK;
+    }
+    if (number_of_blocks - 1 >= first && number_of_blocks - 1 < end) {
+        entries[number_of_blocks - 1 - first] = EOF_BLOCK;
+    }
+}
+
+/**
+ * This Function is used to mount the FAT. Only the free count summary is
+ * read, pages of the FAT are read when a chain or a search reaches them.
+ *
+ * @return - succesfully read the summary from disk return 0
+ *         - if failed to allocate memory or to read return -1
  *         
  */
 int fat_read_from_disk() {
-    printf("[ FAT READ ] : Trying to read %d blocks of size %d\n", vcb->FAT_size_32, vcb->bytes_per_block);
+    printf("[ FAT READ ] : Reading the free count summary, %llu blocks of size %d\n",
+        (ull_t) vcb->summary_size, bytes_per_block);
+
+    if (setup_cache(bytes_per_block) != 0) {
+        return -1;
+    }
 
-    //allocating memory for the fat to be able to read to disk
-    fat_array = (int*) malloc(vcb->FAT_size_32 * vcb->bytes_per_block);
-    if (fat_array == NULL) {
-        fprintf(stderr, "[ FAT READ ] : Failed to allocate memory for FAT.\n");
+    uint32_t * counts = malloc(vcb->summary_size * block_bytes);
+    if (counts == NULL) {
+        fprintf(stderr, "[ FAT READ ] : Failed to allocate memory for the summary.\n");
+        free_cache();
         return -1;
     }
 
     //reading from diskk
-    if (LBAread(fat_array, vcb->FAT_size_32, FAT_BLOCK_START_LOCATION) != vcb->FAT_size_32) {
-        fprintf(stderr, "[ FAT READ ] : Failed to read FAT from disk but was able to allocate memory.\n");
-        free(fat_array);
-        fat_array = NULL;
+    uint64_t summary_start = FAT_BLOCK_START_LOCATION + vcb->FAT_size;
+    if (elv_read(counts, vcb->summary_size, summary_start) != vcb->summary_size) {
+        fprintf(stderr, "[ FAT READ ] : Failed to read the free count summary from disk.\n");
+        free(counts);
+        free_cache();
         return -1;
     }
 
-    printf("[ FAT READ ] : Successfully read FAT from disk and allocated memory.\n");
+    int ret = build_groups(counts);
+    free(counts);
+    if (ret != 0) {
+        free_cache();
+        return -1;
+    }
+
+    printf("[ FAT READ ] : Pages of %u entries, at most %d kept in memory.\n", page_entries, FAT_CACHE_PAGES);
     return 0;
 }
 
 /**
- * This Function is used to searches the fat array for a free block
+ * This Function is used to size the free count summary of a volume
  *
+ * @param number_of_blocks - blocks of the volume
+ * @param block_size - bytes of a block
  *
- * @return - succesful return index
- *         - if otherwise return -1
+ * @return - blocks the summary takes, enough for a group per FAT_GROUP_BLOCKS blocks
  *         
  */
-uint32_t find_free_block() {
-//    printf("[ FIND FREE BLOCK ] : Searching for a free block...\n");
-    int block_index = -1;
+uint64_t fat_summary_blocks(uint64_t number_of_blocks, uint64_t block_size) {
+    uint64_t groups_max = (number_of_blocks + FAT_GROUP_BLOCKS - 1) / FAT_GROUP_BLOCKS;
+    return (groups_max * sizeof(uint32_t) + block_size - 1) / block_size;
+}
 
-    for (int i = vcb->reserved_blocks_count; i < vcb->total_blocks_32; i++) {
-        if (fat_array[i] == FREE_BLOCK) {
-   //        printf("[ FIND FREE BLOCK ] : Free block found at index %d\n", i);
-            block_index = i;
-            fat_array[i] = RESERVED_BLOCK;
-            return block_index;
-        }
+/**
+ * This helper function sizes the pages for the block size and empties the
+ * page cache. A page is at least FAT_PAGE_ENTRIES entries and whole blocks.
+ *
+ * @param block_size - bytes of a block
+ *
+ * @return - 0 on success, -1 if memory ran out
+ */
+static int setup_cache(uint32_t block_size) {
+    free_cache();
+    block_bytes = block_size;
+    page_blocks = (FAT_PAGE_ENTRIES * sizeof(uint32_t) + block_size - 1) / block_size;
+    page_entries = page_blocks * block_size / sizeof(uint32_t);
+    // blocks are powers of 2, so the page of an entry is a shift away
+    page_shift = 0;
+    while ((1U << page_shift) < page_entries) {
+        page_shift++;
     }
-    fprintf(stderr, "[ FIND FREE BLOCK ] : No free blocks available.\n");
-    return block_index;
+    memset(&cache_stats, 0, sizeof(cache_stats));
+    discard_supported = 1;
+
+    summary_dirty = calloc(vcb->summary_size, 1);
+    if (summary_dirty == NULL) {
+        fprintf(stderr, "[ FAT CACHE ] : Failed to allocate the summary flags.\n");
+        return -1;
+    }
+    return 0;
 }
 
 /**
- * This Function is used to Allocate a given number of blocks, returns the starting block.
+ * This helper function drops every page in memory, the groups and the
+ * summary flags, pages that changed are not written
  *
- * @param blocks_needed - A int the contains how many blocks needed for allocating
+ * @return - void
+ */
+static void free_cache() {
+    free_groups();
+    fat_page * frame = lru_head;
+    while (frame != NULL) {
+        fat_page * next = frame->lru_next;
+        free(frame->entries);
+        free(frame);
+        frame = next;
+    }
+    memset(page_hash, 0, sizeof(page_hash));
+    lru_head = NULL;
+    lru_tail = NULL;
+    frame_count = 0;
+    free(summary_dirty);
+    summary_dirty = NULL;
+    free(discard_runs);
+    discard_runs = NULL;
+    discard_count = 0;
+    discard_capacity = 0;
+}
+
+/**
+ * This helper function frees the allocation groups
  *
- * @return - succesfully allocated return the starting block
- *         - if failed to allocate blocks return -1
- *         
+ * @return - void
  */
-uint32_t allocate_blocks(int blocks_needed) {
-    printf("[ ALLOCATE_BLOCKS ] : Allocating blocks_needed = %d.\n", blocks_needed);
+static void free_groups() {
+    for (int g = 0; g < group_count; g++) {
+        pthread_mutex_destroy(&groups[g].lock);
+    }
+    free(groups);
+    groups = NULL;
+    group_count = 0;
+    __atomic_store_n(&total_free, 0, __ATOMIC_RELAXED);
+}
 
-    if (blocks_needed <= 0 || blocks_needed > get_total_free_blocks()) {
-        printf("[ ALLOCATE_BLOCKS ] : Invalid blocks_needed.\n");
-        return -1;
+/**
+ * This helper function splits the data blocks into allocation groups
+ * and sets the free count of every group
+ *
+ * @param counts - the free count of every group from the summary, NULL on a
+ *                 new volume where only the last block is taken
+ *
+ * @return - 0 on success, -1 if memory ran out
+ */
+static int build_groups(const uint32_t * counts) {
+    free_groups();
+
+    uint32_t first = vcb->reserved_blocks_count;
+    uint32_t last = vcb->total_blocks;
+    int count = (last - first + FAT_GROUP_BLOCKS - 1) / FAT_GROUP_BLOCKS;
+    if (count < 1) {
+        count = 1;
     }
 
-    uint32_t *blocks_found = (uint32_t *)malloc(blocks_needed * sizeof(uint32_t));
-    if (blocks_found == NULL) {
-        printf("[ ALLOCATE_BLOCKS ] : Failed to allocate memory.\n");
+    groups = malloc(count * sizeof(fat_group));
+    if (groups == NULL) {
+        fprintf(stderr, "[ FAT GROUPS ] : Failed to allocate the allocation groups.\n");
         return -1;
     }
 
-    int blocks = 0;
-    while (blocks < blocks_needed) {
-        int free_block_index = find_free_block();
-        if (free_block_index == -1) {
-            printf("[ ALLOCATE_BLOCKS ] : No more free blocks.\n");
-            free(blocks_found);
-            return -1;
+    uint32_t total = 0;
+    for (int g = 0; g < count; g++) {
+        fat_group * grp = &groups[g];
+        pthread_mutex_init(&grp->lock, NULL);
+        grp->start = first + g * FAT_GROUP_BLOCKS;
+        grp->end = grp->start + FAT_GROUP_BLOCKS;
+        if (grp->end > last) {
+            grp->end = last;
         }
-        blocks_found[blocks] = free_block_index;
-        blocks++;
+        uint32_t size = grp->end - grp->start;
+        if (counts == NULL) {
+            // the last block of the volume is marked EOF
+            grp->free_count = grp->end == last ? size - 1 : size;
+        } else {
+            grp->free_count = counts[g] <= size ? counts[g] : size;
+        }
+        grp->hint = grp->start;
+        grp->discard_start = grp->start;
+        grp->discard_end = grp->start;
+        total += grp->free_count;
     }
+    group_count = count;
+    __atomic_store_n(&total_free, total, __ATOMIC_RELAXED);
 
-    uint32_t start_block = blocks_found[0];
+    printf("[ FAT GROUPS ] : %d allocation groups of %d blocks.\n", group_count, FAT_GROUP_BLOCKS);
+    return 0;
+}
 
-    if (blocks_needed != 1) {
-        for (int i = 0; i < blocks - 1; i++) { 
-            if (blocks_found[i] == vcb->total_blocks_32 - 1) {
-                printf("[ ALLOCATE_BLOCKS ] : Last block in FAT, can't link to the next block.\n");
-                break;
-            }
-            fat_array[blocks_found[i]] = blocks_found[i + 1];
-        }
+/**
+ * This helper function finds the allocation group of a data block
+ *
+ * @param block - the block
+ *
+ * @return - index of the group
+ */
+static int group_of(uint32_t block) {
+    if (block < groups[0].start) {
+        return 0;
     }
+    int g = (block - groups[0].start) / FAT_GROUP_BLOCKS;
+    return g < group_count ? g : group_count - 1;
+}
 
-    fat_array[blocks_found[blocks - 1]] = EOF_BLOCK;
+/**
+ * This helper function returns the group the calling thread allocates from,
+ * threads are spread over the groups in the order they first allocate
+ *
+ * @return - index of the group
+ */
+static int home_group() {
+    if (thread_group < 0) {
+        thread_group = __sync_fetch_and_add(&next_thread_group, 1);
+    }
+    return thread_group % group_count;
+}
 
-    printf("[ ALLOCATE_BLOCKS ] : Updating FAT.\n");
-    update_fat_on_disk();
+/**
+ * This helper function changes the free count of a group and the total, and
+ * flags the summary block of the group. The caller holds the lock of the group.
+ *
+ * @param g - index of the group
+ * @param delta - blocks freed, less than 0 for blocks taken
+ *
+ * @return - void
+ */
+static void change_free_count(int g, int delta) {
+    groups[g].free_count += delta;
+    __atomic_add_fetch(&total_free, (uint32_t) delta, __ATOMIC_RELAXED);
+    uint64_t block = GEO_BLOCK_OF((uint64_t) g * sizeof(uint32_t));
+    // groups that share a summary block hold different locks
+    __atomic_store_n(&summary_dirty[block], 1, __ATOMIC_RELAXED);
+}
 
-    free(blocks_found);
+/**
+ * This helper function finds a loaded page, the caller holds the cache lock
+ * or the hash lock
+ *
+ * @param page - the page of the FAT
+ *
+ * @return - the frame that holds it, NULL if it is not loaded
+ */
+static fat_page * find_page(uint32_t page) {
+    fat_page * frame = page_hash[page % FAT_HASH_BUCKETS];
+    while (frame != NULL && frame->page != page) {
+        frame = frame->hash_next;
+    }
+    return frame;
+}
 
-    return start_block;
+/**
+ * This helper function moves a frame to the front of the LRU list, the
+ * caller holds the cache lock
+ *
+ * @param frame - the frame just used
+ *
+ * @return - void
+ */
+static void touch_page(fat_page * frame) {
+    if (lru_head == frame) {
+        return;
+    }
+    if (frame->lru_prev != NULL) {
+        frame->lru_prev->lru_next = frame->lru_next;
+    }
+    if (frame->lru_next != NULL) {
+        frame->lru_next->lru_prev = frame->lru_prev;
+    }
+    if (lru_tail == frame) {
+        lru_tail = frame->lru_prev;
+    }
+    frame->lru_prev = NULL;
+    frame->lru_next = lru_head;
+    if (lru_head != NULL) {
+        lru_head->lru_prev = frame;
+    }
+    lru_head = frame;
+    if (lru_tail == NULL) {
+        lru_tail = frame;
+    }
 }
 
 /**
- * This Function is used to Allocate a given number of blocks, returns the void
+ * This helper function puts a frame in the bucket of the page it will hold,
+ * the caller holds the cache lock
  *
- * @param first_block - A first block in chain
- * @param blocks_to_allocate - how many blocks you need to allocate
+ * @param frame - an empty frame
+ * @param page - the page of the FAT
  *
  * @return - void
- *         
  */
-void allocate_additional_blocks(uint32_t first_block, int blocks_to_allocate) {
-    int curr_index = first_block;
+static void hash_page(fat_page * frame, uint32_t page) {
+    pthread_rwlock_wrlock(&hash_lock);
+    frame->page = page;
+    frame->hash_next = page_hash[page % FAT_HASH_BUCKETS];
+    page_hash[page % FAT_HASH_BUCKETS] = frame;
+    pthread_rwlock_unlock(&hash_lock);
+}
 
-    //Get to the EOF BLOCK
-    while (fat_array[curr_index] != EOF_BLOCK) {
-        curr_index = fat_array[curr_index];
+/**
+ * This helper function takes the hash link of a frame out of its bucket,
+ * the caller holds the cache lock. Readers of the entries without the cache
+ * lock are done once it has the hash lock.
+ *
+ * @param frame - the frame that stops holding its page
+ *
+ * @return - void
+ */
+static void unhash_page(fat_page * frame) {
+    pthread_rwlock_wrlock(&hash_lock);
+    fat_page ** link = &page_hash[frame->page % FAT_HASH_BUCKETS];
+    while (*link != frame) {
+        link = &(*link)->hash_next;
     }
+    *link = frame->hash_next;
+    frame->hash_next = NULL;
+    frame->page = NO_PAGE;
+    pthread_rwlock_unlock(&hash_lock);
+}
 
-    // allocate new chain with desired amount of blocks
-    uint32_t first_new_block = allocate_blocks(blocks_to_allocate);
+/**
+ * This helper function finds a frame for a page to load, the caller holds
+ * the cache lock. A new frame is made while there are fewer than
+ * FAT_CACHE_PAGES, then the least recently used page nobody pinned is
+ * dropped, after it is written if it changed. A page that chain walks read
+ * since it was last passed over goes back to the front instead. When every
+ * page is pinned the cache grows past its bound.
+ *
+ * @return - an empty frame in the LRU list, NULL if memory ran out
+ */
+static fat_page * take_frame() {
+    fat_page * frame = NULL;
+    if (frame_count >= FAT_CACHE_PAGES) {
+        // two passes, the first may only clear referenced flags
+        fat_page * candidate = lru_tail;
+        for (int seen = 0; candidate != NULL && seen < 2 * frame_count; seen++) {
+            fat_page * prev = candidate->lru_prev;
+            if (candidate->pins == 0) {
+                if (!__atomic_exchange_n(&candidate->referenced, 0, __ATOMIC_RELAXED)) {
+                    frame = candidate;
+                    break;
+                }
+                touch_page(candidate);
+            }
+            candidate = prev != NULL ? prev : lru_tail;
+        }
+    }
 
-    //if fail to allocate additional blocks
-    if (first_new_block == -1) {
-        fprintf(stderr, "Failed to allocate additional blocks.\n");
-        return;
+    if (frame == NULL) {
+        frame = calloc(1, sizeof(fat_page));
+        if (frame == NULL) {
+            return NULL;
+        }
+        frame->entries = malloc(page_blocks * block_bytes);
+        if (frame->entries == NULL) {
+            free(frame);
+            return NULL;
+        }
+        frame->page = NO_PAGE;
+        frame->lru_prev = lru_tail;
+        if (lru_tail != NULL) {
+            lru_tail->lru_next = frame;
+        }
+        lru_tail = frame;
+        if (lru_head == NULL) {
+            lru_head = frame;
+        }
+        frame_count++;
+        return frame;
     }
 
-    // link the end of current chain to beginning of new one
-    fat_array[curr_index] = first_new_block;
-    update_fat_on_disk();
+    if (frame->dirty) {
+        // data its chains point at goes to disk first, as in write_fat
+        elv_barrier();
+        write_page(frame->entries, frame->page);
+        elv_barrier();
+        frame->dirty = 0;
+        cache_stats.writebacks++;
+    }
+    if (frame->page != NO_PAGE) {
+        unhash_page(frame);
+        cache_stats.evictions++;
+    }
+    return frame;
 }
 
 /**
- * This Function is used to frees blocks using the index stored at the given position in fat unti EOF
+ * This helper function pins the loaded frame of a page, reading the page
+ * when it is not in memory. The caller holds the cache lock, it is dropped
+ * while the page is read and while another thread reads it.
  *
- * @param first_block - A first block in chain
+ * @param page - the page of the FAT
  *
- * @return - amount of blocks that you freed
- *         
+ * @return - the pinned frame, NULL if the page could not be read
  */
-uint32_t release_blocks(int first_block) {
+static fat_page * get_page(uint32_t page) {
+    fat_page * frame = find_page(page);
+    if (frame != NULL) {
+        frame->pins++;
+        while (__atomic_load_n(&frame->loading, __ATOMIC_ACQUIRE)) {
+            pthread_cond_wait(&page_loaded, &cache_lock);
+        }
+        if (frame->page != page) {
+            // the read failed and the frame was taken out of the hash
+            frame->pins--;
+            return NULL;
+        }
+        __atomic_fetch_add(&cache_stats.hits, 1, __ATOMIC_RELAXED);
+        metrics_count(MC_FAT_PAGE_HIT);
+        touch_page(frame);
+        return frame;
+    }
 
-    int curr_index = first_block;
-    int blocks_freed = 0;
+    frame = take_frame();
+    if (frame == NULL) {
+        TRACE_ERROR("[ FAT CACHE ] : Failed to allocate a page.\n");
+        return NULL;
+    }
+    frame->pins = 1;
+    frame->referenced = 0;
+    __atomic_store_n(&frame->loading, 1, __ATOMIC_RELAXED);
+    hash_page(frame, page);
+    touch_page(frame);
+    cache_stats.misses++;
+    metrics_count(MC_FAT_PAGE_MISS);
+    pthread_mutex_unlock(&cache_lock);
 
-    //looping to get each block and free each one
-    while (fat_array[curr_index] != EOF_BLOCK) {
-        int next_index = fat_array[curr_index];
-        fat_array[curr_index] = FREE_BLOCK;
-        blocks_freed++;
-        curr_index = next_index;
+    // the last page may run past the end of the FAT
+    uint64_t first_block = (uint64_t) page * page_blocks;
+    uint64_t blocks = vcb->FAT_size - first_block < page_blocks ? vcb->FAT_size - first_block : page_blocks;
+    memset(frame->entries, 0, page_blocks * block_bytes);
+    int loaded = elv_read(frame->entries, blocks, FAT_BLOCK_START_LOCATION + first_block) == blocks;
+
+    pthread_mutex_lock(&cache_lock);
+    if (!loaded) {
+        unhash_page(frame);
+        frame->pins--;
     }
+    __atomic_store_n(&frame->loading, 0, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&page_loaded);
+    if (!loaded) {
+        TRACE_ERROR("[ FAT CACHE ] : Failed to read page %u of the FAT.\n", page);
+        return NULL;
+    }
+    return frame;
+}
 
-    //updating the fat after freeing the blocks
-    update_fat_on_disk();
-    return blocks_freed;
+/**
+ * This helper function loads a page and pins it, it stays in memory until
+ * unpin_page
+ *
+ * @param page - the page of the FAT
+ *
+ * @return - the frame, NULL if the page could not be read
+ */
+static fat_page * pin_page(uint32_t page) {
+    pthread_mutex_lock(&cache_lock);
+    fat_page * frame = get_page(page);
+    pthread_mutex_unlock(&cache_lock);
+    return frame;
 }
 
 /**
- * This Function is used to retrieve the next block in the chain
+ * This helper function drops a pin taken by pin_page
  *
- * @param current_block - THe current block in chain
+ * @param frame - the pinned frame, NULL does nothing
  *
- * @return - the next block in the chain from the fat array
- *         
+ * @return - void
  */
-uint32_t get_next_block(int current_block) {
-    return fat_array[current_block];
+static void unpin_page(fat_page * frame) {
+    if (frame == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&cache_lock);
+    frame->pins--;
+    pthread_mutex_unlock(&cache_lock);
 }
 
 /**
- * This Function is used to retrieve the Count of free blocks in the fat
+ * This helper function returns the entry of a block in a pinned page. The
+ * page held by the last call is kept when it has the block, otherwise it
+ * is unpinned and the page of the block is pinned in its place. A scan
+ * ends with unpin_page on the page it holds.
  *
+ * @param block - the block
+ * @param held - the page pinned by the last call, NULL at the start
  *
- * @return - the total amount of free blocks in fat
- *         
+ * @return - the entry, NULL if its page could not be read
  */
-uint32_t get_total_free_blocks() {
-    uint32_t free_blocks = 0;
-    for (int i = vcb->reserved_blocks_count; i < vcb->total_blocks_32; i++) {
-        if (fat_array[i] == FREE_BLOCK) {
-            free_blocks++;
+static uint32_t * entry_of(uint32_t block, fat_page ** held) {
+    uint32_t page = block >> page_shift;
+    if (*held == NULL || (*held)->page != page) {
+        unpin_page(*held);
+        *held = pin_page(page);
+        if (*held == NULL) {
+            return NULL;
         }
     }
-    return free_blocks;
+    return &(*held)->entries[block & (page_entries - 1)];
 }
 
 /**
- * This Function is used to compute blocks from blocks given
+ * This helper function queues the write of one page of the FAT
  *
- * @param current_block - The amount of bytes you want to convert
+ * @param entries - the entries of the page
+ * @param page - the page of the FAT
  *
- * @return - the converted amount of blocks
- *         
+ * @return - 0 on success, -1 if the write failed
  */
-int to_blocks(int bytes) {
-    printf("[ TO_BLOCKS ] : Converting bytes = %d to blocks.\n", bytes);
-    return (bytes + (vcb->bytes_per_block - 1)) / vcb->bytes_per_block;
+static int write_page(const uint32_t * entries, uint32_t page) {
+    uint64_t first_block = (uint64_t) page * page_blocks;
+    uint64_t blocks = vcb->FAT_size - first_block < page_blocks ? vcb->FAT_size - first_block : page_blocks;
+    if (elv_write((void *) entries, blocks, FAT_BLOCK_START_LOCATION + first_block) != blocks) {
+        TRACE_ERROR("[ FAT CACHE ] : Failed to write page %u of the FAT.\n", page);
+        return -1;
+    }
+    return 0;
 }
 
 /**
- * This Function is used to update fat
+ * This helper function takes free blocks from one group and marks them reserved.
+ * The search goes on from where the last one stopped, so blocks taken one
+ * after the other are next to each other on disk.
+ *
+ * @param g - index of the group
+ * @param out - receives the blocks taken
+ * @param wanted - the most blocks to take
+ *
+ * @return - number of blocks taken
+ */
+static int take_from_group(int g, uint32_t * out, int wanted) {
+    fat_group * grp = &groups[g];
+    fat_page * held = NULL;
+    int got = 0;
+
+    pthread_mutex_lock(&grp->lock);
+    uint32_t size = grp->end - grp->start;
+    uint32_t block = grp->hint;
+    for (uint32_t scanned = 0; scanned < size && got < wanted && grp->free_count > 0; scanned++) {
+        uint32_t * entry = entry_of(block, &held);
+        if (entry == NULL) {
+            break;
+        }
+        if (*entry == FREE_BLOCK && !in_discard(grp, block)) {
+            __atomic_store_n(entry, RESERVED_BLOCK, __ATOMIC_RELAXED);
+            __atomic_store_n(&held->dirty, 1, __ATOMIC_RELEASE);
+            change_free_count(g, -1);
+            out[got++] = block;
+        }
+        block++;
+        if (block == grp->end) {
+            block = grp->start;
+        }
+    }
+    grp->hint = block;
+    unpin_page(held);
+    pthread_mutex_unlock(&grp->lock);
+    return got;
+}
+
+/**
+ * This helper function takes free blocks starting with one group and
+ * moving on to the next groups when it runs out. Blocks being discarded
+ * are taken once their discard is sent.
+ *
+ * @param first_group - the group to try first
+ * @param out - receives the blocks taken
+ * @param wanted - the most blocks to take
+ *
+ * @return - number of blocks taken, less than wanted if the volume is full
+ */
+static int take_blocks(int first_group, uint32_t * out, int wanted) {
+    int got = 0;
+    do {
+        for (int k = 0; k < group_count && got < wanted; k++) {
+            got += take_from_group((first_group + k) % group_count, out + got, wanted - got);
+        }
+    } while (got < wanted && wait_for_discard());
+    return got;
+}
+
+/**
+ * This helper function changes one FAT entry under the lock of its group
+ *
+ * @param block - the entry to change
+ * @param value - the new value
  *
  * @return - void
+ */
+static void set_entry(uint32_t block, uint32_t value) {
+    int g = group_of(block);
+    fat_group * grp = &groups[g];
+    fat_page * held = NULL;
+    pthread_mutex_lock(&grp->lock);
+    uint32_t * entry = entry_of(block, &held);
+    if (entry != NULL) {
+        if (*entry == FREE_BLOCK && value != FREE_BLOCK) {
+            change_free_count(g, -1);
+        } else if (*entry != FREE_BLOCK && value == FREE_BLOCK) {
+            change_free_count(g, 1);
+        }
+        // get_next_block reads entries without the group lock
+        __atomic_store_n(entry, value, __ATOMIC_RELAXED);
+        __atomic_store_n(&held->dirty, 1, __ATOMIC_RELEASE);
+        unpin_page(held);
+    }
+    pthread_mutex_unlock(&grp->lock);
+}
+
+/**
+ * This Function is used to searches the fat array for a free block
+ *
+ *
+ * @return - succesful return index, the block is marked reserved
+ *         - if otherwise return -1
  *         
  */
-void update_fat_on_disk() {
-    //if not equal to vcb->FAT_size_32, then it means that the update on fat array has gone wrong
-    if (LBAwrite(fat_array, vcb->FAT_size_32, FAT_BLOCK_START_LOCATION) != vcb->FAT_size_32) {
-        fprintf(stderr, "Failed to update FAT on disk.\n");
+uint32_t find_free_block() {
+    uint32_t block_index;
+    if (take_blocks(home_group(), &block_index, 1) == 1) {
+        return block_index;
+    }
+    TRACE_WARN("[ FIND FREE BLOCK ] : No free blocks available.\n");
+    return -1;
+}
+
+/**
+ * This helper function takes and links a chain of blocks in memory only
+ *
+ * @param blocks_needed - A int the contains how many blocks needed for allocating
+ *
+ * @return - succesfully allocated return the starting block
+ *         - if failed to allocate blocks return -1
+ *         
+ */
+static uint32_t allocate_chain(int blocks_needed) {
+    TRACE_DEBUG("[ ALLOCATE_BLOCKS ] : Allocating blocks_needed = %d.\n", blocks_needed);
+
+    if (blocks_needed <= 0 || blocks_needed > count_unpromised()) {
+        TRACE_WARN("[ ALLOCATE_BLOCKS ] : Invalid blocks_needed %d.\n", blocks_needed);
+        return -1;
+    }
+
+    uint32_t *blocks_found = (uint32_t *)malloc(blocks_needed * sizeof(uint32_t));
+    if (blocks_found == NULL) {
+        TRACE_ERROR("[ ALLOCATE_BLOCKS ] : Failed to allocate memory.\n");
+        return -1;
+    }
+
+    int blocks = take_blocks(home_group(), blocks_found, blocks_needed);
+    if (blocks < blocks_needed) {
+        // another thread got the last blocks first, give back what we took
+        TRACE_WARN("[ ALLOCATE_BLOCKS ] : No more free blocks.\n");
+        for (int i = 0; i < blocks; i++) {
+            set_entry(blocks_found[i], FREE_BLOCK);
+        }
+        free(blocks_found);
+        return -1;
+    }
+
+    uint32_t start_block = blocks_found[0];
+    for (int i = 0; i < blocks - 1; i++) {
+        set_entry(blocks_found[i], blocks_found[i + 1]);
+    }
+    set_entry(blocks_found[blocks - 1], EOF_BLOCK);
+
+    free(blocks_found);
+    return start_block;
+}
+
+/**
+ * This Function is used to Allocate a given number of blocks, returns the starting block.
+ *
+ * @param blocks_needed - A int the contains how many blocks needed for allocating
+ *
+ * @return - succesfully allocated return the starting block
+ *         - if failed to allocate blocks return -1
+ *         
+ */
+uint32_t allocate_blocks(int blocks_needed) {
+    METRIC_SCOPE(M_ALLOCATE_BLOCKS);
+    uint32_t start_block = allocate_chain(blocks_needed);
+    if (start_block == -1) {
+        return -1;
+    }
+
+    TRACE_DEBUG("[ ALLOCATE_BLOCKS ] : Updating FAT.\n");
+    write_fat();
+    return start_block;
+}
+
+/**
+ * This Function is used to Allocate a given number of blocks, returns the void
+ *
+ * @param first_block - A first block in chain
+ * @param blocks_to_allocate - how many blocks you need to allocate
+ *
+ * @return - void
+ *         
+ */
+void allocate_additional_blocks(uint32_t first_block, int blocks_to_allocate) {
+    int curr_index = first_block;
+
+    //Get to the EOF BLOCK
+    while (get_next_block(curr_index) != EOF_BLOCK) {
+        curr_index = get_next_block(curr_index);
+    }
+
+    // allocate new chain with desired amount of blocks
+    uint32_t first_new_block = allocate_chain(blocks_to_allocate);
+
+    //if fail to allocate additional blocks
+    if (first_new_block == -1) {
+        TRACE_WARN("[ ALLOCATE_BLOCKS ] : Failed to allocate %d additional blocks.\n", blocks_to_allocate);
+        return;
+    }
+
+    // link the end of current chain to beginning of new one
+    set_entry(curr_index, first_new_block);
+    write_fat();
+}
+
+/**
+ * This Function is used to start a batch reservation for one file
+ *
+ * @param r - the reservation to set up
+ * @param near_block - a block of the file, its batches come from the same group
+ *
+ * @return - void
+ *         
+ */
+void fat_reservation_init(fat_reservation * r, uint32_t near_block) {
+    if (near_block >= groups[0].start && near_block < vcb->total_blocks) {
+        r->group = group_of(near_block);
+    } else {
+        r->group = home_group();
+    }
+    r->next = 0;
+    r->count = 0;
+}
+
+/**
+ * This Function is used to add one block to the end of a chain. It comes from
+ * the batch of the reservation, a new batch is taken when it is empty.
+ * The link is only made in memory, update_fat_on_disk writes it.
+ *
+ * @param last_block - the last block of the chain
+ * @param r - the reservation of the file
+ *
+ * @return - the new last block of the chain
+ *         - if the volume is full return -1
+ *         
+ */
+uint32_t allocate_next_block(uint32_t last_block, fat_reservation * r) {
+    if (r->next == r->count) {
+        r->next = 0;
+        r->count = take_blocks(r->group, r->blocks, FAT_BATCH_BLOCKS);
+        if (r->count == 0) {
+            TRACE_WARN("[ FAT RESERVE ] : No free blocks available.\n");
+            return -1;
+        }
+        // the next batch continues where this one ended
+        r->group = group_of(r->blocks[r->count - 1]);
+    }
+
+    uint32_t block = r->blocks[r->next++];
+    set_entry(block, EOF_BLOCK);
+    set_entry(last_block, block);
+    return block;
+}
+
+/**
+ * This Function is used to add a run of blocks to the end of a chain in one
+ * call. The blocks come from the group of the reservation and follow each
+ * other on disk when the group has room. The links are made in memory only.
+ *
+ * @param last_block - the last block of the chain
+ * @param blocks - how many blocks to add
+ * @param r - the reservation of the file
+ * @param out - receives the new blocks in chain order
+ *
+ * @return - blocks on success
+ *         - if the volume is full return -1, nothing is changed
+ *         
+ */
+int allocate_extent(uint32_t last_block, int blocks, fat_reservation * r, uint32_t * out) {
+    METRIC_SCOPE(M_ALLOCATE_EXTENT);
+    int got = 0;
+
+    // blocks left in the batch were taken for this file already
+    while (got < blocks && r->next < r->count) {
+        out[got++] = r->blocks[r->next++];
+    }
+    if (got < blocks) {
+        got += take_blocks(r->group, out + got, blocks - got);
+    }
+    if (got < blocks) {
+        TRACE_WARN("[ FAT EXTENT ] : Only %d of %d blocks available.\n", got, blocks);
+        for (int i = 0; i < got; i++) {
+            set_entry(out[i], FREE_BLOCK);
+        }
+        return -1;
+    }
+    r->group = group_of(out[blocks - 1]);
+
+    for (int i = 0; i < blocks - 1; i++) {
+        set_entry(out[i], out[i + 1]);
+    }
+    set_entry(out[blocks - 1], EOF_BLOCK);
+    set_entry(last_block, out[0]);
+    return blocks;
+}
+
+/**
+ * This Function is used to take a run of free blocks that follow each other
+ * on disk and link them as a new chain, in memory only. The search starts at
+ * near_block and wraps around to the first data block, so the run found is
+ * the first one at or after near_block.
+ *
+ * @param blocks - how many blocks the run needs
+ * @param near_block - where the search starts
+ *
+ * @return - the first block of the new chain
+ *         - if no free run is long enough return -1, nothing is changed
+ *         
+ */
+uint32_t allocate_contiguous(int blocks, uint32_t near_block) {
+    if (blocks <= 0 || blocks > count_unpromised()) {
+        return -1;
+    }
+
+    uint32_t first = groups[0].start;
+    uint32_t end = groups[group_count - 1].end;
+    if (near_block < first || near_block >= end) {
+        near_block = first;
+    }
+
+    lock_all_groups();
+    fat_page * held = NULL;
+    uint32_t start = -1;
+    uint32_t run = 0;
+    // from near_block to the end, then from the start to near_block, a run
+    // may cross near_block on the second pass
+    for (int pass = 0; pass < 2 && start == -1; pass++) {
+        uint32_t from = pass == 0 ? near_block : first;
+        uint32_t to = pass == 0 ? end : near_block + blocks - 1;
+        if (to > end) {
+            to = end;
+        }
+        run = 0;
+        uint32_t b = from;
+        while (b < to && start == -1) {
+            // the free count says when a group is full or empty without
+            // reading its pages
+            fat_group * grp = &groups[group_of(b)];
+            uint32_t group_to = grp->end < to ? grp->end : to;
+            if (grp->free_count == 0) {
+                run = 0;
+                b = group_to;
+                continue;
+            }
+            if (grp->free_count == grp->end - grp->start && grp->discard_start == grp->discard_end) {
+                if (run + (group_to - b) >= blocks) {
+                    start = b - run;
+                }
+                run += group_to - b;
+                b = group_to;
+                continue;
+            }
+            for (; b < group_to; b++) {
+                uint32_t * entry = entry_of(b, &held);
+                run = entry != NULL && *entry == FREE_BLOCK && !in_discard(grp, b) ? run + 1 : 0;
+                if (run == blocks) {
+                    start = b - blocks + 1;
+                    break;
+                }
+            }
+        }
+    }
+    if (start != -1) {
+        for (uint32_t i = 0; i < blocks; i++) {
+            uint32_t * entry = entry_of(start + i, &held);
+            if (entry == NULL) {
+                // a page of the run was dropped and can't be read back,
+                // the blocks taken so far are given back
+                for (uint32_t k = 0; k < i; k++) {
+                    uint32_t * undo = entry_of(start + k, &held);
+                    if (undo != NULL) {
+                        __atomic_store_n(undo, FREE_BLOCK, __ATOMIC_RELAXED);
+                        __atomic_store_n(&held->dirty, 1, __ATOMIC_RELEASE);
+                        change_free_count(group_of(start + k), 1);
+                    }
+                }
+                start = -1;
+                break;
+            }
+            __atomic_store_n(entry, i + 1 < blocks ? start + i + 1 : EOF_BLOCK, __ATOMIC_RELAXED);
+            __atomic_store_n(&held->dirty, 1, __ATOMIC_RELEASE);
+            change_free_count(group_of(start + i), -1);
+        }
+    }
+    unpin_page(held);
+    unlock_all_groups();
+    return start;
+}
+
+/**
+ * This Function is used to measure how the free space is split up
+ *
+ * @param extents - receives the number of runs of free blocks
+ * @param largest - receives the length of the longest run
+ *
+ * @return - void
+ *         
+ */
+void fat_free_extents(int * extents, int * largest) {
+    int count = 0;
+    int longest = 0;
+    int run = 0;
+
+    lock_all_groups();
+    fat_page * held = NULL;
+    for (int g = 0; g < group_count; g++) {
+        fat_group * grp = &groups[g];
+        // full and empty groups are measured from their free count
+        if (grp->free_count == 0) {
+            run = 0;
+            continue;
+        }
+        if (grp->free_count == grp->end - grp->start) {
+            if (run == 0) {
+                count++;
+            }
+            run += grp->free_count;
+            if (run > longest) {
+                longest = run;
+            }
+            continue;
+        }
+        for (uint32_t b = grp->start; b < grp->end; b++) {
+            uint32_t * entry = entry_of(b, &held);
+            if (entry != NULL && *entry == FREE_BLOCK) {
+                if (run == 0) {
+                    count++;
+                }
+                run++;
+                if (run > longest) {
+                    longest = run;
+                }
+            } else {
+                run = 0;
+            }
+        }
+    }
+    unpin_page(held);
+    unlock_all_groups();
+    *extents = count;
+    *largest = longest;
+}
+
+/**
+ * This Function is used to promise free blocks to buffered data, so its
+ * blocks can be chosen later without running out of space
+ *
+ * @param blocks - how many blocks to promise
+ *
+ * @return - 0 on success
+ *         - if not enough blocks are free return -1
+ *         
+ */
+int fat_reserve_space(int blocks) {
+    int ret = -1;
+    pthread_mutex_lock(&promise_mutex);
+    uint32_t free_blocks = get_total_free_blocks();
+    if (blocks_promised + blocks <= free_blocks) {
+        blocks_promised += blocks;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&promise_mutex);
+    return ret;
+}
+
+/**
+ * This Function is used to take back a promise made by fat_reserve_space,
+ * after the blocks were allocated or the data was dropped
+ *
+ * @param blocks - how many blocks were promised
+ *
+ * @return - void
+ *         
+ */
+void fat_unreserve_space(int blocks) {
+    pthread_mutex_lock(&promise_mutex);
+    blocks_promised -= blocks;
+    pthread_mutex_unlock(&promise_mutex);
+}
+
+/**
+ * This helper function counts the free blocks nobody was promised
+ *
+ * @return - the free blocks left for new allocations
+ *         
+ */
+static uint32_t count_unpromised() {
+    uint32_t free_blocks = get_total_free_blocks();
+    pthread_mutex_lock(&promise_mutex);
+    uint32_t promised = blocks_promised;
+    pthread_mutex_unlock(&promise_mutex);
+    return free_blocks > promised ? free_blocks - promised : 0;
+}
+
+/**
+ * This Function is used to give the unused blocks of a reservation back
+ *
+ * @param r - the reservation
+ *
+ * @return - number of blocks given back
+ *         
+ */
+int fat_reservation_release(fat_reservation * r) {
+    int released = r->count - r->next;
+    for (int i = r->next; i < r->count; i++) {
+        set_entry(r->blocks[i], FREE_BLOCK);
+    }
+    r->next = 0;
+    r->count = 0;
+    return released;
+}
+
+/**
+ * This Function is used to frees blocks using the index stored at the given position in fat unti EOF
+ *
+ * @param first_block - A first block in chain
+ *
+ * @return - amount of blocks that you freed
+ *         
+ */
+uint32_t release_blocks(int first_block) {
+
+    int curr_index = first_block;
+    int blocks_freed = 0;
+
+    //looping to get each block and free each one
+    while (get_next_block(curr_index) != EOF_BLOCK) {
+        int next_index = get_next_block(curr_index);
+        set_entry(curr_index, FREE_BLOCK);
+        queue_discard(curr_index);
+        blocks_freed++;
+        curr_index = next_index;
+    }
+
+    //the last block of the chain holds the EOF marker, free it too
+    set_entry(curr_index, FREE_BLOCK);
+    queue_discard(curr_index);
+    blocks_freed++;
+
+    //updating the fat after freeing the blocks
+    write_fat();
+    run_discards(0);
+    return blocks_freed;
+}
+
+/**
+ * This Function is used to cut a chain after its first block, the blocks after it are freed
+ *
+ * @param first_block - A first block in chain, it stays allocated as the end of the chain
+ *
+ * @return - amount of blocks that you freed
+ *         
+ */
+uint32_t release_after(int first_block) {
+
+    int curr_index = get_next_block(first_block);
+    int blocks_freed = 0;
+    if (curr_index == EOF_BLOCK) {
+        return 0;
+    }
+    set_entry(first_block, EOF_BLOCK);
+
+    while (get_next_block(curr_index) != EOF_BLOCK) {
+        int next_index = get_next_block(curr_index);
+        set_entry(curr_index, FREE_BLOCK);
+        queue_discard(curr_index);
+        blocks_freed++;
+        curr_index = next_index;
+    }
+    set_entry(curr_index, FREE_BLOCK);
+    queue_discard(curr_index);
+    blocks_freed++;
+
+    write_fat();
+    run_discards(0);
+    return blocks_freed;
+}
+
+/**
+ * This Function is used to put another chain after the first block of a
+ * chain. The blocks that followed it are freed and the FAT is written once,
+ * so on disk the chain has either the old blocks or the new ones.
+ *
+ * @param first_block - A first block in chain, it stays in the chain
+ * @param new_chain - first block of the chain that follows it from now on
+ *
+ * @return - amount of blocks that you freed
+ *         
+ */
+uint32_t replace_after(int first_block, uint32_t new_chain) {
+
+    int curr_index = get_next_block(first_block);
+    int blocks_freed = 0;
+    set_entry(first_block, new_chain);
+
+    while (curr_index != EOF_BLOCK) {
+        int next_index = get_next_block(curr_index);
+        set_entry(curr_index, FREE_BLOCK);
+        queue_discard(curr_index);
+        blocks_freed++;
+        curr_index = next_index;
+    }
+
+    write_fat();
+    run_discards(0);
+    return blocks_freed;
+}
+
+/**
+ * This Function is used to retrieve the next block in the chain. A loaded
+ * page is read under the hash lock shared with the other walks, the page
+ * is only pinned through the cache lock when it has to be read.
+ *
+ * @param current_block - THe current block in chain
+ *
+ * @return - the next block in the chain from its page of the FAT
+ *         - EOF_BLOCK if the page could not be read, so walks stop
+ *         
+ */
+uint32_t get_next_block(int current_block) {
+    uint32_t page = (uint32_t) current_block >> page_shift;
+    uint32_t slot = current_block & (page_entries - 1);
+    uint32_t next = EOF_BLOCK;
+
+    pthread_rwlock_rdlock(&hash_lock);
+    fat_page * frame = find_page(page);
+    if (frame != NULL && !__atomic_load_n(&frame->loading, __ATOMIC_ACQUIRE)) {
+        next = __atomic_load_n(&frame->entries[slot], __ATOMIC_RELAXED);
+        __atomic_store_n(&frame->referenced, 1, __ATOMIC_RELAXED);
+        pthread_rwlock_unlock(&hash_lock);
+        __atomic_fetch_add(&cache_stats.hits, 1, __ATOMIC_RELAXED);
+        metrics_count(MC_FAT_PAGE_HIT);
+        return next;
+    }
+    pthread_rwlock_unlock(&hash_lock);
+
+    frame = pin_page(page);
+    if (frame != NULL) {
+        next = __atomic_load_n(&frame->entries[slot], __ATOMIC_RELAXED);
+        unpin_page(frame);
+    }
+    return next;
+}
+
+/**
+ * This Function is used to change the entry of one block in memory, the free
+ * count of its group follows. The FAT is written by update_fat_on_disk.
+ *
+ * @param current_block - The block to change
+ * @param next_block - the next block of the chain, EOF_BLOCK or FREE_BLOCK
+ *
+ * @return - void
+ *         
+ */
+void set_next_block(uint32_t current_block, uint32_t next_block) {
+    set_entry(current_block, next_block);
+}
+
+/**
+ * This Function is used to retrieve the Count of free blocks in the fat,
+ * kept as the groups change so no group is locked
+ *
+ *
+ * @return - the total amount of free blocks in fat
+ *         
+ */
+uint32_t get_total_free_blocks() {
+    return __atomic_load_n(&total_free, __ATOMIC_RELAXED);
+}
+
+/**
+ * This Function is used to compute blocks from blocks given
+ *
+ * @param current_block - The amount of bytes you want to convert
+ *
+ * @return - the converted amount of blocks
+ *         
+ */
+uint64_t to_blocks(uint64_t bytes) {
+    return GEO_BLOCKS(bytes);
+}
+
+/**
+ * This Function is used to update fat
+ *
+ * @return - void
+ *         
+ */
+void update_fat_on_disk() {
+    write_fat();
+}
+
+/**
+ * This Function is used to free the FAT when the file system exits
+ *
+ * @return - void
+ *         
+ */
+void fat_exit() {
+    free_cache();
+}
+
+/**
+ * This Function is used to count the free blocks of every group again from
+ * the FAT, for when the summary on disk can't be trusted. Every page is read.
+ *
+ * @return - the number of groups whose count was wrong
+ *         
+ */
+int fat_rebuild_summary() {
+    int wrong = 0;
+    for (int g = 0; g < group_count; g++) {
+        fat_group * grp = &groups[g];
+        fat_page * held = NULL;
+        uint32_t free_blocks = 0;
+        pthread_mutex_lock(&grp->lock);
+        for (uint32_t b = grp->start; b < grp->end; b++) {
+            uint32_t * entry = entry_of(b, &held);
+            if (entry != NULL && *entry == FREE_BLOCK) {
+                free_blocks++;
+            }
+        }
+        unpin_page(held);
+        if (free_blocks != grp->free_count) {
+            change_free_count(g, (int) (free_blocks - grp->free_count));
+            wrong++;
+        }
+        pthread_mutex_unlock(&grp->lock);
+    }
+    return wrong;
+}
+
+/**
+ * This Function is used to read the counters of the FAT page cache
+ *
+ * @param stats - receives the counters
+ *
+ * @return - void
+ *         
+ */
+void fat_get_stats(fat_cache_stats * stats) {
+    pthread_mutex_lock(&cache_lock);
+    *stats = cache_stats;
+    stats->hits = __atomic_load_n(&cache_stats.hits, __ATOMIC_RELAXED);
+    stats->pages = 0;
+    stats->dirty = 0;
+    for (fat_page * frame = lru_head; frame != NULL; frame = frame->lru_next) {
+        if (frame->page != NO_PAGE) {
+            stats->pages++;
+            stats->dirty += __atomic_load_n(&frame->dirty, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/**
+ * This Function is used to discard the freed blocks waiting in the batch
+ *
+ * @return - void
+ *         
+ */
+void fat_discard_flush() {
+    run_discards(1);
+}
+
+/**
+ * This Function is used to discard every free block of the volume, for
+ * blocks freed before discards were made or by fsck. Groups with every
+ * block free are discarded whole without reading their pages.
+ *
+ * @param extents - receives the runs of free blocks discarded
+ *
+ * @return - the blocks discarded
+ *         - if the host can't punch holes return -1
+ *         
+ */
+long fat_trim(long * extents) {
+    // the batch is part of the pass, and the FAT that frees every block
+    // discarded is on disk first
+    pthread_mutex_lock(&discard_mutex);
+    free(discard_runs);
+    discard_runs = NULL;
+    discard_count = 0;
+    discard_capacity = 0;
+    pthread_mutex_unlock(&discard_mutex);
+    write_fat();
+    elv_flush();
+
+    __atomic_store_n(&discard_supported, 1, __ATOMIC_RELAXED);
+    long runs = 0;
+    long blocks = discard_free_runs(groups[0].start, groups[group_count - 1].end, &runs);
+    *extents = runs;
+    return __atomic_load_n(&discard_supported, __ATOMIC_RELAXED) ? blocks : -1;
+}
+
+/**
+ * This helper function adds a freed block to the batch of discards
+ *
+ * @param block - the block just freed
+ *
+ * @return - void
+ */
+static void queue_discard(uint32_t block) {
+    pthread_mutex_lock(&discard_mutex);
+    if (!__atomic_load_n(&discard_supported, __ATOMIC_RELAXED)) {
+        pthread_mutex_unlock(&discard_mutex);
+        return;
+    }
+    fat_discard * last = discard_count > 0 ? &discard_runs[discard_count - 1] : NULL;
+    if (last != NULL && last->start + last->count == block) {
+        last->count++;
+    } else {
+        if (discard_count == discard_capacity) {
+            int capacity = discard_capacity > 0 ? discard_capacity * 2 : 64;
+            fat_discard * runs = realloc(discard_runs, capacity * sizeof(fat_discard));
+            if (runs == NULL) {
+                // the block keeps its space until a trim
+                pthread_mutex_unlock(&discard_mutex);
+                return;
+            }
+            discard_runs = runs;
+            discard_capacity = capacity;
+        }
+        discard_runs[discard_count].start = block;
+        discard_runs[discard_count].count = 1;
+        discard_count++;
+    }
+    pthread_mutex_unlock(&discard_mutex);
+}
+
+/**
+ * This helper function orders two runs by their first block, for qsort
+ *
+ * @return - less than, equal to or more than 0
+ */
+static int compare_discards(const void * a, const void * b) {
+    uint32_t x = ((const fat_discard *) a)->start;
+    uint32_t y = ((const fat_discard *) b)->start;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * This helper function sends the batch of discards. The runs are sorted and
+ * merged, and the queued writes are flushed first so the FAT that frees the
+ * blocks is on disk before their data is gone.
+ *
+ * @param force - 1 to send the batch however small it is
+ *
+ * @return - void
+ */
+static void run_discards(int force) {
+    pthread_mutex_lock(&discard_mutex);
+    if (discard_count == 0 || (!force && discard_count < FAT_DISCARD_BATCH)) {
+        pthread_mutex_unlock(&discard_mutex);
+        return;
+    }
+    fat_discard * runs = discard_runs;
+    int count = discard_count;
+    discard_runs = NULL;
+    discard_count = 0;
+    discard_capacity = 0;
+    pthread_mutex_unlock(&discard_mutex);
+
+    qsort(runs, count, sizeof(fat_discard), compare_discards);
+    elv_flush();
+
+    long done = 0;
+    int i = 0;
+    while (i < count) {
+        uint32_t start = runs[i].start;
+        uint32_t end = start + runs[i].count;
+        // runs that touch or overlap go out as one
+        for (i++; i < count && runs[i].start <= end; i++) {
+            if (runs[i].start + runs[i].count > end) {
+                end = runs[i].start + runs[i].count;
+            }
+        }
+        discard_free_runs(start, end, &done);
+    }
+    free(runs);
+}
+
+/**
+ * This helper function discards the blocks between start and end that are
+ * still free. The runs are looked up under the group locks, merged across
+ * groups, and sent with no lock held.
+ *
+ * @param start - the first block
+ * @param end - one past the last block
+ * @param runs - counts the runs of free blocks discarded
+ *
+ * @return - the blocks discarded
+ */
+static long discard_free_runs(uint32_t start, uint32_t end, long * runs) {
+    fat_discard found[FAT_DISCARD_RUNS];
+    long discarded = 0;
+    uint32_t b = start;
+
+    pthread_mutex_lock(&discard_send_mutex);
+    while (b < end && __atomic_load_n(&discard_supported, __ATOMIC_RELAXED)) {
+        int count = collect_free_runs(&b, end, found, FAT_DISCARD_RUNS);
+        for (int i = 0; i < count; i++) {
+            long sent = discard_run(found[i], runs);
+            if (sent == -1) {
+                break;
+            }
+            discarded += sent;
+        }
+    }
+    pthread_mutex_unlock(&discard_send_mutex);
+    return discarded;
+}
+
+/**
+ * This helper function looks up the runs of free blocks from a block on,
+ * each group under its lock. A run that reaches the end of a group goes on
+ * into the next one. Groups with every block free are not read.
+ *
+ * @param from - the first block, receives where the next look starts
+ * @param end - one past the last block
+ * @param found - receives the runs
+ * @param max - the most runs to find
+ *
+ * @return - the runs found
+ */
+static int collect_free_runs(uint32_t * from, uint32_t end, fat_discard * found, int max) {
+    int count = 0;
+    int full = 0;
+    uint32_t b = *from;
+    while (b < end && !full) {
+        fat_group * grp = &groups[group_of(b)];
+        uint32_t to = grp->end < end ? grp->end : end;
+        if (b < grp->start) {
+            b = grp->start;
+            continue;
+        }
+        fat_page * held = NULL;
+
+        pthread_mutex_lock(&grp->lock);
+        int whole = grp->free_count == grp->end - grp->start;
+        for (; b < to; b++) {
+            if (!whole) {
+                uint32_t * entry = entry_of(b, &held);
+                if (entry == NULL || *entry != FREE_BLOCK) {
+                    continue;
+                }
+            }
+            fat_discard * last = count > 0 ? &found[count - 1] : NULL;
+            if (last != NULL && last->start + last->count == b && last->count < FAT_DISCARD_RUN_BLOCKS) {
+                last->count++;
+                continue;
+            }
+            if (count == max) {
+                full = 1;
+                break;
+            }
+            found[count].start = b;
+            found[count].count = 1;
+            count++;
+        }
+        unpin_page(held);
+        pthread_mutex_unlock(&grp->lock);
+    }
+    *from = b;
+    return count;
+}
+
+/**
+ * This helper function discards a run that was found free. The groups it
+ * is in keep allocation away from it first, then the blocks still free are
+ * looked up again and discarded with no lock held, so a block allocated
+ * since the run was found keeps its data.
+ *
+ * @param run - the run
+ * @param runs - counts the runs of free blocks discarded
+ *
+ * @return - the blocks discarded
+ *         - if the host can't punch holes return -1
+ */
+static long discard_run(fat_discard run, long * runs) {
+    uint32_t end = run.start + run.count;
+    int first = group_of(run.start);
+    int last = group_of(end - 1);
+    pthread_mutex_lock(&discard_mutex);
+    discard_claimed = 1;
+    pthread_mutex_unlock(&discard_mutex);
+    for (int g = first; g <= last; g++) {
+        fat_group * grp = &groups[g];
+        pthread_mutex_lock(&grp->lock);
+        grp->discard_start = run.start > grp->start ? run.start : grp->start;
+        grp->discard_end = end < grp->end ? end : grp->end;
+        pthread_mutex_unlock(&grp->lock);
+    }
+
+    fat_discard still[FAT_DISCARD_RUNS];
+    long discarded = 0;
+    uint32_t b = run.start;
+    while (b < end && discarded != -1) {
+        int count = collect_free_runs(&b, end, still, FAT_DISCARD_RUNS);
+        for (int i = 0; i < count; i++) {
+            if (elv_discard(still[i].count, still[i].start) != still[i].count) {
+                __atomic_store_n(&discard_supported, 0, __ATOMIC_RELAXED);
+                discarded = -1;
+                break;
+            }
+            discarded += still[i].count;
+            (*runs)++;
+            pthread_mutex_lock(&cache_lock);
+            cache_stats.discards++;
+            cache_stats.discarded_blocks += still[i].count;
+            pthread_mutex_unlock(&cache_lock);
+        }
+    }
+
+    for (int g = first; g <= last; g++) {
+        fat_group * grp = &groups[g];
+        pthread_mutex_lock(&grp->lock);
+        grp->discard_start = grp->start;
+        grp->discard_end = grp->start;
+        pthread_mutex_unlock(&grp->lock);
+    }
+    pthread_mutex_lock(&discard_mutex);
+    discard_claimed = 0;
+    pthread_cond_broadcast(&discard_sent);
+    pthread_mutex_unlock(&discard_mutex);
+    return discarded;
+}
+
+/**
+ * This helper function says whether a free block is being discarded,
+ * called with the lock of its group
+ *
+ * @param grp - the group of the block
+ * @param block - the block
+ *
+ * @return - 1 if allocation has to leave it alone, 0 if not
+ */
+static int in_discard(const fat_group * grp, uint32_t block) {
+    return block >= grp->discard_start && block < grp->discard_end;
+}
+
+/**
+ * This helper function waits for the run being discarded to be sent, for
+ * an allocation that found too few blocks
+ *
+ * @return - 1 if a run was being discarded and can be taken now
+ *         - 0 if none was, the blocks are not there
+ */
+static int wait_for_discard() {
+    pthread_mutex_lock(&discard_mutex);
+    int waited = discard_claimed;
+    while (discard_claimed) {
+        pthread_cond_wait(&discard_sent, &discard_mutex);
+    }
+    pthread_mutex_unlock(&discard_mutex);
+    return waited;
+}
+
+/**
+ * This helper function takes the lock of every group, in group order
+ *
+ * @return - void
+ */
+static void lock_all_groups() {
+    for (int g = 0; g < group_count; g++) {
+        pthread_mutex_lock(&groups[g].lock);
+    }
+}
+
+/**
+ * This helper function drops the locks taken by lock_all_groups
+ *
+ * @return - void
+ */
+static void unlock_all_groups() {
+    for (int g = group_count - 1; g >= 0; g--) {
+        pthread_mutex_unlock(&groups[g].lock);
+    }
+}
+
+/**
+ * This helper function writes the pages of the FAT that changed and the
+ * blocks of the summary with a changed count. The pages that changed are
+ * pinned under the cache lock, so none of them is dropped and written by
+ * take_frame while an older copy of it waits here, and written after the
+ * lock is dropped. A dirty flag is cleared before its page is copied into
+ * the queue, so an entry changed during the copy leaves the page dirty for
+ * the next write. Each group is locked only while its count is read.
+ *
+ * @return - void
+ *         
+ */
+static void write_fat() {
+    uint32_t per_block = block_bytes / sizeof(uint32_t);
+    uint32_t * summary_buffer = malloc(block_bytes);
+    if (summary_buffer == NULL) {
+        TRACE_ERROR("[ FAT ] : Failed to update FAT on disk.\n");
+        return;
+    }
+
+    pthread_mutex_lock(&fat_io_mutex);
+    pthread_mutex_lock(&cache_lock);
+    fat_page ** pinned = malloc((frame_count + 1) * sizeof(fat_page *));
+    int count = 0;
+    if (pinned == NULL) {
+        pthread_mutex_unlock(&cache_lock);
+        pthread_mutex_unlock(&fat_io_mutex);
+        free(summary_buffer);
+        TRACE_ERROR("[ FAT ] : Failed to update FAT on disk.\n");
+        return;
+    }
+    for (fat_page * frame = lru_head; frame != NULL; frame = frame->lru_next) {
+        if (frame->page != NO_PAGE && __atomic_load_n(&frame->dirty, __ATOMIC_RELAXED)) {
+            frame->pins++;
+            pinned[count++] = frame;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    // data the new chains point at goes to disk before the FAT, and the
+    // FAT before any directory entry written after it
+    elv_barrier();
+    unsigned long written = 0;
+    for (int i = 0; i < count; i++) {
+        fat_page * frame = pinned[i];
+        // pairs with the release store of the thread that changed an entry
+        __atomic_exchange_n(&frame->dirty, 0, __ATOMIC_ACQ_REL);
+        if (write_page(frame->entries, frame->page) == 0) {
+            written++;
+        } else {
+            __atomic_store_n(&frame->dirty, 1, __ATOMIC_RELAXED);
+        }
+    }
+    uint64_t summary_start = FAT_BLOCK_START_LOCATION + vcb->FAT_size;
+    for (uint64_t i = 0; i < vcb->summary_size; i++) {
+        if (!__atomic_exchange_n(&summary_dirty[i], 0, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        memset(summary_buffer, 0, block_bytes);
+        for (uint32_t k = 0; k < per_block && i * per_block + k < group_count; k++) {
+            fat_group * grp = &groups[i * per_block + k];
+            pthread_mutex_lock(&grp->lock);
+            summary_buffer[k] = grp->free_count;
+            pthread_mutex_unlock(&grp->lock);
+        }
+        if (elv_write(summary_buffer, 1, summary_start + i) != 1) {
+            TRACE_ERROR("[ FAT ] : Failed to update the free count summary on disk.\n");
+            __atomic_store_n(&summary_dirty[i], 1, __ATOMIC_RELAXED);
+        }
+    }
+    elv_barrier();
+
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < count; i++) {
+        pinned[i]->pins--;
     }
+    cache_stats.writebacks += written;
+    pthread_mutex_unlock(&cache_lock);
+    pthread_mutex_unlock(&fat_io_mutex);
+    free(pinned);
+    free(summary_buffer);
 }
@@ -14,6 +14,7 @@
 **************************************************************/
 #ifndef __FAT_H__
 #define __FAT_H__
+#include <stdint.h>
 
 //Starting block of the FAT
 #define FAT_BLOCK_START_LOCATION 1
@@ -22,7 +23,54 @@
 #define RESERVED_BLOCK 0xFFFFFFFF
 #define EOF_BLOCK 0xFFFFFFFE
 
-extern int * fat_array; // keep a copy of FAT while program is running
+// Most blocks in a volume, entries are signed ints in memory and the
+// top values are the markers above
+#define FAT_MAX_BLOCKS 0x7FFFFFFFULL
+
+// Blocks in one allocation group. Every group has its own lock and free
+// count, threads and files allocate from their own group.
+#define FAT_GROUP_BLOCKS 2048
+// Blocks an open file takes from its group at a time
+#define FAT_BATCH_BLOCKS 16
+
+// The FAT is read in pages of FAT_PAGE_ENTRIES entries, or of one block when
+// a block holds more, and at most FAT_CACHE_PAGES pages are kept in memory.
+// Mount reads the free count of every group from the summary after the FAT.
+#define FAT_PAGE_ENTRIES 2048
+#define FAT_CACHE_PAGES 256
+#define FAT_HASH_BUCKETS 256
+
+// pages fat_init builds and compares with the volume at a time
+#define FAT_INIT_PAGES 64
+
+// Blocks freed from chains are discarded from the volume file by the
+// flusher when it finds nothing to write, sorted and merged into runs,
+// after the FAT that frees them is on disk. A thread that frees blocks
+// sends the batch itself once this many runs wait.
+#define FAT_DISCARD_BATCH 1024
+
+// counters of the FAT page cache since the file system started
+typedef struct fat_cache_stats
+	{
+	unsigned long hits;		// lookups of a page that was loaded
+	unsigned long misses;		// pages read from disk
+	unsigned long evictions;	// pages dropped to make room
+	unsigned long writebacks;	// pages written, by an eviction or a FAT update
+	int pages;			// pages loaded now
+	int dirty;			// loaded pages changed since they were written
+	unsigned long discards;		// runs of free blocks discarded
+	unsigned long discarded_blocks;	// blocks in those runs
+	} fat_cache_stats;
+
+// Blocks taken for one file ahead of its writes. They are reserved in the
+// FAT and handed out one at a time, so the file grows without contention.
+typedef struct fat_reservation
+	{
+	int group;			// group the next batch is taken from
+	int next;			// next unused block in blocks
+	int count;			// blocks in the batch
+	uint32_t blocks[FAT_BATCH_BLOCKS];
+	} fat_reservation;
 
 
 // upfates the FAT on disk
@@ -34,9 +82,28 @@ void update_fat_on_disk();
 // if memory allocation fails, an error message get logged and -1 returned.
 int fat_init(uint64_t number_of_blocks, uint64_t block_size);
 
-//load the fat from disk to memory
+//set up the FAT page cache and read the free count summary from disk,
+//pages of the FAT are read when they are used
 int fat_read_from_disk();
 
+//blocks of the free count summary for a volume of number_of_blocks blocks
+uint64_t fat_summary_blocks(uint64_t number_of_blocks, uint64_t block_size);
+
+//count the free blocks of every group again from the FAT, returns how
+//many groups had a wrong count. The summary is written with the FAT.
+int fat_rebuild_summary();
+
+//copy the counters of the FAT page cache into stats
+void fat_get_stats(fat_cache_stats * stats);
+
+//discard the freed blocks that wait in the batch, called by the flusher
+//when it is idle and at unmount
+void fat_discard_flush();
+
+//discard every free block of the volume. Returns the blocks discarded and
+//the runs they were in through extents, -1 if the host can't punch holes.
+long fat_trim(long * extents);
+
 // allocate new blocks in FAt, starts from first free block.
 // it logs an error if not enough free blocks to allocate and return -1.
 uint32_t allocate_blocks(int blocks_to_allocate);
@@ -44,13 +111,56 @@ uint32_t allocate_blocks(int blocks_to_allocate);
 //functin to free blocks from fat
 uint32_t release_blocks(int first_block);
 
+//function to free every block of a chain after the first one,
+//the first block becomes the end of the chain
+uint32_t release_after(int first_block);
+
+//function to put new_chain after the first block of a chain, the blocks
+//that followed it are freed
+uint32_t replace_after(int first_block, uint32_t new_chain);
+
 //function to allocate more blocks if needed
 void allocate_additional_blocks(uint32_t first_block, int blocks_to_allocate);
 
+// start a reservation, its batches come from the group of near_block
+void fat_reservation_init(fat_reservation * r, uint32_t near_block);
+
+// link one block from the reservation after last_block, in memory only.
+// returns the new block, -1 if the volume is full.
+uint32_t allocate_next_block(uint32_t last_block, fat_reservation * r);
+
+// link a run of blocks after last_block in one call, in memory only,
+// the new blocks are stored in out. returns blocks, -1 if the volume is full.
+int allocate_extent(uint32_t last_block, int blocks, fat_reservation * r, uint32_t * out);
+
+// take a run of blocks that follow each other on disk as a new chain, the
+// first free run at or after near_block, in memory only.
+// returns the first block, -1 if no run is long enough.
+uint32_t allocate_contiguous(int blocks, uint32_t near_block);
+
+// count the runs of free blocks and the length of the longest one
+void fat_free_extents(int * extents, int * largest);
+
+// promise free blocks to buffered data that gets its blocks later,
+// returns -1 if not enough blocks are free
+int fat_reserve_space(int blocks);
+
+// take back a promise once the blocks are allocated or the data is dropped
+void fat_unreserve_space(int blocks);
+
+// give the unused blocks of a reservation back, returns how many
+int fat_reservation_release(fat_reservation * r);
+
+// free the FAT and the allocation groups on exit
+void fat_exit();
+
 //function to get next block from fat
 uint32_t get_next_block(int current_block);
 
-// find first empty block in FAT
+//function to change the entry of a block in memory only, used by repairs
+void set_next_block(uint32_t current_block, uint32_t next_block);
+
+// find an empty block in FAT and mark it reserved
 uint32_t find_free_block();
 
 // check if a block is free, bby checking corresponding entry in the FAT
@@ -63,7 +173,7 @@ uint32_t get_total_free_blocks();
 
 // Function to compute blocks from 
 // bytes given
-int to_blocks(int bytes);
+uint64_t to_blocks(uint64_t bytes);
 
 #endif //__FAT_H__
 
@@ -21,170 +21,270 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include "b_io.h"
 #include "mfs.h"
 #include "FAT.h"
+#include "dir_cache.h"
+#include "vnode.h"
+#include "elevator.h"
+#include "geometry.h"
+#include "trace.h"
+#include "metrics.h"
+
+// Default maximum number of files that can be open at the same time,
+// it can be changed at build time or with b_set_max_open.
+#ifndef B_MAX_OPEN_DEFAULT
+#define B_MAX_OPEN_DEFAULT 65536
+#endif
+
+// Number of FCBs added to the table at a time when it grows.
+#define FCB_CHUNK_SLOTS 64
+
+// A file descriptor is the slot index in the low bits and the slot
+// generation above it, so a descriptor kept after b_close is caught.
+#define FD_INDEX_BITS 20
+#define FD_INDEX_MASK ((1 << FD_INDEX_BITS) - 1)
+#define FD_GEN_MASK 0x7FF
+
+// Size of the chunks that the system will use to read from or write to the files,
+// one block of the mounted volume, offsets are split with its shift and mask.
+#define B_CHUNK_SIZE GEO_SIZE
+
+// Most blocks read in one request when a read covers whole blocks that
+// follow each other on disk, so a read of many gigabytes does not hold
+// the elevator queue for the whole transfer.
+#define B_READ_RUN_BLOCKS 4096
 
-// Maximum number of file descriptors that can be open at the same time in the system.
-#define MAXFCBS 20
 
-// Size of the chunks that the system will use to read from or write to the files.
-#define B_CHUNK_SIZE 512
+// Definition of the File Control Block structure.
+typedef struct b_fcb
+{
+	/** TODO add al the information you need in the file control block **/
+	vnode *fi;			  // shared state of the file, one per open file
+	char *buf;			  // holds the open file buffer
+	int index;			  // holds the current position in the buffer
+	int buflen;			  // holds how many valid bytes are in the buffer
+	int buf_block;		  // block whose data is in the buffer, -1 when none
+	unsigned long buf_gen; // data_gen of the vnode when the buffer was filled
+	int current_location; // current block location
+	int blocks_read;	  // blocks read so far
+	off_t file_size_index; // file offset
+	int flags;			  // mark the purpose when open the file
+	int in_use;			  // 1 while the slot belongs to an open file
+	int generation;		  // bumped on every close, part of the descriptor
+	int next_free;		  // next free slot index, -1 at the end of the list
+} b_fcb;
 
-// Global variable.
-extern int bytes_per_block;
-// Function declaration to find the last block in a chain of blocks.
-int get_last_block(int location);
+// The FCBs live in fixed chunks that never move, only the array of chunk
+// pointers grows, so pointers into an FCB stay valid when the table grows.
+static b_fcb **fcb_chunks = NULL;
+static int fcb_chunk_count = 0;
+static int fcb_chunk_capacity = 0;
+static int fcb_free_head = -1;	 // first free slot, free slots form a stack
+static int fcb_open_count = 0;
+static int fcb_max_open = B_MAX_OPEN_DEFAULT;
+// protects the table and the free list, a descriptor itself is only
+// used by one thread at a time
+static pthread_mutex_t fcb_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int64_t b_write_locked(b_fcb *fcb, char *buffer, int64_t count);
+static int64_t b_read_locked(b_fcb *fcb, char *buffer, int64_t count);
+static int b_lock_flushed(b_fcb *fcb);
 
-// Structure to store file information.
-typedef struct file_info
-{
-	char file_name[NAME_MAX_LENGTH]; // file name
-	int file_size;					 // file size in bytes
-	int location;					 // starting logical block in disk
-	int blocks;						 // total blocks of file in disk
-	Directory_Entry *de;			 // used for correctly updating directory infomation
-} file_info;
+int startup = 0; // Indicates that this has not been initialized
 
 /**
- * The function retrieves the information of a file given its name.
+ * The function returns the FCB stored in a slot of the table.
  *
- * @param fname - A pointer to a string containing the name of the file.
- *                This string is expected to include the file's complete path in the file system.
+ * @param index - The slot index, it must be lower than the table size.
  *
- * @return - On success, this function returns a pointer to a `file_info` struct.
- * 		   - If fname is a directory, it returns NULL.
+ * @return - A pointer to the FCB.
  */
-file_info *get_file_info(char *fname)
+static b_fcb *fcb_at(int index)
 {
-	// Check if the given path is a directory.
-	if (fs_isDir(fname) == 1)
-	{
-		// If path is a directory, exits get_file_info returning NULL.
-		return NULL;
-	}
+	return &fcb_chunks[index / FCB_CHUNK_SLOTS][index % FCB_CHUNK_SLOTS];
+}
 
-	// Declare an instance of parsed_entry struct to hold the parsed
-	// information of the directory path.
-	parsed_entry entry;
+/**
+ * The function adds a chunk of FCB_CHUNK_SLOTS free slots to the table,
+ * the caller holds the table lock.
+ *
+ * @return - On success, this function returns 0.
+ *         - If the cap is reached or memory ran out, it returns -1.
+ */
+static int fcb_grow()
+{
+	int first = fcb_chunk_count * FCB_CHUNK_SLOTS;
+	if (first >= fcb_max_open || first + FCB_CHUNK_SLOTS > FD_INDEX_MASK + 1)
+		return -1;
 
-	// Statement to indicate the directory path does not exist.
-	// If parse function returns -1, exits get_file_info returning NULL.
-	if (parse_directory_path(fname, &entry) == -1)
+	// The pointer array doubles, the chunks themselves never move.
+	if (fcb_chunk_count == fcb_chunk_capacity)
 	{
-		printf(" get fileinffo %s does not exists", entry.name);
-		return NULL;
+		int capacity = fcb_chunk_capacity == 0 ? 4 : fcb_chunk_capacity * 2;
+		b_fcb **chunks = realloc(fcb_chunks, capacity * sizeof(b_fcb *));
+		if (chunks == NULL)
+			return -1;
+		fcb_chunks = chunks;
+		fcb_chunk_capacity = capacity;
 	}
 
-	// Checks if the parent directory of file exists.
-	// If parent directory does not exist, exits get_file_info returning NULL.
-	if (entry.parent == NULL)
+	b_fcb *chunk = calloc(FCB_CHUNK_SLOTS, sizeof(b_fcb));
+	if (chunk == NULL)
+		return -1;
+	fcb_chunks[fcb_chunk_count++] = chunk;
+
+	// Push the new slots so the lowest index is handed out first.
+	for (int i = FCB_CHUNK_SLOTS - 1; i >= 0; i--)
 	{
-		printf(" get fileinfo invalid file\n");
-		return NULL;
+		chunk[i].generation = 1;
+		chunk[i].next_free = fcb_free_head;
+		fcb_free_head = first + i;
 	}
+	return 0;
+}
 
-	// Allocate memory on the heap to create a new file_info object.
-	file_info *finfo = malloc(sizeof(file_info));
+/**
+ * The function initializes the file system by setting up the File Control Block table.
+ */
+void b_init()
+{
+	// the table starts empty and grows on the first open
+	pthread_mutex_lock(&fcb_mutex);
+	startup = 1;
+	pthread_mutex_unlock(&fcb_mutex);
+}
 
-	// Checks if malloc was successful in allocating memory.
-	// exits get_file_info returning NULL.
-	if (finfo == NULL)
+/**
+ * The function returns an available File Control Block (FCB) and marks it as used.
+ *
+ * @return - If there is a free FCB element, it returns the descriptor of that element.
+ *         - If the maximum number of open files is reached, it returns -1.
+ */
+b_io_fd b_getFCB()
+{
+	pthread_mutex_lock(&fcb_mutex);
+	if (fcb_open_count >= fcb_max_open || (fcb_free_head == -1 && fcb_grow() == -1))
 	{
-		printf("Memory allocation failed\n");
-		return NULL;
+		pthread_mutex_unlock(&fcb_mutex);
+		return (-1); // all in use
 	}
 
-	// If entry has a valid index, file or directory exists.
-	if (entry.index != -1)
-	{
-
-		// Copy the file or directory name from the entry to the finfo.
-		strcpy(finfo->file_name, entry.parent[entry.index].dir_name);
-
-		// Set the file size in finfo to the size in entry.
-		finfo->file_size = entry.parent[entry.index].dir_file_size;
-
-		// Set the location of the file or directory in finfo to the first cluster number in entry.
-		finfo->location = entry.parent[entry.index].dir_first_cluster;
+	int index = fcb_free_head;
+	b_fcb *fcb = fcb_at(index);
+	fcb_free_head = fcb->next_free;
+	fcb->next_free = -1;
+	fcb->in_use = 1;
+	fcb_open_count++;
+	b_io_fd fd = (fcb->generation << FD_INDEX_BITS) | index;
+	pthread_mutex_unlock(&fcb_mutex);
 
-		// Number of blocks occupied by the file or directory.
-		int blocks = (finfo->file_size + bytes_per_block - 1) / bytes_per_block;
-
-		// Set the number of blocks in finfo.
-		finfo->blocks = blocks;
-
-		finfo -> de = &entry.parent[entry.index];
-	}
-	else
-	{
+	return fd;
+}
 
-		// If entry index is -1, it's not a valid file or directory,
-		// so it sets the name in finfo to an empty string.
-		strcpy(finfo->file_name, "");
-	}
+/**
+ * The function finds the FCB of an open file descriptor.
+ *
+ * @param fd - The file descriptor returned by b_open.
+ *
+ * @return - On success, a pointer to the FCB.
+ *         - If fd is not open, or was closed since, it returns NULL.
+ */
+static b_fcb *b_fcbOf(b_io_fd fd)
+{
+	if (fd < 0)
+		return NULL;
 
-	// If the parent of the parsed entry is not the root directory or the current directory,
-	// free the memory allocated for the parent.
-	if (entry.parent != root_directory && entry.parent != current_directory)
+	int index = fd & FD_INDEX_MASK;
+	pthread_mutex_lock(&fcb_mutex);
+	b_fcb *fcb = NULL;
+	if (index < fcb_chunk_count * FCB_CHUNK_SLOTS)
 	{
-		free(entry.parent);
-		// After freeing memory set the pointer to NULL to avoid dangling pointers.
-		entry.parent = NULL;
+		fcb = fcb_at(index);
+		if (!fcb->in_use || fcb->generation != (fd >> FD_INDEX_BITS))
+			fcb = NULL;
 	}
-	// Returns file_info structure that contains information about the file or directory.
-	return finfo;
+	pthread_mutex_unlock(&fcb_mutex);
+	return fcb;
 }
 
-// Definition of the File Control Block structure.
-typedef struct b_fcb
+/**
+ * The function gives a slot back to the free list.
+ *
+ * @param fcb - The FCB to release, its buffer must already be freed.
+ * @param fd - The descriptor of the FCB.
+ */
+static void b_releaseFCB(b_fcb *fcb, b_io_fd fd)
 {
-	/** TODO add al the information you need in the file control block **/
-	file_info *fi;		  // low level system file info
-	char *buf;			  // holds the open file buffer
-	int index;			  // holds the current position in the buffer
-	int buflen;			  // holds how many valid bytes are in the buffer
-	int current_location; // current block location
-	int blocks_read;	  // blocks read so far
-	int file_size_index;  // file offset
-	int flags;			  // mark the purpose when open the file
-} b_fcb;
-
-// Declaration of the File Control Block array.
-b_fcb fcbArray[MAXFCBS];
+	pthread_mutex_lock(&fcb_mutex);
+	fcb->in_use = 0;
+	// the generation changes so the old descriptor no longer matches
+	fcb->generation = (fcb->generation % FD_GEN_MASK) + 1;
+	fcb->next_free = fcb_free_head;
+	fcb_free_head = fd & FD_INDEX_MASK;
+	fcb_open_count--;
+	pthread_mutex_unlock(&fcb_mutex);
+}
 
-int startup = 0; // Indicates that this has not been initialized
+/**
+ * The function returns the buffer of an FCB, allocating it on the first I/O.
+ *
+ * @param fcb - The FCB of an open file.
+ *
+ * @return - On success, the buffer.
+ *         - If memory ran out, it returns NULL.
+ */
+static char *b_fcbBuffer(b_fcb *fcb)
+{
+	if (fcb->buf == NULL)
+		fcb->buf = (char *)malloc(B_CHUNK_SIZE);
+	return fcb->buf;
+}
 
 /**
- * The function initializes the file system by setting up the File Control Block array.
+ * The function sets the maximum number of files open at the same time.
+ *
+ * @param max - The new maximum, it can't be lower than the files open now.
+ *
+ * @return - On success, this function returns 0.
+ *         - If max is too low or too high, it returns -1.
  */
-void b_init()
+int b_set_max_open(int max)
 {
-	// init fcbArray to all free
-	for (int i = 0; i < MAXFCBS; i++)
+	pthread_mutex_lock(&fcb_mutex);
+	int ret = -1;
+	if (max >= 1 && max >= fcb_open_count && max <= FD_INDEX_MASK + 1)
 	{
-		fcbArray[i].buf = NULL; // indicates a free fcbArray
+		fcb_max_open = max;
+		ret = 0;
 	}
-
-	startup = 1;
+	pthread_mutex_unlock(&fcb_mutex);
+	return ret;
 }
 
 /**
- * The function returns an available File Control Block (FCB) element index.
- *
- * @return - If there is a free FCB element, it returns the index of that element.
- *         - If all FCB elements are in use, it returns -1 to indicate that all FCBs are occupied.
+ * The function frees the FCB table when the file system exits.
+ * Files still open are closed first, no other thread may use the
+ * file system any more.
  */
-b_io_fd b_getFCB()
+void b_exit()
 {
-	for (int i = 0; i < MAXFCBS; i++)
+	for (int i = 0; i < fcb_chunk_count * FCB_CHUNK_SLOTS; i++)
 	{
-		if (fcbArray[i].buf == NULL)
-		{
-			return i; // Not thread safe (But do not worry about it for this assignment)
-		}
+		b_fcb *fcb = fcb_at(i);
+		if (fcb->in_use)
+			b_close((fcb->generation << FD_INDEX_BITS) | i);
 	}
-	return (-1); // all in use
+	for (int i = 0; i < fcb_chunk_count; i++)
+		free(fcb_chunks[i]);
+	free(fcb_chunks);
+	fcb_chunks = NULL;
+	fcb_chunk_count = 0;
+	fcb_chunk_capacity = 0;
+	fcb_free_head = -1;
+	fcb_open_count = 0;
+	startup = 0;
 }
 
 /**
@@ -198,6 +298,23 @@ b_io_fd b_getFCB()
  */
 b_io_fd b_open(char *filename, int flags)
 {
+	return b_open_sized(filename, flags, 0);
+}
+
+/**
+ * The function opens a buffered file like b_open, when the file is created
+ * or truncated the blocks for size_hint bytes are reserved in one extent.
+ *
+ * @param filename - A pointer to a string containing the name of the file to be opened.
+ * @param flags - An integer representing the access mode and file status flags for the file.
+ * @param size_hint - The size the file is expected to reach, 0 if unknown.
+ *
+ * @return - On success, this function returns the file descriptor associated with the opened file.
+ *         - If an error occurs during opening the file, it returns -1.
+ */
+b_io_fd b_open_sized(char *filename, int flags, off_t size_hint)
+{
+	METRIC_SCOPE(M_B_OPEN);
 	// Stores the file descriptor of the opened file.
 	b_io_fd returnFd;
 
@@ -236,104 +353,110 @@ b_io_fd b_open(char *filename, int flags)
 	// check for error - all used FCB's.
 	if (returnFd == -1)
 		return -1;
+	b_fcb *fcb = b_fcbOf(returnFd);
 
-	// Gets file information using get_file_info() for the specified filename.
-	fcbArray[returnFd].fi = (file_info *)get_file_info(filename);
-	
-	// Check if the file information retrieval was successful.
-	// If fi is NULL, it means the get_file_info() returned NULL,
-	// indicating an error in retrieving file information.
-	if (fcbArray[returnFd].fi == NULL)
+	// Resolve the filename once, every step below works on this result.
+	lookup_result entry;
+	if (fs_lookup(filename, &entry) == -1)
 	{
-		printf("[OPEN] invalid filename\n");
+		TRACE_WARN("[ B_OPEN ] : Invalid filename %s.\n", filename);
+		b_releaseFCB(fcb, returnFd);
 		return -1;
 	}
 
-	// Check if file name is an empty string "". That indicates file does not exist.
-	if (strcmp(fcbArray[returnFd].fi->file_name, "") == 0)
+	// The file does not exist yet.
+	if (!entry.exists)
 	{
 		// If the 'O_CREAT' flag is not set, file should not be created.
-		// It then print an error message, free the memory allocated for fi,
-		// set it to NULL, and returns -1.
 		if (!(flags & O_CREAT))
 		{ // don't want to make new if not exists
-			printf("[OPEN] file does not exists\n");
-			free(fcbArray[returnFd].fi);
-			fcbArray[returnFd].fi = NULL;
+			TRACE_WARN("[ B_OPEN ] : %s does not exist.\n", filename);
+			fs_lookup_release(&entry);
+			b_releaseFCB(fcb, returnFd);
 			return -1;
 		}
 
-		// Try to create the file using the fs_mkfile().
-		// If the creation fails prints an error message,
-		// free the memory allocated for fi, set it to NULL, and return -1.
-		if (fs_mkfile(filename) == -1)
+		// Try to create the file in the parent the lookup found.
+		// On success entry describes the new file.
+		// If another thread created it first, entry describes that file.
+		if (fs_mkfile_at(&entry) == -1 && !entry.exists)
 		{
-			free(fcbArray[returnFd].fi);
-			fcbArray[returnFd].fi = NULL;
+			fs_lookup_release(&entry);
+			b_releaseFCB(fcb, returnFd);
 			return -1;
 		}
+	}
 
-		// Gets the file information fi for the file using get_file_info().
-		fcbArray[returnFd].fi = get_file_info(filename);
+	// Every descriptor on the same file shares one vnode.
+	// If it returned NULL the path is a directory or the file went away.
+	fcb->fi = vnode_get(&entry);
+	if (fcb->fi == NULL)
+	{
+		fs_lookup_release(&entry);
+		TRACE_WARN("[ B_OPEN ] : Invalid filename %s.\n", filename);
+		b_releaseFCB(fcb, returnFd);
+		return -1;
 	}
 
 	// If O_TRUNC flag is set, it means the file should be truncated and
 	// its content should be cleared.
-	// This step is to make sure that the file information is updated.
-	else if ((flags & O_TRUNC))
+	if (flags & O_TRUNC)
 	{
-		// Delete the existing file from the file system to clear its content.
-		fs_delete(filename);
-		// Create a new empty file with the same name as the original file.
-		fs_mkfile(filename);
-		// Retrieve the updated file information for the empty file.
-		fcbArray[returnFd].fi = get_file_info(filename);
+		// Cut the existing file back to an empty file in place,
+		// other descriptors on the file see the new size too.
+		vnode_write_lock(fcb->fi);
+		if (fs_truncate_at(&entry) == 0)
+			vnode_truncate(fcb->fi);
+		vnode_unlock(fcb->fi);
 	}
 
-	// Allocates memory for the buffer used to hold the content of the file for
-	// the file descriptor returnFd.
-	fcbArray[returnFd].buf = (char *)malloc(B_CHUNK_SIZE);
+	// A known size gets its blocks now, so the writes find them in one
+	// contiguous extent. The open does not fail if they can't be reserved.
+	if (size_hint > 0 && (flags & (O_CREAT | O_TRUNC)))
+	{
+		vnode_write_lock(fcb->fi);
+		vnode_fallocate(fcb->fi, 0, size_hint);
+		vnode_unlock(fcb->fi);
+	}
+	fs_lookup_release(&entry);
+
+	// The buffer used to hold the content of the file is allocated by the
+	// first read or write, a file that is only opened never needs one.
+	fcb->buf = NULL;
+	fcb->buf_block = -1;
 
 	// Sets the index in the buffer to 0 to indicate that the buffer is initially empty.
-	fcbArray[returnFd].index = 0;
+	fcb->index = 0;
 
 	// Sets the buffer length to 0, to indicate that the buffer doesn't contain any
 	// valid data yet.
-	fcbArray[returnFd].buflen = 0;
+	fcb->buflen = 0;
 
 	// Sets the current_location to the starting logical block of the file
 	// This keeps track of the current location of the file's content.
-	fcbArray[returnFd].current_location = fcbArray[returnFd].fi->location;
+	fcb->current_location = fcb->fi->location;
 
 	// Initializes blocks_read to 0, to indicate that no blocks have been read from the file yet.
-	fcbArray[returnFd].blocks_read = 0;
+	fcb->blocks_read = 0;
 
 	// Initializes file_size_index to 0, which is the current offset of the file.
 	// It is updated when reading or writing to the file to keep track of the current position.
-	fcbArray[returnFd].file_size_index = 0;
+	fcb->file_size_index = 0;
 
-	// Stores the flags in fcbArray to keep track of the intend of opening the file.
+	// Stores the flags in the FCB to keep track of the intend of opening the file.
 	// The flags indicate the access mode for the file.
-	fcbArray[returnFd].flags = flags;
+	fcb->flags = flags;
 
 	// Check if O_APPEND flag is set. That indicates the file is opened in append mode.
 	if ((flags & O_APPEND))
 	{
-		// Moves the pointer to the end of the file by getting
-		// the last block's logical block number.
-		fcbArray[returnFd].current_location = get_last_block(fcbArray[returnFd].fi->location);
-
-		// Updates the blocks_read field with the total number of blocks in the file.
-		// It keeps track of how many blocks have been read.
-		fcbArray[returnFd].blocks_read = fcbArray[returnFd].fi->blocks;
-
-		// Updates the file_size_index field to the end of the file.
-		// This is the current offset of file and is used for read and write operations.
-		fcbArray[returnFd].file_size_index = fcbArray[returnFd].fi->file_size;
+		// Moves the offset to the end of the file, the block holding it is
+		// found by the size, preallocated blocks after it are left alone.
+		b_seek(returnFd, 0, SEEK_END);
 	}
 
-	printf("The file location: %d \n", fcbArray[returnFd].current_location);
-	printf("The file_size_index: %d \n", fcbArray[returnFd].file_size_index);
+	TRACE_DEBUG("[ B_OPEN ] : %s at block %d, offset %lld\n", filename,
+		fcb->current_location, (long long)fcb->file_size_index);
 	// Returns the file descriptor, that indicates the file opened successfully.
 	return (returnFd); // all set
 }
@@ -351,186 +474,48 @@ b_io_fd b_open(char *filename, int flags)
  */
 
 // Function to write data to a file
-int b_write(b_io_fd fd, char *buffer, int count) //600
+int64_t b_write(b_io_fd fd, char *buffer, int64_t count) //600
 {
+	METRIC_SCOPE(M_B_WRITE);
 
 
 	// Check if the system is initialized
     if (startup == 0)
         b_init(); // Initialize our system
 
-    // Check that fd is between 0 and (MAXFCBS-1)
-    if ((fd < 0) || (fd >= MAXFCBS))
+    // Check that fd is an open file descriptor
+    b_fcb *fcb = b_fcbOf(fd);
+    if (fcb == NULL)
     {
         return -1; // Invalid file descriptor
     }
 
-	//gives us the current position in the file
-	fcbArray[fd].index = fcbArray[fd].fi->de->dir_file_size % B_CHUNK_SIZE;
-
-	int remainingBytesInBuffer = B_CHUNK_SIZE - fcbArray[fd].index; //remaining bytes from index of fd
-	int part1,part2,part3;
-	int blocksToCopy; //blocks to copy for part2
-	int userBufferPosition = 0; //current positon of the user buffer that we need to start memcpy from 
-
-	//first block -> count < remaining bytes in buffer
-	if(count <= remainingBytesInBuffer) {
-
-		printf("[WRITE] goes into first if \n");
-
-		//whats written to current block because it fits inside
-		part1 = count;
-
-		//dont need anything else to write
-		part2 = 0;
-		part3 = 0;
-	}
-	else{ //count > block //1200 is what they are asking aka count
-
-		printf("[WRITE] goes into first else \n");
-
-		part1 = remainingBytesInBuffer; //should hold a full block
-
-		part3 = count - remainingBytesInBuffer; //how much more after a full block
-
-		blocksToCopy = part3 / B_CHUNK_SIZE; // Checks how many blocks you need for part 2
-
-		part2 = blocksToCopy * B_CHUNK_SIZE; //convert blocks to amount of bytes you need per block
-
-		part3 = part3 - part2; //if negative part3 won't go 
-	}
-
-	if(part1 > 0){
-
-		//grab the current block, store it in our buffer
-		LBAread(fcbArray[fd].buf, 1,fcbArray[fd].current_location );
-
-		printf("[WRITE] goes into part1 \n");
-
-		printf("[WRITE] index part1 %d\n", fcbArray[fd].index);
-		printf("[WRITE] location part1  %d\n", fcbArray[fd].current_location);
-
-		//buffer always reset to 0 after LBAwrite and the src is buffer up to the count of part1
-		//write to our buffer from their buffer
-		memcpy(fcbArray[fd].buf + fcbArray[fd].index, buffer, part1); 
-
-		printf("[WRITE] buffer  %s\n", fcbArray[fd].buf);
-
-		printf("[WRITE] file writes this  %s\n", fcbArray[fd].buf + fcbArray[fd].index);
-
-		//do a lbawrite first
-		if (LBAwrite(fcbArray[fd].buf, 1, fcbArray[fd].current_location) == 0) {
-				printf("[WRITE] failed at part1 \n");	
-	 			return -1;
-	 	}
-
-		//updating positon you are at in the file NOT THE BUFFER
-		fcbArray[fd].index += part1;
-
-		//update file size due to write
-		fcbArray[fd].fi->de->dir_file_size += part1;
-
-		//because we have memcpy the part1 of the buffer
-		userBufferPosition += part1;
-
-	}
-	//if there is a remainder
-	if(part2 > 0){
-
-		printf("[WRITE] goes into part2 \n");
-
-		//loops through each block you need to copy and write
-		for(int i = 0; i < blocksToCopy; i++){
-
-			//now we need to update where we write to becuase we just wrote
-			uint32_t next_block = get_next_block(fcbArray[fd].current_location);
-
-			//If there is no next block, we need to allocate a new block
-			if (next_block == EOF_BLOCK)
-			{
-				// Allocate 1 additional block
-				allocate_additional_blocks(fcbArray[fd].current_location, 1);
-
-				// Get the updated next block from FAT
-				next_block = get_next_block(fcbArray[fd].current_location);
-			}
-
-			//Update the current_location to the next block
-			fcbArray[fd].current_location = next_block;
-			
-			//write function for one block at a time
-			if (LBAwrite(buffer + userBufferPosition, 1, fcbArray[fd].current_location) == 0) {	
-				printf("[WRITE] failed at part2 \n");	
-	 			return -1;
-	 		}
-
-			//update file size due to write
-			fcbArray[fd].fi->de->dir_file_size += B_CHUNK_SIZE;
-
-			//because we have memcpy the part1 of the buffer
-			userBufferPosition += B_CHUNK_SIZE;
-		}
-	}
-
-	//if there is remainder bytes that fits into one block
-	if(part3 > 0){
-		printf("[WRITE] goes into part3 \n");
-
-		//grab block
-
-		//now we need to update where we write to becuase we just wrote in either part1 or part2
-		uint32_t next_block = get_next_block(fcbArray[fd].current_location);
-
-		//If there is no next block, we need to allocate a new block
-		if (next_block == EOF_BLOCK)
-		{
-			// Allocate 1 additional block
-			allocate_additional_blocks(fcbArray[fd].current_location, 1);
-
-			// Get the updated next block from FAT
-			next_block = get_next_block(fcbArray[fd].current_location);
-		}
-
-		//Update the current_location to the next block
-		fcbArray[fd].current_location = next_block;
-
-		//We need to read whats currently in the buffer so we can make sure to get everything in the block
-		LBAread(fcbArray[fd].buf, 1,fcbArray[fd].current_location);
-
-		//bring it into to memory to then do a write
-		memcpy(fcbArray[fd].buf, buffer + userBufferPosition, part3); 
-
-		printf("[WRITE] buffer  part3 %s\n", fcbArray[fd].buf);
-
-		//write function for one block at a time
-		if (LBAwrite(fcbArray[fd].buf, 1, fcbArray[fd].current_location) == 0) {	
-			printf("[WRITE] failed at part3 \n");	
-			return -1;
-		}
-
-		//update file size due to write
-		fcbArray[fd].fi->de->dir_file_size += part3;
-
-		//keep positon of where what we have written from the user's buffer consistent
-		userBufferPosition += part3;
-	}
-
-	//return value gets set to all parts to see how much you wrote
-	int retValue = part1 + part2 + part3;
-	printf("[WRITE retValue] checking part1 %d\n", part1);
-	printf("[WRITE retValue] checking part2 %d\n", part2);
-	printf("[WRITE retValue] checking part3 %d\n", part3);
-	printf("[WRITE] checking userBufferPosition %d\n", userBufferPosition);
-
-	//error checking if you wrote as much as you gone through their buffer
-	if(userBufferPosition != retValue) {
-		printf("[WRITE error] checking part1+part2+part3 %d\n", retValue);
-		//printf("[WRITE error] checking userBufferPosition %d\n", userBufferPosition);
+	if (count < 0)
 		return -1;
-	}
 
-	return userBufferPosition;
+	// One writer at a time per file, other files are not blocked.
+	vnode_write_lock(fcb->fi);
+	int64_t ret = b_write_locked(fcb, buffer, count);
+	vnode_unlock(fcb->fi);
+	return ret;
+}
 
+/**
+ * The function does the work of b_write, the caller holds the write lock of the file.
+ *
+ * @param fcb - The FCB of the open file.
+ * @param buffer - A pointer to the buffer containing the data to be written.
+ * @param count - The number of bytes to be written from the buffer.
+ *
+ * @return - On success, the function returns the number of bytes written to the file.
+ *         - If an error occurs during writing, it returns -1.
+ */
+static int64_t b_write_locked(b_fcb *fcb, char *buffer, int64_t count)
+{
+	// The data is held in the vnode, its blocks are chosen in one extent
+	// when it fills up, on b_fsync or on the last close. A large count
+	// is taken in pieces of the vnode buffer.
+	return vnode_write(fcb->fi, buffer, count);
 }
 
 
@@ -566,53 +551,102 @@ int b_write(b_io_fd fd, char *buffer, int count) //600
  *         - If the end of file (EOF) is reached during reading, it returns the total number of bytes read until EOF.
  *         - If an error occurs during reading, it returns -1.
  */
-int b_read(b_io_fd fd, char *buffer, int count)
+int64_t b_read(b_io_fd fd, char *buffer, int64_t count)
 {
+	METRIC_SCOPE(M_B_READ);
 
 	if (startup == 0)
 		b_init(); // Initialize our system
 
-	// check that fd is between 0 and (MAXFCBS-1)
-	if ((fd < 0) || (fd >= MAXFCBS))
+	// check that fd is an open file descriptor
+	b_fcb *fcb = b_fcbOf(fd);
+	if (fcb == NULL)
 	{
 		return (-1); // invalid file descriptor
 	}
 
-	if (fcbArray[fd].fi == NULL) // may not need this because of open.
+	if (fcb->fi == NULL) // may not need this because of open.
 	{
 		return -1;
 	}
 
+	if (count < 0 || b_fcbBuffer(fcb) == NULL)
+	{
+		return -1;
+	}
+
+	if (b_lock_flushed(fcb) == -1)
+		return -1;
+	int64_t ret = b_read_locked(fcb, buffer, count);
+	vnode_unlock(fcb->fi);
+	return ret;
+}
+
+/**
+ * The function takes the read lock of a file with no data held by a writer,
+ * the data is flushed first so the blocks of the file hold all of it.
+ *
+ * @param fcb - The FCB of the open file.
+ *
+ * @return - On success, 0 with the read lock taken.
+ *         - If the held data can't be written, it returns -1 without the lock.
+ */
+static int b_lock_flushed(b_fcb *fcb)
+{
+	// Readers of the same file share the lock, a writer waits for them.
+	vnode_read_lock(fcb->fi);
+	while (fcb->fi->pending_len > 0)
+	{
+		vnode_unlock(fcb->fi);
+		vnode_write_lock(fcb->fi);
+		int flushed = vnode_flush(fcb->fi);
+		vnode_unlock(fcb->fi);
+		if (flushed == -1)
+			return -1;
+		vnode_read_lock(fcb->fi);
+	}
+	return 0;
+}
+
+/**
+ * The function does the work of b_read, the caller holds the read lock of the file.
+ *
+ * @param fcb - The FCB of the open file.
+ * @param buffer - A pointer to the buffer where the data will be stored.
+ * @param count - The number of bytes to be read from the file.
+ *
+ * @return - the total number of bytes read from the file, it stops at the end of the file.
+ */
+static int64_t b_read_locked(b_fcb *fcb, char *buffer, int64_t count)
+{
 	// Initialize variables to calculate how much data can be filled from the buffer.
-	int part1, part2, part3;
-	int remainingBytes = B_CHUNK_SIZE - fcbArray[fd].index; //remaining bytes from index of fd
-	int blocksToCopy; //amount of blocks to copy used in part 2
-	int bytesRead; //bytes read calculated from amount of blocks read in struct
-	printf("[b_ioc -> b_read] count is %d\n", count);
-	printf("[b_ioc -> b_read] the file name is %s\n", fcbArray[fd].fi->file_name);
-	printf("[b_ioc -> b_read] the file location is %d\n", fcbArray[fd].fi->location);
+	int64_t part1, part2, part3;
+	int64_t remainingBytes = B_CHUNK_SIZE - fcb->index; //remaining bytes from index of fd
+	int64_t blocksToCopy; //amount of blocks to copy used in part 2
+	TRACE_DEBUG("[ B_READ ] : %lld bytes of %s at %lld\n", (long long)count,
+		fcb->fi->file_name, (long long)fcb->file_size_index);
 
 	// TODO: check read flag
-	// printf("[b_ioc -> b_read] file_size is %d\n", fcbArray[fd].file_size_index);
 
 	// adjust count if greater than EOF
-	if (count + fcbArray[fd].file_size_index > fcbArray[fd].fi->de->dir_file_size)
+	if (count > fcb->fi->file_size - fcb->file_size_index)
 	{
-		printf("[b_ioc -> b_read] file_size is %d\n", fcbArray[fd].fi->de->dir_file_size);
 		//update count with the filesize with index to get much you need to read
-		count = fcbArray[fd].fi->de->dir_file_size - fcbArray[fd].file_size_index;
-		printf("[b_ioc -> b_read] Had to reduce count\n");
+		count = fcb->fi->file_size - fcb->file_size_index;
+	}
+	if (count <= 0)
+	{
+		return 0;
 	}
 
 	// Calculate how many bytes can be filled in multiples of the block size.
 	if (remainingBytes >= count)
 	{
-		printf("[b_ioc -> b_read] filling in from current block\n");
 		//if you can use the amount of remaining of bytes for the given count
 		part1 = count;
-		printf("[READ] in the if %d\n", count);
 		part2 = 0;
 		part3 = 0;
+		blocksToCopy = 0;
 	}
 	else
 	{
@@ -621,8 +655,8 @@ int b_read(b_io_fd fd, char *buffer, int count)
 
 		// Calculates how many bytes need to be read.
 		part3 = count - remainingBytes;
-		blocksToCopy = part3 / B_CHUNK_SIZE;
-		part2 = blocksToCopy * B_CHUNK_SIZE;
+		blocksToCopy = GEO_BLOCK_OF(part3);
+		part2 = GEO_BYTES(blocksToCopy);
 
 		// Calculates the remaining bytes after filling part1 and part2.
 		part3 = part3 - part2;
@@ -631,125 +665,270 @@ int b_read(b_io_fd fd, char *buffer, int count)
 	// If there are bytes remaining in the buffer, copy them to the user's buffer.
 	if (part1 > 0)
 	{
-		//we need to read the first block
-		LBAread(fcbArray[fd].buf, 1, fcbArray[fd].current_location);
-
-
-		printf("[b_ioc -> b_read] part1 fcbarray index %d\n", fcbArray[fd].index);
+		// The current block is read again only when the buffer holds
+		// another block, or data of the file was written since.
+		if (fcb->buf_block != fcb->current_location || fcb->buf_gen != fcb->fi->data_gen)
+		{
+			fcb->buf_block = elv_read(fcb->buf, 1, fcb->current_location) == 1
+				? fcb->current_location : -1;
+			fcb->buf_gen = fcb->fi->data_gen;
+		}
 
-		printf("[b_ioc -> b_read] inside condition part 1\n");
 		// Copy part1 number of bytes from the current position in the buffer
 		// to the user's buffer, starting at the address pointed by buffer.
-		memcpy(buffer, fcbArray[fd].buf + fcbArray[fd].index, part1);
+		memcpy(buffer, fcb->buf + fcb->index, part1);
 
 		// Moves the buffer index forward by part1 number of bytes.
-		fcbArray[fd].index = fcbArray[fd].index + part1;
+		fcb->index = fcb->index + part1;
 
 		// Updates the file offset by adding the number of bytes read,
 		// to keep track of the current position in the file.
-		fcbArray[fd].file_size_index += part1;
-
-		// // Increase the buffer length by part1,
-		// // the buffer now has part1 more valid bytes.
-		// fcbArray[fd].buflen += part1;
-
+		fcb->file_size_index += part1;
 	}
-	printf("[b_ioc -> b_read] par 1 is %d\n", part1);
-	printf("[b_ioc -> b_read] par 2 is %d\n", part2);
-	printf("[b_ioc -> b_read] par 3 is %d\n", part3);
+	TRACE_DEBUG("[ B_READ ] : parts of %lld, %lld and %lld bytes\n",
+		(long long)part1, (long long)part2, (long long)part3);
 
-	//  If there are blocks to be read, read them and copy to the user's buffer.
+	//  If there are blocks to be read, read them straight into the user's buffer.
 	if (part2 > 0)
 	{
-		printf("[b_ioc -> b_read] inside condition part 2\n");
 		// Keeps track of the number of bytes copied in part2.
-		int tempPart2 = 0;
+		int64_t tempPart2 = 0;
 
-		// Number of blocks read from the disk.
-		int blocks_read = 0;
-
-		// Loop to copy the number of blocks into the user's buffer.
-		for (int i = 0; i < blocksToCopy; i++)
+		// Blocks that follow each other on disk are read in one request,
+		// so a large read costs one request per extent of the file.
+		while (tempPart2 < part2)
 		{
-			// Update the current_location to the logical block number of the next block.
-			fcbArray[fd].current_location = get_next_block(fcbArray[fd].current_location);
+			uint32_t first = get_next_block(fcb->current_location);
 
 			// Check if the end of file has been reached.
-			if (fcbArray[fd].current_location == -1)
+			if (first == EOF_BLOCK)
 			{
-				printf("[b_io.c -> b_read] reached EOF in part2\n");
+				TRACE_DEBUG("[ B_READ ] : Reached EOF in part2\n");
+				break;
 			}
 
-			// Read the block from the disk into the user's buffer.
-			blocks_read = LBAread(buffer + part1 + tempPart2, 1, fcbArray[fd].current_location);
-
-			bytesRead = blocks_read * B_CHUNK_SIZE;
+			uint32_t last = first;
+			int64_t run = 1;
+			while (tempPart2 + (int64_t) GEO_BYTES(run) < part2 && run < B_READ_RUN_BLOCKS
+					&& get_next_block(last) == last + 1)
+			{
+				last++;
+				run++;
+			}
 
-			// Update the blocks_read field in the fcbArray to keep track of how many blocks have been read.
-			fcbArray[fd].blocks_read++;
+			// Read the blocks from the disk into the user's buffer.
+			int64_t blocks_read = elv_read(buffer + part1 + tempPart2, run, first);
+			fcb->current_location = last;
 
-			// Update the buffer index, current file offset, and blocks_read in the fcbArray for the next iteration.
-			fcbArray[fd].buflen = 0;
-			fcbArray[fd].index = 0;
-			fcbArray[fd].file_size_index += B_CHUNK_SIZE;
+			// Update the blocks_read field in the FCB to keep track of how many blocks have been read.
+			fcb->blocks_read += run;
 
-			// Update the total bytes read in part2.
-			tempPart2 = tempPart2 + bytesRead;
+			// The FCB buffer no longer holds the current block.
+			fcb->buflen = 0;
+			fcb->index = B_CHUNK_SIZE;
+			fcb->file_size_index += GEO_BYTES(run);
+			tempPart2 += GEO_BYTES(run);
+			if (blocks_read != run)
+			{
+				TRACE_ERROR("[ B_READ ] : Read %lld of %lld blocks of %s.\n",
+					(long long)blocks_read, (long long)run, fcb->fi->file_name);
+				break;
+			}
+		}
+		if (tempPart2 < part2)
+		{
+			// Nothing after a short part2 is read.
 			part2 = tempPart2;
+			part3 = 0;
 		}
 	}
 	// If there are bytes remaining to be read, reads the next block and copy to the user's buffer
 	if (part3 > 0)
 	{
-		printf("[b_ioc -> b_read] inside condition part 3\n");
 		// Update the current_location to the logical block number of the next block.
-		int bytes_readP3 = 0;
-	
-		fcbArray[fd].current_location = get_next_block(fcbArray[fd].current_location);
+		int64_t bytes_readP3 = 0;
 
-		printf("[b_ioc -> b_read] the current block part3 start %d\n", fcbArray[fd].current_location);
+		uint32_t next = get_next_block(fcb->current_location);
 
 		// Check if the end of file has been reached.
-		if (fcbArray[fd].current_location == -1)
+		if (next == EOF_BLOCK)
 		{
-			printf("[b_io.c -> b_read] reached EOF in part3\n");
+			TRACE_DEBUG("[ B_READ ] : Reached EOF in part3\n");
+			return part1 + part2;
 		}
+		fcb->current_location = next;
 
-		// Read the block from the disk into the buffer in the fcbArray.
-		bytes_readP3 = LBAread(fcbArray[fd].buf, 1, fcbArray[fd].current_location);
+		// Read the block from the disk into the buffer in the FCB.
+		bytes_readP3 = elv_read(fcb->buf, 1, fcb->current_location);
+		fcb->buf_block = bytes_readP3 == 1 ? fcb->current_location : -1;
+		fcb->buf_gen = fcb->fi->data_gen;
 
 		// Convert the number of blocks read to the actual number of bytes read for part3.
-		bytes_readP3 = bytes_readP3 * B_CHUNK_SIZE;
+		bytes_readP3 = GEO_BYTES(bytes_readP3);
 
-		// Update the total number of blocks read in the fcbArray for this iteration.
-		fcbArray[fd].blocks_read++;
+		// Update the total number of blocks read in the FCB for this iteration.
+		fcb->blocks_read++;
 
-		// Reset the buffer index and buflen in the fcbArray for part3.
-		fcbArray[fd].buflen = 0;
-		fcbArray[fd].index = 0;
+		// Reset the buffer index and buflen in the FCB for part3.
+		fcb->buflen = 0;
+		fcb->index = 0;
 
 		if (bytes_readP3 < part3)
 		{
 			part3 = bytes_readP3;
-			printf("[b_io.c -> b_read] Bytes read less than part3\n");
+			TRACE_ERROR("[ B_READ ] : Failed to read the last block of %s.\n", fcb->fi->file_name);
 		}
 
 		// If bytes read in part3 are less than part3 it updates part3 to the actual bytes read.
 		if (part3 > 0)
 		{
 			// Copy the remaining bytes from the buffer to the user's buffer.
-			memcpy(buffer + part1 + part2, fcbArray[fd].buf + fcbArray[fd].index, part3);
+			memcpy(buffer + part1 + part2, fcb->buf + fcb->index, part3);
 
-			// Update the file offset and buffer length in the fcbArray for part3.
-			fcbArray[fd].index = fcbArray[fd].index + part3;
-			fcbArray[fd].file_size_index += part3;
-			fcbArray[fd].buflen += part3;
+			// Update the file offset and buffer length in the FCB for part3.
+			fcb->index = fcb->index + part3;
+			fcb->file_size_index += part3;
+			fcb->buflen += part3;
 		}
 	}
-	printf("[b_ioc -> b_read] return number of bytes copied is %d\n", (part1 + part2 + part3));
 	// Returns the total number of bytes read from the file.
 	return part1 + part2 + part3;
-	//*/
+}
+
+/**
+ * The function moves the read position of the buffered file associated with
+ * the given file descriptor. Writes always add to the end of the file.
+ *
+ * @param fd - The file descriptor of the buffered file.
+ * @param offset - The number of bytes to move, from the place given by whence.
+ * @param whence - SEEK_SET, SEEK_CUR or SEEK_END.
+ *
+ * @return - On success, the function returns the new offset from the start of the file.
+ *         - If the file descriptor or whence is invalid, or the new offset is
+ *           before the start or past the end of the file, it returns -1.
+ */
+off_t b_seek(b_io_fd fd, off_t offset, int whence)
+{
+	METRIC_SCOPE(M_B_SEEK);
+	b_fcb *fcb = b_fcbOf(fd);
+	if (fcb == NULL || fcb->fi == NULL)
+	{
+		return -1;
+	}
+
+	// The chain is walked, so the data held by a writer needs its blocks.
+	if (b_lock_flushed(fcb) == -1)
+		return -1;
+
+	off_t size = fcb->fi->file_size;
+	off_t target;
+	switch (whence)
+	{
+	case SEEK_SET:
+		target = offset;
+		break;
+	case SEEK_CUR:
+		target = fcb->file_size_index + offset;
+		break;
+	case SEEK_END:
+		target = size + offset;
+		break;
+	default:
+		target = -1;
+		break;
+	}
+	if (target < 0 || target > size)
+	{
+		vnode_unlock(fcb->fi);
+		return -1;
+	}
+
+	// The position is kept the way b_read leaves it, inside the block that
+	// holds the byte before it, so an offset at the end of a block needs
+	// no block after it.
+	off_t block = target == 0 ? 0 : GEO_BLOCK_OF(target - 1);
+	off_t current = GEO_BLOCK_OF(fcb->file_size_index - fcb->index);
+	uint32_t location = fcb->current_location;
+	if (block < current)
+	{
+		// the chain only goes forward, a seek back starts from the first block
+		location = fcb->fi->location;
+		current = 0;
+	}
+	for (; current < block && location != EOF_BLOCK; current++)
+	{
+		location = get_next_block(location);
+	}
+	vnode_unlock(fcb->fi);
+	if (location == EOF_BLOCK)
+	{
+		return -1;
+	}
+
+	fcb->current_location = location;
+	fcb->index = target - GEO_BYTES(block);
+	fcb->buflen = 0;
+	fcb->blocks_read = block;
+	fcb->file_size_index = target;
+	return target;
+}
+
+/**
+ * The function reserves blocks so the file associated with the given file
+ * descriptor can grow to offset + len bytes without allocating. The size
+ * of the file does not change and the blocks are not cleared.
+ *
+ * @param fd - The file descriptor of the buffered file.
+ * @param offset - The start of the range in bytes.
+ * @param len - The length of the range in bytes.
+ *
+ * @return - On success, the function returns 0.
+ *         - If the file descriptor is invalid, not open for writing,
+ *           or the volume is full, it returns -1.
+ */
+int b_fallocate(b_io_fd fd, off_t offset, off_t len)
+{
+	METRIC_SCOPE(M_B_FALLOCATE);
+	b_fcb *fcb = b_fcbOf(fd);
+	if (fcb == NULL || offset < 0 || len <= 0)
+	{
+		return -1;
+	}
+	if (!(fcb->flags & (O_WRONLY | O_RDWR)))
+	{
+		return -1;
+	}
+	vnode_write_lock(fcb->fi);
+	int ret = vnode_fallocate(fcb->fi, offset, len);
+	vnode_unlock(fcb->fi);
+	return ret;
+}
+
+/**
+ * The function writes the data held for the file associated with the given
+ * file descriptor, then its blocks and size, and waits until the queued
+ * writes are on disk.
+ *
+ * @param fd - The file descriptor of the buffered file to sync.
+ *
+ * @return - On success, the function returns 0.
+ *         - If the file descriptor is invalid or the write failed, it returns -1.
+ */
+int b_fsync(b_io_fd fd)
+{
+	METRIC_SCOPE(M_B_FSYNC);
+	b_fcb *fcb = b_fcbOf(fd);
+	if (fcb == NULL)
+	{
+		return -1;
+	}
+	vnode_write_lock(fcb->fi);
+	int ret = vnode_sync(fcb->fi);
+	vnode_unlock(fcb->fi);
+	if (elv_flush() == -1) {
+		ret = -1;
+	}
+	return ret;
 }
 
 /**
@@ -762,68 +941,47 @@ int b_read(b_io_fd fd, char *buffer, int count)
  */
 int b_close(b_io_fd fd)
 {
-	// Check if the file descriptor is within valid range,if it's not,
+	METRIC_SCOPE(M_B_CLOSE);
+	// Check if the file descriptor is open, if it's not,
 	// returns -1 to indicate an invalid file descriptor.
-	if ((fd < 0) || (fd >= MAXFCBS))
+	b_fcb *fcb = b_fcbOf(fd);
+	if (fcb == NULL)
 	{
 		return -1;
 	}
 
-	// Free the memory associated with the file_info struct.
-	free(fcbArray[fd].fi);
-
-	// Set the pointer to the file_info struct to NULL to avoid accessing freed memory.
-	fcbArray[fd].fi = NULL;
+	// Drop the reference on the vnode, the last close writes the size back.
+	vnode_put(fcb->fi);
+	fcb->fi = NULL;
 
 	// Free the memory associated with the buffer.
-	free(fcbArray[fd].buf);
+	free(fcb->buf);
 
 	// Set the pointer to the buffer to NULL.
-	fcbArray[fd].buf = NULL;
+	fcb->buf = NULL;
+	fcb->buf_block = -1;
 
 	// Reset the current position in the buffer.
-	fcbArray[fd].index = 0;
+	fcb->index = 0;
 
 	// Reset the length of data in the buffer to zero.
-	fcbArray[fd].buflen = 0;
+	fcb->buflen = 0;
 
 	// Reset the current block location to zero.
-	fcbArray[fd].current_location = 0;
+	fcb->current_location = 0;
 
 	// Reset the number of blocks read to zero.
-	fcbArray[fd].blocks_read = 0;
+	fcb->blocks_read = 0;
 
 	// Reset the file offset to zero.
-	fcbArray[fd].file_size_index = 0;
+	fcb->file_size_index = 0;
 
 	// Reset the flags associated with the file to zero.
-	fcbArray[fd].flags = 0;
+	fcb->flags = 0;
+
+	// Give the slot back, the descriptor is no longer valid.
+	b_releaseFCB(fcb, fd);
 
 	// Returns 0 to indicate a successful closure of file.
 	return 0;
 }
-
-/**
- * The function retrieves the last block number of a file given the location of a block in the file system.
- *
- * @param location - The location of a block in the file system.
- *
- * @return - The block number of the last block in the file (given its location).
- */
-int get_last_block(int location)
-{
-	// Location of the previous block, initialized to -1.
-	int prev = -1;
-	// Current block location initialized with location.
-	int curr = location;
-
-	// Loop through the blocks until we reach the end.
-	// Keeps updating prev to store the location of the current block and moves
-	// to the next block using get_next_block().
-	while (curr != -1)
-	{
-		prev = curr;
-		curr = get_next_block(curr);
-	}
-	return prev;
-}
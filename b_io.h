@@ -16,6 +16,8 @@
 #ifndef _B_IO_H
 #define _B_IO_H
 #include <fcntl.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 typedef int b_io_fd;
 
@@ -23,22 +25,48 @@ typedef int b_io_fd;
 // Returns a file descriptor.
 b_io_fd b_open (char * filename, int flags);
 
+// Same as b_open, when the file is created or truncated the blocks for
+// size_hint bytes are reserved in one contiguous extent. 0 means no hint.
+b_io_fd b_open_sized (char * filename, int flags, off_t size_hint);
+
+// Reserves blocks so the file described by fd can grow to offset + len
+// bytes without allocating, the size does not change and the blocks are
+// not cleared.
+// Returns zero on success, or -1 if error.
+int b_fallocate (b_io_fd fd, off_t offset, off_t len);
+
 // Reads count bytes from the file described by fd into the buffer. 
-// Returns the number of bytes read.
-int b_read (b_io_fd fd, char * buffer, int count);
+// Sizes, offsets and counts are 64 bits, a count of many gigabytes is
+// read straight into the buffer one extent at a time.
+// Returns the number of bytes read, or -1 if error.
+int64_t b_read (b_io_fd fd, char * buffer, int64_t count);
 
-// Writes count bytes from the buffer into the file described by fd.
-// Returns the number of bytes written.
-int b_write (b_io_fd fd, char * buffer, int count);
+// Writes count bytes from the buffer into the end of the file described by fd.
+// Returns the number of bytes written, or -1 if error.
+int64_t b_write (b_io_fd fd, char * buffer, int64_t count);
 
-// It moves the file offset of the file description indicated by fd 
-// by offset bytes according to whence.
-// Returns the resulting offset location in bytes from the beginning of the file.
-int b_seek (b_io_fd fd, off_t offset, int whence);
+// It moves the read offset of the file description indicated by fd 
+// by offset bytes according to whence, within the size of the file.
+// Returns the resulting offset location in bytes from the beginning of the file,
+// or -1 if error.
+off_t b_seek (b_io_fd fd, off_t offset, int whence);
+
+// Writes the data held for the file described by fd, then its size to its
+// directory, every descriptor open on the same file shares that size.
+// Returns zero on success, or -1 if error.
+int b_fsync (b_io_fd fd);
 
 // Closes the file descriptor fd.
 // Returns zero on success, or -1 if error.
 int b_close (b_io_fd fd);
 
+// Sets how many files can be open at the same time, the table of open
+// files grows on demand up to this cap.
+// Returns zero on success, or -1 if max is lower than the files open now.
+int b_set_max_open (int max);
+
+// Closes every open file and frees the table of open files.
+void b_exit (void);
+
 #endif
 
@@ -0,0 +1,449 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: defrag.c
+*
+* Description: Online defragmenter, used by the shell and by
+*	the fsdefrag tool.
+**************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "fsLow.h"
+#include "mfs.h"
+#include "FAT.h"
+#include "vcb_.h"
+#include "dir_cache.h"
+#include "vnode.h"
+#include "elevator.h"
+#include "writeback.h"
+#include "geometry.h"
+#include "trace.h"
+#include "defrag.h"
+
+
+// class of the thread that started the run, the sweeps of the write queue
+// are made in it because they send the writes of every thread
+static __thread int caller_class = IO_CLASS_SYNC;
+
+// a subdirectory found in a directory, looked at after the directory is done
+typedef struct child_dir
+	{
+	int index;		// slot in the parent
+	uint32_t cluster;	// first block when it was seen
+	} child_dir;
+
+/**
+ * This helper function sends every queued write in the class of the caller
+ * of the run, so the foreground writes queued by other threads are not held
+ * to the background rate
+ *
+ * @return - void
+ */
+static void flush_queue() {
+	int old = LBAsetclass(caller_class);
+	elv_flush();
+	LBAsetclass(old);
+}
+
+/**
+ * This helper function walks a chain and counts its runs of blocks that
+ * follow each other on disk
+ *
+ * @param first - first block of the chain
+ * @param blocks - receives the number of blocks
+ *
+ * @return - the number of runs, 0 for an empty or broken chain
+ */
+static int count_runs(uint32_t first, int * blocks) {
+	int runs = 0;
+	int count = 0;
+	uint32_t prev = -1;
+	uint32_t block = first;
+	// a broken FAT could loop, no chain is longer than the volume
+	while (block != EOF_BLOCK && block < vcb->total_blocks && count <= vcb->total_blocks) {
+		if (count == 0 || block != prev + 1) {
+			runs++;
+		}
+		count++;
+		prev = block;
+		block = get_next_block(block);
+	}
+	*blocks = count;
+	return block == EOF_BLOCK ? runs : 0;
+}
+
+/**
+ * This helper function copies the blocks of a chain to an extent, reading
+ * runs of the chain and writing DEFRAG_IO_BLOCKS at a time
+ *
+ * @param first - first block of the chain
+ * @param blocks - blocks in the chain
+ * @param target - first block of the extent
+ *
+ * @return - 0 on success, -1 if a read or a write failed
+ */
+static int copy_chain(uint32_t first, int blocks, uint32_t target) {
+	char * buf = malloc(DEFRAG_IO_BLOCKS * bytes_per_block);
+	if (buf == NULL) {
+		TRACE_ERROR("[ DEFRAG ] : Out of memory.\n");
+		return -1;
+	}
+
+	uint32_t block = first;
+	int copied = 0;
+	int ret = 0;
+	while (copied < blocks && ret == 0) {
+		// fill the buffer with runs of the chain, one read per run
+		int filled = 0;
+		while (filled < DEFRAG_IO_BLOCKS && copied + filled < blocks) {
+			uint32_t start = block;
+			int run = 1;
+			block = get_next_block(block);
+			while (block == start + run && filled + run < DEFRAG_IO_BLOCKS
+					&& copied + filled + run < blocks) {
+				run++;
+				block = get_next_block(block);
+			}
+			if (elv_read(buf + filled * bytes_per_block, run, start) != run) {
+				ret = -1;
+				break;
+			}
+			filled += run;
+		}
+		// a write that fills the queue sends all of it, that is done here
+		// in the class of the caller instead of at the background rate
+		if (ret == 0 && elv_pending() + filled > ELV_MAX_BLOCKS) {
+			flush_queue();
+		}
+		if (ret == 0 && elv_write(buf, filled, target + copied) != filled) {
+			ret = -1;
+		}
+		copied += filled;
+	}
+	free(buf);
+	return ret;
+}
+
+/**
+ * This helper function writes a directory, the caller holds its write lock
+ *
+ * @param dir - the directory
+ *
+ * @return - 0 on success, -1 if the write failed
+ */
+static int write_dir(Directory_Entry * dir) {
+	int blocks = GEO_BLOCKS(dir[0].dir_file_size);
+	return write_to_disk(dir, dir[0].dir_first_cluster, blocks, bytes_per_block);
+}
+
+/**
+ * This helper function copies a file into one extent and switches its entry
+ * to the copy. The copy is made with no directory lock held, then the entry
+ * is checked under the write lock and only switched if the file was not
+ * changed, moved, removed or opened in the meantime. The data goes to disk
+ * first, then the FAT with the new chain, then the directory, and only then
+ * is the old chain freed.
+ *
+ * @param dir - the directory holding the file, the caller holds a reference
+ * @param index - slot of the file
+ * @param seen - copy of the entry taken when the chain was counted
+ * @param blocks - blocks in the file
+ * @param report - counts what was done
+ *
+ * @return - void
+ */
+static void move_file(Directory_Entry * dir, int index, const Directory_Entry * seen,
+		int blocks, defrag_report * report) {
+	uint32_t old = seen->dir_first_cluster;
+
+	// the lowest free run, so moved files pack the front of the volume
+	uint32_t target = allocate_contiguous(blocks, 0);
+	if (target == (uint32_t) -1) {
+		report->no_space++;
+		return;
+	}
+	if (copy_chain(old, blocks, target) == -1) {
+		TRACE_ERROR("[ DEFRAG ] : Failed to copy %s.\n", seen->dir_name);
+		release_blocks(target);
+		report->errors++;
+		return;
+	}
+	update_fat_on_disk();
+
+	dir_write_lock(dir);
+	Directory_Entry * de = &dir[index];
+	if (dir[1].dir_first_cluster == (uint32_t) -1 || !(de->dir_attr & IS_ACTIVE)
+			|| de->dir_first_cluster != old || de->dir_file_size != seen->dir_file_size
+			|| de->dir_mod_time != seen->dir_mod_time
+			|| vnode_is_open(dir[0].dir_first_cluster, index)) {
+		// the copy may not match the file any more
+		dir_unlock(dir);
+		release_blocks(target);
+		report->skipped++;
+		return;
+	}
+	de->dir_first_cluster = target;
+	if (write_dir(dir) == -1) {
+		TRACE_ERROR("[ DEFRAG ] : Failed to switch %s to its copy.\n", de->dir_name);
+		de->dir_first_cluster = old;
+		dir_unlock(dir);
+		release_blocks(target);
+		report->errors++;
+		return;
+	}
+	dir_unlock(dir);
+	// nothing points at the old chain any more
+	release_blocks(old);
+	report->moved_files++;
+	report->blocks_copied += blocks;
+}
+
+/**
+ * This helper function makes the chain of a directory contiguous after its
+ * first block. The first block stays, path walks find the directory by it
+ * without holding a lock. The caller holds the write lock of the directory.
+ *
+ * @param dir - the directory
+ * @param blocks - blocks in its chain
+ * @param runs - runs in its chain
+ * @param report - counts what was done
+ *
+ * @return - void
+ */
+static void compact_dir(Directory_Entry * dir, int blocks, int runs, defrag_report * report) {
+	uint32_t first = dir[0].dir_first_cluster;
+	if (blocks < 2) {
+		return;
+	}
+
+	// the first free run after the first block, best of all right after it
+	uint32_t target = allocate_contiguous(blocks - 1, first + 1);
+	if (target == (uint32_t) -1) {
+		report->no_space++;
+		return;
+	}
+	if (target != first + 1 && runs <= 2) {
+		// the first block and one run is as good as the new place
+		release_blocks(target);
+		return;
+	}
+
+	// the buffer is the directory, the copy is written straight from it
+	if (elv_write((char *) dir + bytes_per_block, blocks - 1, target) != blocks - 1) {
+		TRACE_ERROR("[ DEFRAG ] : Failed to copy directory %s.\n", dir[0].path);
+		release_blocks(target);
+		report->errors++;
+		return;
+	}
+	replace_after(first, target);
+	report->compacted_dirs++;
+	report->blocks_copied += blocks - 1;
+}
+
+/**
+ * This helper function looks at one directory, then at its subdirectories.
+ * Every slot is looked at under its own short hold of the read lock, a file
+ * is copied with no lock held.
+ *
+ * @param dir - the directory, the caller holds a reference
+ * @param apply - 1 to move data, 0 to only count
+ * @param report - receives the counts
+ *
+ * @return - void
+ */
+static void walk_dir(Directory_Entry * dir, int apply, defrag_report * report) {
+	int entries = vcb->entries_per_dir;
+	child_dir * children = malloc(entries * sizeof(child_dir));
+	int child_count = 0;
+	if (children == NULL) {
+		report->errors++;
+		return;
+	}
+
+	for (int i = 2; i < entries; i++) {
+		dir_read_lock(dir);
+		// rmdir marks a directory it removes, its blocks are not ours any more
+		if (dir[1].dir_first_cluster == (uint32_t) -1) {
+			dir_unlock(dir);
+			break;
+		}
+		Directory_Entry * de = &dir[i];
+		Directory_Entry seen;
+		int move_blocks = 0;
+		if ((de->dir_attr & IS_ACTIVE) && (de->dir_attr & IS_DIR)) {
+			children[child_count].index = i;
+			children[child_count].cluster = de->dir_first_cluster;
+			child_count++;
+		} else if (de->dir_attr & IS_ACTIVE) {
+			int blocks;
+			int runs = count_runs(de->dir_first_cluster, &blocks);
+			report->files++;
+			report->file_blocks += blocks;
+			report->file_runs += runs;
+			if (runs > 1) {
+				report->fragmented_files++;
+				if (apply && vnode_is_open(dir[0].dir_first_cluster, i)) {
+					// its vnode knows the old blocks
+					report->skipped++;
+				} else if (apply) {
+					seen = *de;
+					move_blocks = blocks;
+				}
+			}
+		}
+		dir_unlock(dir);
+		if (move_blocks > 0) {
+			int before = report->moved_files;
+			move_file(dir, i, &seen, move_blocks, report);
+			if (report->moved_files > before) {
+				// one sweep per file
+				flush_queue();
+			}
+		}
+	}
+
+	int blocks;
+	if (apply) {
+		dir_write_lock(dir);
+	} else {
+		dir_read_lock(dir);
+	}
+	if (dir[1].dir_first_cluster != (uint32_t) -1) {
+		int runs = count_runs(dir[0].dir_first_cluster, &blocks);
+		report->dirs++;
+		report->dir_runs += runs;
+		if (runs > 1) {
+			report->fragmented_dirs++;
+			if (apply) {
+				compact_dir(dir, blocks, runs, report);
+			}
+		}
+	}
+	dir_unlock(dir);
+
+	for (int c = 0; c < child_count; c++) {
+		// the slot is checked again, the subdirectory may be gone by now
+		dir_read_lock(dir);
+		Directory_Entry * child = NULL;
+		Directory_Entry * de = &dir[children[c].index];
+		if ((de->dir_attr & IS_ACTIVE) && (de->dir_attr & IS_DIR)
+				&& de->dir_first_cluster == children[c].cluster) {
+			child = dir_get(children[c].cluster);
+		}
+		dir_unlock(dir);
+		if (child != NULL) {
+			walk_dir(child, apply, report);
+			dir_put(child);
+		}
+	}
+	free(children);
+}
+
+/**
+ * This helper function walks the tree from the root
+ *
+ * @param apply - 1 to move data, 0 to only count
+ * @param report - receives the counts
+ *
+ * @return - 0 on success, -1 if an error was counted
+ */
+static int walk_volume(int apply, defrag_report * report) {
+	memset(report, 0, sizeof(defrag_report));
+	if (apply) {
+		// closed files still queued for the flusher keep a vnode until written
+		wb_sync();
+	}
+	dir_hold(root_directory);
+	walk_dir(root_directory, apply, report);
+	dir_put(root_directory);
+	if (apply) {
+		flush_queue();
+	}
+	fat_free_extents(&report->free_extents, &report->largest_free);
+	return report->errors > 0 ? -1 : 0;
+}
+
+/**
+ * This function measures the fragmentation of the volume
+ *
+ * @param report - receives the counts
+ *
+ * @return - 0 on success, -1 if an error was counted
+ */
+int defrag_scan(defrag_report * report) {
+	return walk_volume(0, report);
+}
+
+/**
+ * This function defragments the volume in the background I/O class
+ *
+ * @param rate - most bytes per second, 0 keeps the rate of the class
+ * @param before - receives a scan taken before, can be NULL
+ * @param after - receives a scan taken after with the counts of the run, can be NULL
+ *
+ * @return - 0 on success, -1 if an error stopped part of the run
+ */
+int defrag_volume(uint64_t rate, defrag_report * before, defrag_report * after) {
+	defrag_report run;
+	uint64_t old_rate;
+	uint64_t old_burst;
+	LBAgetrate(IO_CLASS_BACKGROUND, &old_rate, &old_burst);
+	int old_class = LBAsetclass(IO_CLASS_BACKGROUND);
+	caller_class = old_class;
+	if (rate > 0) {
+		LBAsetrate(IO_CLASS_BACKGROUND, rate, IO_BACKGROUND_BURST);
+	}
+
+	if (before != NULL) {
+		defrag_scan(before);
+	}
+	int ret = walk_volume(1, &run);
+	if (after != NULL) {
+		defrag_scan(after);
+		after->moved_files = run.moved_files;
+		after->compacted_dirs = run.compacted_dirs;
+		after->skipped = run.skipped;
+		after->no_space = run.no_space;
+		after->errors += run.errors;
+		after->blocks_copied = run.blocks_copied;
+	}
+
+	if (rate > 0) {
+		// the rate someone set before the run, not the default
+		LBAsetrate(IO_CLASS_BACKGROUND, old_rate, old_burst);
+	}
+	LBAsetclass(old_class);
+	return ret;
+}
+
+/**
+ * This function prints a report on one line
+ *
+ * @param out - where to print
+ * @param label - name of the report
+ * @param r - the report
+ *
+ * @return - void
+ */
+void defrag_print(FILE * out, const char * label, const defrag_report * r) {
+	fprintf(out, "%-7s files %d (%d fragmented, %.2f runs each)  dirs %d (%d fragmented)"
+			"  free space %d runs, largest %d blocks\n", label,
+			r->files, r->fragmented_files,
+			r->files > 0 ? (double) r->file_runs / r->files : 0,
+			r->dirs, r->fragmented_dirs, r->free_extents, r->largest_free);
+	if (r->moved_files || r->compacted_dirs || r->skipped || r->no_space || r->errors) {
+		fprintf(out, "%-7s moved %d files and %d dirs, %ld blocks copied, %d skipped,"
+				" %d without room, %d errors\n", "",
+				r->moved_files, r->compacted_dirs, r->blocks_copied,
+				r->skipped, r->no_space, r->errors);
+	}
+}
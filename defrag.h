@@ -0,0 +1,62 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: defrag.h
+*
+* Description: Defragmenter. Walks the directory tree, copies
+*	every file stored in more than one run of blocks into one
+*	contiguous extent and switches its entry to the copy, and
+*	makes the chain of every directory contiguous after its
+*	first block. It runs in the background I/O class, so its
+*	reads and writes are held to the background rate.
+**************************************************************/
+#ifndef _DEFRAG_H
+#define _DEFRAG_H
+#include <stdio.h>
+#include <stdint.h>
+
+// most blocks read or written by one copy request
+#define DEFRAG_IO_BLOCKS	128
+
+// what a walk of the tree found, and did when it moved data
+typedef struct defrag_report
+	{
+	int files;			// regular files
+	int fragmented_files;		// files in more than one run
+	long file_blocks;		// blocks of every file
+	long file_runs;			// runs of consecutive blocks over every file
+	int dirs;			// directories, the root included
+	int fragmented_dirs;		// directories in more than one run
+	long dir_runs;			// runs over every directory
+	int free_extents;		// runs of free blocks
+	int largest_free;		// blocks in the longest free run
+	int moved_files;		// files copied into one extent
+	int compacted_dirs;		// directories made contiguous
+	int skipped;			// files left where they are, open or changed during the copy
+	int no_space;			// files with no free run long enough
+	int errors;
+	long blocks_copied;
+	} defrag_report;
+
+// Measures the fragmentation of the volume without changing it.
+// Returns 0 on success, -1 if the tree could not be read.
+int defrag_scan(defrag_report * report);
+
+// Defragments the volume. rate is the most bytes per second the copy reads
+// or writes, 0 keeps the rate of the background class. before and after,
+// when not NULL, receive scans taken around the run, the counts of what
+// was moved are in after.
+// Returns 0 on success, -1 if an error stopped part of the run.
+int defrag_volume(uint64_t rate, defrag_report * before, defrag_report * after);
+
+// Prints a report on one line.
+void defrag_print(FILE * out, const char * label, const defrag_report * report);
+
+#endif
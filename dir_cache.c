@@ -0,0 +1,463 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: dir_cache.c
+*
+* Description: Pool of shared, reference counted directory buffers.
+**************************************************************/
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "dir_cache.h"
+#include "root_init.h"
+#include "trace.h"
+#include "metrics.h"
+
+// one directory buffer of the pool
+typedef struct dir_slot
+	{
+	Directory_Entry * buf;		// points into the slab data
+	uint32_t cluster;		// first block of the directory loaded in buf
+	int refcount;			// users holding the buffer
+	int valid;			// 1 if dir_get can find it by cluster
+	int loading;			// 1 while the directory is read into buf
+	int failed;			// 1 if the read failed, buf holds nothing
+	pthread_rwlock_t lock;		// readers scan the entries, writers change them
+	struct dir_slot * hash_next;	// next slot in the same hash bucket
+	struct dir_slot * lru_prev;	// unused slots, most recently put first
+	struct dir_slot * lru_next;
+	} dir_slot;
+
+// put in front of every buffer, so the slot of a buffer is found without
+// walking the slabs or taking the pool lock
+typedef union dir_header
+	{
+	dir_slot * slot;
+	max_align_t align;		// keeps the buffer after it aligned
+	} dir_header;
+
+// a fixed group of slots sharing one block of memory
+typedef struct dir_slab
+	{
+	struct dir_slab * next;
+	char * data;
+	dir_slot slots[DIR_SLAB_SLOTS];
+	} dir_slab;
+
+static dir_slab * slabs = NULL;
+static dir_slot * buckets[DIR_HASH_BUCKETS];
+static dir_slot * free_slots = NULL;	// never loaded or invalidated, linked by lru_next
+static dir_slot * lru_head = NULL;	// cached with no users, reused from the tail
+static dir_slot * lru_tail = NULL;
+static int dir_bytes = 0;
+static int dir_blocks = 0;
+static int dir_block_size = 0;
+// protects the lists, the hash and the reference counts, never the entries
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+// signalled when a slot is done loading
+static pthread_cond_t load_done = PTHREAD_COND_INITIALIZER;
+
+static void invalidate_locked(uint32_t first_cluster);
+
+static int bucket_of(uint32_t cluster) {
+	return cluster % DIR_HASH_BUCKETS;
+}
+
+static void hash_insert(dir_slot * slot) {
+	int b = bucket_of(slot->cluster);
+	slot->hash_next = buckets[b];
+	buckets[b] = slot;
+}
+
+static void hash_remove(dir_slot * slot) {
+	dir_slot ** link = &buckets[bucket_of(slot->cluster)];
+	while (*link != NULL) {
+		if (*link == slot) {
+			*link = slot->hash_next;
+			slot->hash_next = NULL;
+			return;
+		}
+		link = &(*link)->hash_next;
+	}
+}
+
+static dir_slot * hash_find(uint32_t cluster) {
+	for (dir_slot * slot = buckets[bucket_of(cluster)]; slot != NULL; slot = slot->hash_next) {
+		if (slot->cluster == cluster) {
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+static void lru_remove(dir_slot * slot) {
+	if (slot->lru_prev != NULL) slot->lru_prev->lru_next = slot->lru_next;
+	else lru_head = slot->lru_next;
+	if (slot->lru_next != NULL) slot->lru_next->lru_prev = slot->lru_prev;
+	else lru_tail = slot->lru_prev;
+	slot->lru_prev = NULL;
+	slot->lru_next = NULL;
+}
+
+static void lru_push(dir_slot * slot) {
+	slot->lru_prev = NULL;
+	slot->lru_next = lru_head;
+	if (lru_head != NULL) lru_head->lru_prev = slot;
+	lru_head = slot;
+	if (lru_tail == NULL) lru_tail = slot;
+}
+
+static void free_push(dir_slot * slot) {
+	slot->valid = 0;
+	slot->lru_prev = NULL;
+	slot->lru_next = free_slots;
+	free_slots = slot;
+}
+
+/**
+ * This helper function adds a slab of DIR_SLAB_SLOTS buffers to the free slots
+ *
+ * @return - 0 on success, -1 if memory ran out
+ */
+static int add_slab() {
+	dir_slab * slab = malloc(sizeof(dir_slab));
+	if (slab == NULL) {
+		return -1;
+	}
+	size_t stride = sizeof(dir_header) + dir_bytes;
+	slab->data = malloc(stride * DIR_SLAB_SLOTS);
+	if (slab->data == NULL) {
+		free(slab);
+		return -1;
+	}
+	for (int i = 0; i < DIR_SLAB_SLOTS; i++) {
+		dir_slot * slot = &slab->slots[i];
+		dir_header * header = (dir_header *) (slab->data + (size_t) i * stride);
+		header->slot = slot;
+		slot->buf = (Directory_Entry *) (header + 1);
+		slot->refcount = 0;
+		slot->loading = 0;
+		slot->failed = 0;
+		slot->hash_next = NULL;
+		pthread_rwlock_init(&slot->lock, NULL);
+		free_push(slot);
+	}
+	slab->next = slabs;
+	slabs = slab;
+	return 0;
+}
+
+/**
+ * This helper function finds the slot that owns a buffer from the header
+ * in front of it. The header is set when the slab is added and never
+ * changes, so a buffer that is held needs no pool lock.
+ *
+ * @param dir - a buffer returned by dir_get or dir_new
+ *
+ * @return - the slot
+ */
+static dir_slot * slot_of(Directory_Entry * dir) {
+	return ((dir_header *) dir - 1)->slot;
+}
+
+/**
+ * This helper function takes an unused slot, a never loaded one first,
+ * then the least recently used cached directory, then a new slab
+ *
+ * @return - a slot with no users that is in no list, NULL if memory ran out
+ */
+static dir_slot * take_slot() {
+	if (free_slots == NULL && lru_tail == NULL && add_slab() == -1) {
+		return NULL;
+	}
+	dir_slot * slot;
+	if (free_slots != NULL) {
+		slot = free_slots;
+		free_slots = slot->lru_next;
+		slot->lru_next = NULL;
+	} else {
+		slot = lru_tail;
+		lru_remove(slot);
+		hash_remove(slot);
+		slot->valid = 0;
+	}
+	return slot;
+}
+
+/**
+ * This function sets up the pool
+ *
+ * @param entries_per_dir - number of entries in every directory
+ * @param block_size - size of a block on the volume
+ *
+ * @return - 0 on success
+ */
+int dir_cache_init(int entries_per_dir, int block_size) {
+	int min_bytes_needed = entries_per_dir * sizeof(Directory_Entry);
+	dir_blocks = (min_bytes_needed + block_size - 1) / block_size;
+	dir_bytes = dir_blocks * block_size;
+	dir_block_size = block_size;
+	memset(buckets, 0, sizeof(buckets));
+	return 0;
+}
+
+/**
+ * This helper function drops a reference, the caller holds the pool lock
+ *
+ * @param slot - a slot with a reference
+ *
+ * @return - void
+ */
+static void put_locked(dir_slot * slot) {
+	slot->refcount--;
+	if (slot->refcount == 0) {
+		if (slot->valid) {
+			lru_push(slot);
+		} else {
+			free_push(slot);
+		}
+	}
+}
+
+/**
+ * This function returns a shared copy of a directory. The slot of a
+ * directory being read is in the hash already, marked loading, so the
+ * read happens without the pool lock and other callers wait on the slot.
+ *
+ * @param first_cluster - first block of the directory
+ *
+ * @return - the directory buffer with one more reference
+ *         - NULL if the directory can't be read
+ */
+Directory_Entry * dir_get(uint32_t first_cluster) {
+	pthread_mutex_lock(&pool_mutex);
+	dir_slot * slot = hash_find(first_cluster);
+	if (slot != NULL) {
+		// somebody has it loaded already, or it is cached with no users
+		if (slot->refcount == 0) {
+			lru_remove(slot);
+		}
+		slot->refcount++;
+		while (slot->loading) {
+			pthread_cond_wait(&load_done, &pool_mutex);
+		}
+		if (slot->failed) {
+			put_locked(slot);
+			pthread_mutex_unlock(&pool_mutex);
+			return NULL;
+		}
+		pthread_mutex_unlock(&pool_mutex);
+		metrics_count(MC_DIR_CACHE_HIT);
+		return slot->buf;
+	}
+	metrics_count(MC_DIR_CACHE_MISS);
+
+	slot = take_slot();
+	if (slot == NULL) {
+		pthread_mutex_unlock(&pool_mutex);
+		TRACE_ERROR("[ DIR CACHE ] : Out of memory for directory buffers.\n");
+		return NULL;
+	}
+	// nobody can be changing a directory that nobody has loaded, the
+	// loading slot in the hash keeps a second caller from reading it again
+	slot->cluster = first_cluster;
+	slot->valid = 1;
+	slot->loading = 1;
+	slot->failed = 0;
+	slot->refcount = 1;
+	hash_insert(slot);
+	pthread_mutex_unlock(&pool_mutex);
+
+	uint64_t start = metrics_now();
+	int loaded = read_from_disk(slot->buf, first_cluster, dir_blocks, dir_block_size);
+	metrics_record(M_DIR_LOAD, start);
+
+	pthread_mutex_lock(&pool_mutex);
+	slot->loading = 0;
+	if (loaded == -1) {
+		slot->failed = 1;
+		// it may have been invalidated while it was read
+		if (slot->valid) {
+			hash_remove(slot);
+			slot->valid = 0;
+		}
+		put_locked(slot);
+	}
+	pthread_cond_broadcast(&load_done);
+	pthread_mutex_unlock(&pool_mutex);
+	if (loaded == -1) {
+		TRACE_ERROR("[ DIR CACHE ] : Failed to load directory at %u.\n", first_cluster);
+		return NULL;
+	}
+	return slot->buf;
+}
+
+/**
+ * This function returns a zeroed buffer for a directory that is being created
+ *
+ * @param first_cluster - first block allocated for the new directory
+ *
+ * @return - the directory buffer with one reference, NULL if memory ran out
+ */
+Directory_Entry * dir_new(uint32_t first_cluster) {
+	pthread_mutex_lock(&pool_mutex);
+	// a stale copy of whatever used these blocks before can't be found any more
+	invalidate_locked(first_cluster);
+
+	dir_slot * slot = take_slot();
+	if (slot == NULL) {
+		pthread_mutex_unlock(&pool_mutex);
+		return NULL;
+	}
+	memset(slot->buf, 0, dir_bytes);
+	slot->cluster = first_cluster;
+	slot->valid = 1;
+	slot->failed = 0;
+	slot->refcount = 1;
+	hash_insert(slot);
+	pthread_mutex_unlock(&pool_mutex);
+	return slot->buf;
+}
+
+/**
+ * This function adds a reference to a directory buffer
+ *
+ * @param dir - a buffer returned by dir_get or dir_new
+ *
+ * @return - void
+ */
+void dir_hold(Directory_Entry * dir) {
+	pthread_mutex_lock(&pool_mutex);
+	slot_of(dir)->refcount++;
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+/**
+ * This function drops a reference to a directory buffer
+ *
+ * @param dir - a buffer returned by dir_get or dir_new, NULL is ignored
+ *
+ * @return - void
+ */
+void dir_put(Directory_Entry * dir) {
+	if (dir == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&pool_mutex);
+	dir_slot * slot = slot_of(dir);
+	if (slot->refcount == 0) {
+		pthread_mutex_unlock(&pool_mutex);
+		TRACE_ERROR("[ DIR CACHE ] : Put of a buffer that is not held.\n");
+		return;
+	}
+	put_locked(slot);
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+/**
+ * This function forgets the loaded copy of a directory that was removed
+ *
+ * @param first_cluster - first block of the removed directory
+ *
+ * @return - void
+ */
+void dir_invalidate(uint32_t first_cluster) {
+	pthread_mutex_lock(&pool_mutex);
+	invalidate_locked(first_cluster);
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+/**
+ * This helper function does the work of dir_invalidate, the caller holds the pool lock
+ *
+ * @param first_cluster - first block of the removed directory
+ *
+ * @return - void
+ */
+static void invalidate_locked(uint32_t first_cluster) {
+	dir_slot * slot = hash_find(first_cluster);
+	if (slot == NULL) {
+		return;
+	}
+	hash_remove(slot);
+	slot->valid = 0;
+	if (slot->refcount == 0) {
+		lru_remove(slot);
+		free_push(slot);
+	}
+}
+
+/**
+ * This function takes the shared lock of a directory to read its entries
+ *
+ * @param dir - a buffer held with dir_get or dir_new
+ *
+ * @return - void
+ */
+void dir_read_lock(Directory_Entry * dir) {
+	pthread_rwlock_rdlock(&slot_of(dir)->lock);
+}
+
+/**
+ * This function takes the exclusive lock of a directory to change its entries
+ *
+ * @param dir - a buffer held with dir_get or dir_new
+ *
+ * @return - void
+ */
+void dir_write_lock(Directory_Entry * dir) {
+	pthread_rwlock_wrlock(&slot_of(dir)->lock);
+}
+
+/**
+ * This function releases the lock taken by dir_read_lock or dir_write_lock
+ *
+ * @param dir - a buffer held with dir_get or dir_new
+ *
+ * @return - void
+ */
+void dir_unlock(Directory_Entry * dir) {
+	pthread_rwlock_unlock(&slot_of(dir)->lock);
+}
+
+/**
+ * This function returns the size of every directory buffer
+ *
+ * @return - size in bytes
+ */
+int dir_cache_bytes(void) {
+	return dir_bytes;
+}
+
+/**
+ * This function frees the whole pool
+ *
+ * @return - void
+ */
+void dir_cache_destroy(void) {
+	dir_slab * slab = slabs;
+	while (slab != NULL) {
+		dir_slab * next = slab->next;
+		for (int i = 0; i < DIR_SLAB_SLOTS; i++) {
+			pthread_rwlock_destroy(&slab->slots[i].lock);
+		}
+		free(slab->data);
+		free(slab);
+		slab = next;
+	}
+	slabs = NULL;
+	free_slots = NULL;
+	lru_head = NULL;
+	lru_tail = NULL;
+	memset(buckets, 0, sizeof(buckets));
+}
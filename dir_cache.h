@@ -0,0 +1,67 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: dir_cache.h
+*
+* Description: Pool of directory buffers. Every directory is the
+*	same size, so buffers come from fixed-size slabs. A loaded
+*	directory is shared by everyone who asks for it and counted,
+*	the buffer goes back to the pool when the last user puts it.
+*	The pool is thread safe and every directory has its own
+*	reader/writer lock.
+**************************************************************/
+#ifndef _DIR_CACHE_H
+#define _DIR_CACHE_H
+#include <stdint.h>
+#include "root_init.h"
+
+// number of directory buffers added to the pool at a time
+#define DIR_SLAB_SLOTS	16
+// number of hash buckets used to find a loaded directory by its first block
+#define DIR_HASH_BUCKETS	64
+
+// Sets up the pool for directories of entries_per_dir entries.
+// Returns 0 on success, -1 on failure.
+int dir_cache_init(int entries_per_dir, int block_size);
+
+// Returns the loaded directory starting at first_cluster with one more
+// reference, reading it from disk only if nobody has it loaded.
+// Returns NULL if it can't be read.
+Directory_Entry * dir_get(uint32_t first_cluster);
+
+// Returns a zeroed buffer for a new directory at first_cluster with one reference.
+Directory_Entry * dir_new(uint32_t first_cluster);
+
+// Adds a reference to a directory that is already held.
+void dir_hold(Directory_Entry * dir);
+
+// Drops a reference, the buffer stays cached for the next dir_get
+// until the pool needs it for another directory.
+void dir_put(Directory_Entry * dir);
+
+// The directory at first_cluster is removed from disk, the loaded copy
+// can't be found any more and goes back to the pool on the last put.
+void dir_invalidate(uint32_t first_cluster);
+
+// Locks of a held directory. Readers of the entries share the lock, a
+// thread changing entries or writing the directory to disk takes it alone.
+// A thread holds at most one directory lock at a time, except a parent
+// before its child, or two siblings in the order of their first block.
+void dir_read_lock(Directory_Entry * dir);
+void dir_write_lock(Directory_Entry * dir);
+void dir_unlock(Directory_Entry * dir);
+
+// Size in bytes of every directory buffer.
+int dir_cache_bytes(void);
+
+// Frees every slab, called when the file system exits.
+void dir_cache_destroy(void);
+
+#endif
@@ -0,0 +1,475 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: elevator.c
+*
+* Description: Sorting and merging write queue for the block
+*	layer.
+**************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "fsLow.h"
+#include "elevator.h"
+#include "geometry.h"
+#include "trace.h"
+
+
+// one queued write, the list keeps them in the order they were queued
+typedef struct elv_request
+	{
+	struct elv_request * next;
+	uint64_t lba;
+	uint64_t count;
+	unsigned long seq;	// order the write was queued in
+	unsigned long epoch;	// barriers passed before it was queued
+	int taken;		// picked by the dispatch running now
+	char * data;		// count blocks
+	} elv_request;
+
+// blocks of the volume written by one dispatch, several requests merged
+typedef struct elv_run
+	{
+	uint64_t lba;
+	uint64_t count;
+	int first;		// index of the first request of the run
+	int n;			// number of requests in the run
+	} elv_run;
+
+// The list changes under the write lock. Readers hold the read lock from
+// LBAread until they have laid the queue over the data, and requests leave
+// the list only after their blocks are on disk, so a reader sees either the
+// queued data or the disk with it.
+static elv_request * queue_head = NULL;
+static elv_request * queue_tail = NULL;
+static int queued_blocks = 0;
+static unsigned long next_seq = 0;
+static unsigned long epoch = 0;
+static pthread_rwlock_t queue_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// one dispatch at a time, it also guards head_position
+static pthread_mutex_t dispatch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t head_position = 0;	// block after the last one dispatched
+
+static elv_stats stats;
+
+/**
+ * This helper function writes clusters to the disk
+ *
+ * @param buffer - count clusters of data
+ * @param count - number of clusters
+ * @param lba - first cluster
+ *
+ * @return - count on success, less if LBAwrite did not write every block
+ */
+static uint64_t disk_write(void * buffer, uint64_t count, uint64_t lba) {
+	// a cluster is 1 << disk_shift blocks of the disk
+	return LBAwrite(buffer, count << fs_geo.disk_shift, lba << fs_geo.disk_shift) >> fs_geo.disk_shift;
+}
+
+/**
+ * This helper function reads clusters from the disk
+ *
+ * @param buffer - room for count clusters
+ * @param count - number of clusters
+ * @param lba - first cluster
+ *
+ * @return - count on success, less if LBAread did not read every block
+ */
+static uint64_t disk_read(void * buffer, uint64_t count, uint64_t lba) {
+	return LBAread(buffer, count << fs_geo.disk_shift, lba << fs_geo.disk_shift) >> fs_geo.disk_shift;
+}
+
+/**
+ * This helper function orders requests by block, then by the order they
+ * were queued in
+ *
+ * @param a - pointer to a request pointer
+ * @param b - pointer to a request pointer
+ *
+ * @return - negative, zero or positive like strcmp
+ */
+static int by_lba(const void * a, const void * b) {
+	const elv_request * ra = *(elv_request * const *) a;
+	const elv_request * rb = *(elv_request * const *) b;
+	if (ra->lba != rb->lba) {
+		return ra->lba < rb->lba ? -1 : 1;
+	}
+	return (ra->seq > rb->seq) - (ra->seq < rb->seq);
+}
+
+/**
+ * This helper function orders requests by the order they were queued in
+ *
+ * @param a - pointer to a request pointer
+ * @param b - pointer to a request pointer
+ *
+ * @return - negative, zero or positive like strcmp
+ */
+static int by_seq(const void * a, const void * b) {
+	const elv_request * ra = *(elv_request * const *) a;
+	const elv_request * rb = *(elv_request * const *) b;
+	return (ra->seq > rb->seq) - (ra->seq < rb->seq);
+}
+
+/**
+ * This helper function returns the size bucket of a dispatch
+ *
+ * @param count - blocks written
+ *
+ * @return - index into elv_stats.sizes
+ */
+static int size_bucket(uint64_t count) {
+	if (count < 2) return 0;
+	if (count < 8) return 1;
+	if (count < 32) return 2;
+	if (count < 128) return 3;
+	return 4;
+}
+
+/**
+ * This helper function writes one run, the requests are laid over each
+ * other in the order they were queued so the newest data wins
+ *
+ * @param run - the run
+ * @param reqs - the requests of the dispatch, sorted by block
+ *
+ * @return - 0 on success, -1 if the write failed
+ */
+static int write_run(elv_run * run, elv_request ** reqs) {
+	elv_request ** part = reqs + run->first;
+	char * data;
+	char * merged = NULL;
+
+	if (run->n == 1) {
+		data = part[0]->data;
+	} else {
+		merged = malloc(run->count * bytes_per_block);
+		if (merged == NULL) {
+			// write the requests one by one, in the order they were queued
+			qsort(part, run->n, sizeof(elv_request *), by_seq);
+			int failed = 0;
+			for (int i = 0; i < run->n; i++) {
+				if (disk_write(part[i]->data, part[i]->count, part[i]->lba) != part[i]->count) {
+					failed = 1;
+				}
+			}
+			return failed ? -1 : 0;
+		}
+		qsort(part, run->n, sizeof(elv_request *), by_seq);
+		for (int i = 0; i < run->n; i++) {
+			memcpy(merged + (part[i]->lba - run->lba) * bytes_per_block, part[i]->data,
+					part[i]->count * bytes_per_block);
+		}
+		data = merged;
+	}
+
+	int ret = disk_write(data, run->count, run->lba) == run->count ? 0 : -1;
+	free(merged);
+	return ret;
+}
+
+/**
+ * This helper function dispatches the requests of the oldest epoch queued
+ * up to stop_seq. The requests are sorted by block, neighbours and overlaps
+ * are merged into runs, and the runs are written in one sweep that starts
+ * at the head position and wraps around to the lowest block. The caller
+ * holds dispatch_mutex.
+ *
+ * @param stop_seq - requests queued after this one are left for later
+ *
+ * @return - 1 if an epoch was dispatched, 0 if there was nothing to do,
+ *           -1 if a write failed
+ */
+static int dispatch_epoch(unsigned long stop_seq) {
+	pthread_rwlock_wrlock(&queue_lock);
+	if (queue_head == NULL || queue_head->seq > stop_seq) {
+		pthread_rwlock_unlock(&queue_lock);
+		return 0;
+	}
+	unsigned long oldest = queue_head->epoch;
+	int n = 0;
+	for (elv_request * r = queue_head; r != NULL && r->seq <= stop_seq; r = r->next) {
+		if (r->epoch == oldest) {
+			n++;
+		}
+	}
+	elv_request ** reqs = malloc(n * sizeof(elv_request *));
+	elv_run * runs = malloc(n * sizeof(elv_run));
+	if (reqs == NULL || runs == NULL) {
+		pthread_rwlock_unlock(&queue_lock);
+		free(reqs);
+		free(runs);
+		TRACE_ERROR("[ ELEVATOR ] : Failed to allocate a dispatch of %d requests.\n", n);
+		return -1;
+	}
+	n = 0;
+	for (elv_request * r = queue_head; r != NULL && r->seq <= stop_seq; r = r->next) {
+		if (r->epoch == oldest) {
+			r->taken = 1;
+			reqs[n++] = r;
+		}
+	}
+	pthread_rwlock_unlock(&queue_lock);
+
+	// runs of requests that touch or overlap, in block order
+	qsort(reqs, n, sizeof(elv_request *), by_lba);
+	int run_count = 0;
+	for (int i = 0; i < n; ) {
+		elv_run * run = &runs[run_count++];
+		run->lba = reqs[i]->lba;
+		run->count = reqs[i]->count;
+		run->first = i;
+		run->n = 1;
+		for (i++; i < n; i++) {
+			uint64_t end = reqs[i]->lba + reqs[i]->count;
+			if (reqs[i]->lba > run->lba + run->count) {
+				break;
+			}
+			uint64_t new_count = end > run->lba + run->count ? end - run->lba : run->count;
+			if (new_count > ELV_MAX_DISPATCH && reqs[i]->lba == run->lba + run->count) {
+				// a neighbour that would make the run too big starts the next one,
+				// an overlap has to stay in the run so the newest data wins
+				break;
+			}
+			run->count = new_count;
+			run->n++;
+		}
+	}
+
+	// the sweep starts at the first run at or after the head
+	int start = 0;
+	while (start < run_count && runs[start].lba < head_position) {
+		start++;
+	}
+	if (start == run_count) {
+		start = 0;
+	}
+	int failed = 0;
+	unsigned long sizes[ELV_SIZE_BUCKETS] = {0};
+	unsigned long blocks = 0;
+	for (int k = 0; k < run_count; k++) {
+		elv_run * run = &runs[(start + k) % run_count];
+		if (write_run(run, reqs) == -1) {
+			TRACE_ERROR("[ ELEVATOR ] : Failed to write %lu blocks at %lu.\n",
+					(unsigned long) run->count, (unsigned long) run->lba);
+			failed++;
+		}
+		head_position = run->lba + run->count;
+		sizes[size_bucket(run->count)]++;
+		blocks += run->count;
+	}
+
+	// the blocks are on disk, the requests can leave the queue
+	pthread_rwlock_wrlock(&queue_lock);
+	elv_request * prev = NULL;
+	elv_request * r = queue_head;
+	while (r != NULL) {
+		elv_request * next = r->next;
+		if (r->taken) {
+			if (prev == NULL) {
+				queue_head = next;
+			} else {
+				prev->next = next;
+			}
+			if (queue_tail == r) {
+				queue_tail = prev;
+			}
+			queued_blocks -= r->count;
+			free(r->data);
+			free(r);
+		} else {
+			prev = r;
+		}
+		r = next;
+	}
+	stats.depth -= n;
+	stats.dispatches += run_count;
+	stats.dispatched_blocks += blocks;
+	stats.sweeps++;
+	stats.errors += failed;
+	for (int b = 0; b < ELV_SIZE_BUCKETS; b++) {
+		stats.sizes[b] += sizes[b];
+	}
+	pthread_rwlock_unlock(&queue_lock);
+
+	free(reqs);
+	free(runs);
+	return failed ? -1 : 1;
+}
+
+/**
+ * This function queues a write
+ *
+ * @param buffer - count blocks of data, copied into the queue
+ * @param count - number of blocks
+ * @param lba - first block
+ *
+ * @return - count, or what LBAwrite returns when the write goes straight to disk
+ */
+uint64_t elv_write(void * buffer, uint64_t count, uint64_t lba) {
+	if (count == 0) {
+		return 0;
+	}
+	elv_request * req = malloc(sizeof(elv_request));
+	char * data = malloc(count * bytes_per_block);
+	if (req == NULL || data == NULL) {
+		free(req);
+		free(data);
+		// keep the order, everything queued goes first
+		elv_flush();
+		return disk_write(buffer, count, lba);
+	}
+	memcpy(data, buffer, count * bytes_per_block);
+	req->next = NULL;
+	req->lba = lba;
+	req->count = count;
+	req->taken = 0;
+	req->data = data;
+
+	pthread_rwlock_wrlock(&queue_lock);
+	req->seq = next_seq++;
+	req->epoch = epoch;
+	if (queue_tail == NULL) {
+		queue_head = req;
+	} else {
+		queue_tail->next = req;
+	}
+	queue_tail = req;
+	queued_blocks += count;
+	stats.requests++;
+	stats.blocks += count;
+	stats.depth++;
+	if (stats.depth > stats.max_depth) {
+		stats.max_depth = stats.depth;
+	}
+	int full = queued_blocks > ELV_MAX_BLOCKS;
+	pthread_rwlock_unlock(&queue_lock);
+
+	if (full) {
+		elv_flush();
+	}
+	return count;
+}
+
+/**
+ * This function reads blocks and lays the queued writes over them
+ *
+ * @param buffer - receives count blocks
+ * @param count - number of blocks
+ * @param lba - first block
+ *
+ * @return - what LBAread returns
+ */
+uint64_t elv_read(void * buffer, uint64_t count, uint64_t lba) {
+	pthread_rwlock_rdlock(&queue_lock);
+	uint64_t got = disk_read(buffer, count, lba);
+	for (elv_request * r = queue_head; r != NULL; r = r->next) {
+		if (r->lba >= lba + count || r->lba + r->count <= lba) {
+			continue;
+		}
+		uint64_t from = r->lba > lba ? r->lba : lba;
+		uint64_t to = r->lba + r->count < lba + count ? r->lba + r->count : lba + count;
+		memcpy((char *) buffer + (from - lba) * bytes_per_block,
+				r->data + (from - r->lba) * bytes_per_block,
+				(to - from) * bytes_per_block);
+	}
+	pthread_rwlock_unlock(&queue_lock);
+	return got;
+}
+
+/**
+ * This function starts a new epoch, an empty epoch needs no new one
+ *
+ * @return - void
+ */
+void elv_barrier(void) {
+	pthread_rwlock_wrlock(&queue_lock);
+	if (queue_tail != NULL && queue_tail->epoch == epoch) {
+		epoch++;
+		stats.barriers++;
+	}
+	pthread_rwlock_unlock(&queue_lock);
+}
+
+/**
+ * This function dispatches every write queued before the call
+ *
+ * @return - 0 on success, -1 if a write failed
+ */
+int elv_flush(void) {
+	pthread_mutex_lock(&dispatch_mutex);
+	pthread_rwlock_rdlock(&queue_lock);
+	unsigned long stop_seq = next_seq - 1;
+	int empty = queue_head == NULL;
+	pthread_rwlock_unlock(&queue_lock);
+
+	int ret = 0;
+	if (!empty) {
+		// a failed epoch stops the flush, the epochs behind it must not pass it
+		int done;
+		while ((done = dispatch_epoch(stop_seq)) == 1) {
+		}
+		ret = done == -1 ? -1 : 0;
+	}
+	pthread_mutex_unlock(&dispatch_mutex);
+	return ret;
+}
+
+/**
+ * This function returns the number of blocks waiting in the queue
+ *
+ * @return - the number of blocks
+ */
+int elv_pending(void) {
+	pthread_rwlock_rdlock(&queue_lock);
+	int blocks = queued_blocks;
+	pthread_rwlock_unlock(&queue_lock);
+	return blocks;
+}
+
+/**
+ * This function copies the counters of the queue
+ *
+ * @param out - receives the counters
+ *
+ * @return - void
+ */
+void elv_get_stats(elv_stats * out) {
+	pthread_rwlock_rdlock(&queue_lock);
+	*out = stats;
+	pthread_rwlock_unlock(&queue_lock);
+}
+
+/**
+ * This function dispatches every queued write before the file system exits
+ *
+ * @return - void
+ */
+void elv_exit(void) {
+	if (elv_flush() == -1) {
+		TRACE_ERROR("[ ELEVATOR ] : Some queued writes did not reach the disk.\n");
+	}
+}
+
+/**
+ * This function tells the disk it can drop the data of free clusters, the
+ * request is not queued
+ *
+ * @param count - number of clusters
+ * @param lba - first cluster
+ *
+ * @return - count on success, what LBAdiscard returns in clusters otherwise
+ */
+uint64_t elv_discard(uint64_t count, uint64_t lba) {
+	return LBAdiscard(count << fs_geo.disk_shift, lba << fs_geo.disk_shift) >> fs_geo.disk_shift;
+}
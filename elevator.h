@@ -0,0 +1,78 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: elevator.h
+*
+* Description: Write queue in front of LBAwrite. Writes are
+*	copied into the queue and dispatched later, sorted by
+*	block and merged with their neighbours, in one sweep up
+*	the volume. A barrier starts a new epoch, nothing queued
+*	after it reaches the disk before everything queued ahead
+*	of it. Reads see queued writes. The file system counts in
+*	clusters of one or more disk blocks, the queue turns them
+*	into blocks of the disk with the shift of the geometry.
+**************************************************************/
+#ifndef _ELEVATOR_H
+#define _ELEVATOR_H
+#include <stdint.h>
+
+// queued blocks above which the writer that queues more dispatches the queue
+#define ELV_MAX_BLOCKS		1024
+// most blocks written by one merged request
+#define ELV_MAX_DISPATCH	256
+// number of dispatch size buckets, 1, 2-7, 8-31, 32-127 and 128 or more blocks
+#define ELV_SIZE_BUCKETS	5
+
+// counters of the queue since the file system started
+typedef struct elv_stats
+	{
+	unsigned long requests;		// writes queued
+	unsigned long blocks;		// blocks queued
+	unsigned long dispatches;	// writes sent to LBAwrite after merging
+	unsigned long dispatched_blocks;	// blocks sent to LBAwrite, overlaps count once
+	unsigned long sweeps;		// passes over the queue
+	unsigned long barriers;		// epochs started by elv_barrier
+	unsigned long errors;		// dispatches LBAwrite did not finish
+	int depth;			// requests in the queue now
+	int max_depth;			// most requests ever queued at once
+	unsigned long sizes[ELV_SIZE_BUCKETS];	// dispatches by number of blocks
+	} elv_stats;
+
+// Queues a write of count blocks at lba, the buffer is copied so the
+// caller can reuse it. Returns count, or what LBAwrite returns if the
+// write could not be queued and went straight to disk.
+uint64_t elv_write(void * buffer, uint64_t count, uint64_t lba);
+
+// Reads count blocks at lba with the queued writes laid over them.
+// Returns what LBAread returns.
+uint64_t elv_read(void * buffer, uint64_t count, uint64_t lba);
+
+// Ordering point, writes queued before it reach the disk before any
+// write queued after it.
+void elv_barrier(void);
+
+// Dispatches every queued write, epoch by epoch.
+// Returns 0 on success, -1 if a write failed.
+int elv_flush(void);
+
+// Returns the number of blocks waiting in the queue.
+int elv_pending(void);
+
+// Copies the counters into stats.
+void elv_get_stats(elv_stats * stats);
+
+// Dispatches every queued write, called when the file system exits.
+void elv_exit(void);
+
+// Discards count clusters at lba on the disk, without queueing.
+// Returns count, or less if the disk can't discard.
+uint64_t elv_discard(uint64_t count, uint64_t lba);
+
+#endif
@@ -24,8 +24,13 @@
 
 #include "mfs.h"
 #include "FAT.h"
+#include "dir_cache.h"
+#include "writeback.h"
+#include "elevator.h"
+#include "geometry.h"
 
-int bytes_per_block;
+int fs_read_only = 0;
+int fs_cluster_blocks = 0;
 
 extern Directory_Entry *root_directory;
 
@@ -40,31 +45,46 @@ extern Directory_Entry *root_directory;
  */
 int initFileSystem(uint64_t number_of_blocks, uint64_t block_size) {
     printf("Initializing File System with %ld blocks with a block size of %ld\n", number_of_blocks, block_size);
-   bytes_per_block = block_size;
+    // the VCB is read one block at a time, it tells the size of a cluster
+    geo_set(block_size, 1);
     /* TODO: Add any code you need to initialize your file system. */
 
     int vcb_check = 0;
 
     //VCB not initalized at start, so you try to initalize
-    if (!vcb_is_init()) {
+    if (!vcb_is_init(block_size)) {
         printf("[ FS INIT ] : VCB not initialized. Attempting initialization...\n");
 
         vcb_check = vcb_init(number_of_blocks, block_size);
         if (vcb_check == -1) {
             return vcb_check;
         }
+        // everything below counts in clusters
+        if (vcb_use_clusters() == -1) {
+            free(vcb);
+            vcb = NULL;
+            return -1;
+        }
 
-        int fat_check = fat_init(vcb->total_blocks_32, block_size);
+        int fat_check = fat_init(vcb->total_blocks, bytes_per_block);
 
         if (fat_check == -1) {
             return fat_check;
         }
-        root_directory = init_directory(block_size, NULL, "");
+        dir_cache_init(vcb->entries_per_dir, bytes_per_block);
+        root_directory = init_directory(bytes_per_block, NULL, "");
 	current_directory = root_directory;
         if (root_directory == NULL) {
             printf("[ FS INIT ] : Failed to initialize root directory.\n");
 
+        } else {
+            // the VCB learns where the root went and what is left free
+            vcb->root_cluster = root_directory[0].dir_first_cluster;
+            vcb->free_space = get_total_free_blocks();
+            vcb_write_to_disk(vcb);
         }
+	// the current directory holds its own reference on the pool buffer
+	dir_hold(current_directory);
     } else { //otherwise vcb already intialized so start without initalizing it
         printf("[ FS INIT ] : VCB already initialized. Loading from disk...\n");
 
@@ -72,23 +92,78 @@ int initFileSystem(uint64_t number_of_blocks, uint64_t block_size) {
         if (vcb_check == -1) {
             printf("[ FS INIT ] : Failed to read VCB from disk.\n");
             free(vcb);
+            vcb = NULL;
             return vcb_check;
         }
-        fat_read_from_disk();
+        if (vcb->bytes_per_block != block_size) {
+            printf("[ FS INIT ] : The volume has blocks of %u bytes, not %llu.\n",
+                vcb->bytes_per_block, (ull_t) block_size);
+            free(vcb);
+            vcb = NULL;
+            return -1;
+        }
+        if (vcb_use_clusters() == -1) {
+            free(vcb);
+            vcb = NULL;
+            return -1;
+        }
+        if (fat_read_from_disk() != 0) {
+            printf("[ FS INIT ] : Failed to read the FAT summary from disk.\n");
+            free(vcb);
+            vcb = NULL;
+            return -1;
+        }
+        if (vcb->mount_state == VCB_CLEAN) {
+            printf("[ FS INIT ] : Volume was unmounted cleanly, using its free counts.\n");
+        } else {
+            // a crash can leave the summary behind the FAT, count it again
+            int wrong = fat_rebuild_summary();
+            vcb->free_space = get_total_free_blocks();
+            printf("[ FS INIT ] : Volume was not unmounted cleanly, %d group counts fixed.\n", wrong);
+        }
+        if (!fs_read_only) {
+            // until the checkpoint at exit, a crash leaves the volume unclean
+            vcb->mount_state = VCB_MOUNTED;
+            vcb_write_to_disk(vcb);
+            elv_barrier();
+        }
+        dir_cache_init(vcb->entries_per_dir, bytes_per_block);
         int root_check = load_root();
 
         if (root_check == -1) {
             printf("[ VCB INIT ] : Failed to load root directory.\n");
             free(vcb);
+            vcb = NULL;
             return root_check;
         }
 
     }
-	
+
+    // data written to files is flushed in the background from now on
+    wb_init();
 
     return 0;
 }
 
+/**
+ * This helper function writes the clean-unmount checkpoint. The FAT pages
+ * and the summary go first, then the VCB with the free count and the clean
+ * state, so the next mount can trust the summary without reading the FAT.
+ *
+ * @return - void
+ *         
+ */
+static void write_checkpoint() {
+    update_fat_on_disk();
+    // freed blocks still waiting for a full batch give their space back
+    fat_discard_flush();
+    vcb->free_space = get_total_free_blocks();
+    vcb->mount_state = VCB_CLEAN;
+    if (vcb_write_to_disk(vcb) == -1) {
+        printf("[ FS EXIT ] : Failed to write the checkpoint, the next mount counts free blocks.\n");
+    }
+}
+
 /**
  * This Function is used to exit the file system
  *
@@ -99,21 +174,27 @@ int initFileSystem(uint64_t number_of_blocks, uint64_t block_size) {
 void exitFileSystem() {
     printf("System exiting\n");
 
+    // open files still reference their directories, close them first,
+    // then the flusher writes what they left and stops
+    b_exit();
+    wb_exit();
+    if (!fs_read_only) {
+        write_checkpoint();
+    }
+    elv_exit();
+
     free(vcb);
     vcb = NULL;
 
-    free(fat_array);
-    fat_array = NULL;
+    fat_exit();
 
 	
-    if (current_directory != root_directory) {
-	    free(current_directory);
-	    current_directory = NULL;
-    }
+    // root and the current directory each hold a reference on their buffer
+    dir_put(current_directory);
+    current_directory = NULL;
 
-    free(root_directory);
+    dir_put(root_directory);
     root_directory = NULL;
 
-    free(cwd);
-    cwd = NULL;
+    dir_cache_destroy();
 }
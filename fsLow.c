@@ -26,6 +26,10 @@
  *	file that represents the physical drive is properally closed.
  *
  **************************************************************/
+// fallocate and its hole punching flags
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -38,6 +42,7 @@
 #include <errno.h>
 #include <math.h>
 #include "fsLow.h"
+#include "metrics.h"
 
 // Partition structure.  This is the in-memory structure that is
 // also saved to disk that provides the needed information
@@ -58,6 +63,183 @@ typedef struct partitionInfo
 
 partitionInfo_p partInfop = NULL;
 
+// I/O scheduler, every LBAread and LBAwrite waits in ioBegin until its
+// class may start.  One mutex guards all the classes.
+typedef struct ioClass
+{
+	int waiting;			 // requests waiting to start
+	int running;			 // requests started and not finished
+	uint64_t rate;			 // bytes per second, 0 for no limit
+	uint64_t burst;			 // most tokens the bucket holds
+	double tokens;			 // bytes that may start now, negative after a big request
+	struct timespec refilled; // last time tokens were added
+	pthread_cond_t cond;	 // waiters for a free slot sleep on it
+	pthread_cond_t timer;	 // waiters for tokens, only their timeout wakes them
+	io_class_stats stats;
+} ioClass_t;
+
+static ioClass_t ioClasses[IO_CLASSES] = {
+	{.cond = PTHREAD_COND_INITIALIZER, .timer = PTHREAD_COND_INITIALIZER},
+	{.cond = PTHREAD_COND_INITIALIZER, .timer = PTHREAD_COND_INITIALIZER},
+	{.cond = PTHREAD_COND_INITIALIZER, .timer = PTHREAD_COND_INITIALIZER,
+	 .rate = IO_BACKGROUND_RATE, .burst = IO_BACKGROUND_BURST}};
+static pthread_mutex_t ioMutex = PTHREAD_MUTEX_INITIALIZER;
+static int ioRunning = 0;
+static __thread int ioThreadClass = IO_CLASS_SYNC;
+
+// nanoseconds from a to b
+static int64_t ioElapsed(struct timespec *a, struct timespec *b)
+{
+	return (int64_t)(b->tv_sec - a->tv_sec) * 1000000000LL + (b->tv_nsec - a->tv_nsec);
+}
+
+// Adds the tokens earned since the last refill, caller holds ioMutex
+static void ioRefill(ioClass_t *c, struct timespec *now)
+{
+	c->tokens += ioElapsed(&c->refilled, now) / 1e9 * c->rate;
+	if (c->tokens > c->burst)
+		c->tokens = c->burst;
+	c->refilled = *now;
+}
+
+// Wakes every class with waiters for a slot, the ones still blocked go
+// back to sleep, caller holds ioMutex
+static void ioWakeWaiters()
+{
+	for (int i = 0; i < IO_CLASSES; i++)
+	{
+		if (ioClasses[i].waiting > 0)
+			pthread_cond_broadcast(&ioClasses[i].cond);
+	}
+}
+
+// Waits until the calling thread may start a request of lbaCount blocks,
+// returns the class the request runs in for ioEnd
+static int ioBegin(uint64_t lbaCount)
+{
+	int cls = ioThreadClass;
+	ioClass_t *c = &ioClasses[cls];
+	double bytes = (double)lbaCount * partInfop->blocksize;
+	struct timespec start, now;
+	int throttled = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_mutex_lock(&ioMutex);
+	c->waiting++;
+	for (;;)
+	{
+		int blocked = ioRunning >= IO_MAX_INFLIGHT;
+		for (int i = 0; i < cls; i++)
+		{
+			if (ioClasses[i].waiting > 0)
+				blocked = 1;
+		}
+		if (cls == IO_CLASS_BACKGROUND && c->running >= IO_BACKGROUND_INFLIGHT)
+			blocked = 1;
+		if (blocked)
+		{
+			pthread_cond_wait(&c->cond, &ioMutex);
+			continue;
+		}
+		if (c->rate == 0)
+			break;
+
+		// a request bigger than the bucket only needs a full bucket, the
+		// rest is paid for by the requests after it
+		double need = bytes < c->burst ? bytes : c->burst;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ioRefill(c, &now);
+		if (c->tokens >= need)
+			break;
+
+		throttled = 1;
+		int64_t waitNs = (int64_t)((need - c->tokens) / c->rate * 1e9) + 1;
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_sec += waitNs / 1000000000LL;
+		until.tv_nsec += waitNs % 1000000000LL;
+		if (until.tv_nsec >= 1000000000L)
+		{
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&c->timer, &ioMutex, &until);
+	}
+	c->waiting--;
+	c->running++;
+	ioRunning++;
+	if (c->rate != 0)
+		c->tokens -= bytes;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	c->stats.ios++;
+	c->stats.blocks += lbaCount;
+	c->stats.wait_ns += ioElapsed(&start, &now);
+	c->stats.throttled += throttled;
+	// the classes below may have been waiting on this one
+	ioWakeWaiters();
+	pthread_mutex_unlock(&ioMutex);
+	return cls;
+}
+
+// Ends a request started by ioBegin
+static void ioEnd(int cls)
+{
+	pthread_mutex_lock(&ioMutex);
+	ioClasses[cls].running--;
+	ioRunning--;
+	ioWakeWaiters();
+	pthread_mutex_unlock(&ioMutex);
+}
+
+int LBAsetclass(int ioClass)
+{
+	int old = ioThreadClass;
+	if (ioClass >= 0 && ioClass < IO_CLASSES)
+		ioThreadClass = ioClass;
+	return old;
+}
+
+int LBAsetrate(int ioClass, uint64_t bytesPerSec, uint64_t burst)
+{
+	if (ioClass < 0 || ioClass >= IO_CLASSES)
+		return -1;
+
+	pthread_mutex_lock(&ioMutex);
+	ioClass_t *c = &ioClasses[ioClass];
+	c->rate = bytesPerSec;
+	c->burst = burst;
+	c->tokens = burst;
+	clock_gettime(CLOCK_MONOTONIC, &c->refilled);
+	pthread_cond_broadcast(&c->timer);
+	ioWakeWaiters();
+	pthread_mutex_unlock(&ioMutex);
+	return 0;
+}
+
+int LBAgetrate(int ioClass, uint64_t *bytesPerSec, uint64_t *burst)
+{
+	if (ioClass < 0 || ioClass >= IO_CLASSES)
+		return -1;
+
+	pthread_mutex_lock(&ioMutex);
+	*bytesPerSec = ioClasses[ioClass].rate;
+	*burst = ioClasses[ioClass].burst;
+	pthread_mutex_unlock(&ioMutex);
+	return 0;
+}
+
+int LBAgetstats(int ioClass, io_class_stats *stats)
+{
+	if (ioClass < 0 || ioClass >= IO_CLASSES)
+		return -1;
+
+	pthread_mutex_lock(&ioMutex);
+	*stats = ioClasses[ioClass].stats;
+	pthread_mutex_unlock(&ioMutex);
+	return 0;
+}
+
 //
 // Initialize Partition
 // This sets up a the file as a volume
@@ -91,11 +273,16 @@ int initializePartition(int fd, uint64_t volSize, uint64_t blockSize)
 
 	fsync(fd);
 	uint64_t blkCount = buf->numberOfBlocks;
-	memset(buf, 0, blockSize);
 
-	// Write one block at the end of the volume to allocate the space
-	lseek(fd, volSize, SEEK_SET);
-	writeRet = write(fd, buf, blockSize);
+	// Extend the file to the header plus the volume without writing it, the
+	// blocks read as zeros and take no space until they are written
+	if (ftruncate(fd, volSize + blockSize) != 0)
+	{
+		printf("Could not size the volume to %llu bytes, errno = %d\n",
+			   (ull_t)(volSize + blockSize), errno);
+		free(buf);
+		return PART_ERR_INVALID;
+	}
 	fsync(fd);
 	printf("Created a volume with %llu bytes, broken into %llu blocks of %llu bytes.\n",
 		   (ull_t)volSize, (ull_t)blkCount, (ull_t)blockSize);
@@ -162,6 +349,12 @@ int startPartitionSystem(char *filename, uint64_t *volSize, uint64_t *blockSize)
 
 			int initRet = initializePartition(fd, *volSize, *blockSize);
 			close(fd);
+			if (initRet != PART_NOERROR)
+			{
+				// the volume could not be sized, do not leave half a file
+				unlink(filename);
+				return -2;
+			}
 		}
 		else
 		{
@@ -214,6 +407,7 @@ int closePartitionSystem()
 // Check to see if Write or read is beyond the capacity of the volume
 uint64_t LBAwrite(void *buffer, uint64_t lbaCount, uint64_t lbaPosition)
 {
+	METRIC_SCOPE(M_LBA_WRITE);
 	struct flock fl;
 
 	if (partInfop == NULL) // System Not initialized
@@ -244,21 +438,61 @@ uint64_t LBAwrite(void *buffer, uint64_t lbaCount, uint64_t lbaPosition)
 	if (fl.l_start < partInfop->blocksize) // not a valid start position
 		return 0;
 
+	int cls = ioBegin(lbaCount);
 	fcntl(partInfop->fd, F_SETLKW, &fl);
 
-	lseek(partInfop->fd, fl.l_start, SEEK_SET);
-	uint64_t retWrite = write(partInfop->fd, buffer, fl.l_len);
+	// pwrite does not move the shared file offset, so threads can write at once
+	uint64_t retWrite = pwrite(partInfop->fd, buffer, fl.l_len, fl.l_start);
 
 	fsync(partInfop->fd);
 
 	fl.l_type = F_UNLCK;
 	fcntl(partInfop->fd, F_SETLKW, &fl);
+	ioEnd(cls);
 
 	return retWrite / partInfop->blocksize;
 }
 
+uint64_t LBAdiscard(uint64_t lbaCount, uint64_t lbaPosition)
+{
+#ifdef FALLOC_FL_PUNCH_HOLE
+	struct flock fl;
+
+	if (partInfop == NULL) // System Not initialized
+		return 0;
+
+	if (lbaCount == 0 || lbaPosition >= partInfop->numberOfBlocks)
+		return 0;
+
+	if ((lbaPosition + lbaCount) > partInfop->numberOfBlocks)
+		lbaCount = partInfop->numberOfBlocks - lbaPosition;
+
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = (lbaPosition * partInfop->blocksize) + partInfop->blocksize;
+	fl.l_len = lbaCount * partInfop->blocksize;
+
+	// no data moves, so the request takes no tokens from its class
+	int cls = ioBegin(0);
+	fcntl(partInfop->fd, F_SETLKW, &fl);
+
+	// the file keeps its size, only the space under the blocks is freed
+	int ret = fallocate(partInfop->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+						fl.l_start, fl.l_len);
+
+	fl.l_type = F_UNLCK;
+	fcntl(partInfop->fd, F_SETLKW, &fl);
+	ioEnd(cls);
+
+	return ret == 0 ? lbaCount : 0;
+#else
+	return 0;
+#endif
+}
+
 uint64_t LBAread(void *buffer, uint64_t lbaCount, uint64_t lbaPosition)
 {
+	METRIC_SCOPE(M_LBA_READ);
 	struct flock fl;
 	uint64_t retRead;
 
@@ -287,13 +521,15 @@ uint64_t LBAread(void *buffer, uint64_t lbaCount, uint64_t lbaPosition)
 	if (fl.l_start < partInfop->blocksize) // not a valid start position
 		return 0;
 
+	int cls = ioBegin(lbaCount);
 	fcntl(partInfop->fd, F_SETLKW, &fl);
 
-	lseek(partInfop->fd, fl.l_start, SEEK_SET);
-	retRead = read(partInfop->fd, buffer, fl.l_len);
+	// pread does not move the shared file offset, so threads can read at once
+	retRead = pread(partInfop->fd, buffer, fl.l_len, fl.l_start);
 
 	fl.l_type = F_UNLCK;
 	fcntl(partInfop->fd, F_SETLKW, &fl);
+	ioEnd(cls);
 
 	return retRead / partInfop->blocksize;
 	;
@@ -26,6 +26,8 @@
 *	file that represents the physical drive is properally closed.
 *
 **************************************************************/
+#ifndef _FSLOW_H
+#define _FSLOW_H
 //
 // Start Partition System
 //
@@ -62,6 +64,54 @@ uint64_t LBAwrite (void * buffer, uint64_t lbaCount, uint64_t lbaPosition);
 
 uint64_t LBAread (void * buffer, uint64_t lbaCount, uint64_t lbaPosition);
 
+//
+// I/O priority classes
+//
+// Every LBAread and LBAwrite goes through a scheduler.  A request of a
+// class only starts when no request of a higher class (lower number) is
+// waiting, and classes with a rate limit take their bytes from a token
+// bucket first.  Background requests also run one at a time, so at most
+// one of them is ever ahead of a foreground request.
+//
+// The class belongs to the calling thread, threads start as IO_CLASS_SYNC.
+#define IO_CLASS_SYNC		0	// foreground, the caller waits for it
+#define IO_CLASS_ASYNC		1	// foreground work done later, writeback
+#define IO_CLASS_BACKGROUND	2	// scans and maintenance
+#define IO_CLASSES		3
+
+#define IO_MAX_INFLIGHT		8	// requests of every class running at once
+#define IO_BACKGROUND_INFLIGHT	1	// background requests running at once
+#define IO_BACKGROUND_RATE	(8 * 1024 * 1024)	// default bytes per second
+#define IO_BACKGROUND_BURST	(256 * 1024)		// default bucket size in bytes
+
+// counters of one class since the partition was started
+typedef struct io_class_stats
+	{
+	ull_t ios;		// requests served
+	ull_t blocks;		// blocks moved
+	ull_t wait_ns;		// time spent waiting to start
+	ull_t throttled;	// requests that waited for tokens
+	} io_class_stats;
+
+// Sets the class of the calling thread, returns the class it had.
+int LBAsetclass (int ioClass);
+
+// Sets the token bucket of a class, bytesPerSec 0 means no limit.
+// Returns 0 on success, -1 for an unknown class.
+int LBAsetrate (int ioClass, uint64_t bytesPerSec, uint64_t burst);
+
+// Copies the token bucket of a class, returns -1 for an unknown class.
+int LBAgetrate (int ioClass, uint64_t * bytesPerSec, uint64_t * burst);
+
+// Copies the counters of a class, returns -1 for an unknown class.
+int LBAgetstats (int ioClass, io_class_stats * stats);
+
+// Gives the space of lbaCount blocks at lbaPosition back to the host by
+// punching a hole in the volume file, the blocks read as zeros after it.
+// Runs in the class of the calling thread without using its tokens.
+// Returns the blocks discarded, 0 when the host can't punch holes.
+uint64_t LBAdiscard (uint64_t lbaCount, uint64_t lbaPosition);
+
 void runFSLowTest();  //Do not use this, for testing only
 
 #define MINBLOCKSIZE 512
@@ -75,5 +125,4 @@ void runFSLowTest();  //Do not use this, for testing only
 #define	PART_NOERROR 		0
 #define PART_ERR_INVALID	-4
 
-
-
+#endif
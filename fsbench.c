@@ -0,0 +1,394 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: fsbench.c
+*
+* Description: Multi-threaded stress benchmark. Every worker
+*	thread works on its own file of one mounted volume, the
+*	run is repeated with 1, 2, 4 and 8 threads to show how
+*	reads, writes and block allocation scale. The allocation
+*	phase reports blocks allocated per second and the average
+*	run of consecutive blocks in every chain, and the run ends
+*	with how many writes the write queue merged. A last phase
+*	reports the p50 and p99 latency of foreground reads with no
+*	scan, with a background class scan of the volume and with the
+*	same scan in the foreground class. The file system
+*	logs go to /dev/null, the results are printed on stderr.
+*	Given a metrics file, the counters and latency histograms
+*	of every operation are written to it as JSON at the end, to
+*	compare them with another build.
+*
+*	Usage: fsbench [volume] [max threads] [metrics file]
+**************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "fsLow.h"
+#include "mfs.h"
+#include "FAT.h"
+#include "writeback.h"
+#include "elevator.h"
+#include "metrics.h"
+
+#define BENCH_VOLUME		"BenchVolume"
+#define BENCH_VOLUME_SIZE	20000000
+#define BENCH_BLOCK_SIZE	512
+#define BENCH_MAX_THREADS	8
+#define BENCH_FILE_SIZE		(64 * 1024)	// bytes written to every file
+#define BENCH_READ_PASSES	200		// times every thread reads its file
+#define BENCH_ALLOC_BLOCKS	1024		// blocks every thread adds to its chain
+#define BENCH_LAT_OPS		20000		// timed reads in every latency run
+#define BENCH_LAT_BYTES		4096		// bytes read by one timed read
+#define BENCH_SCAN_BLOCKS	64		// blocks read by one request of the scan
+
+// work of one thread
+typedef struct bench_job
+	{
+	pthread_t thread;
+	int id;
+	char path[32];
+	char * data;		// BENCH_FILE_SIZE bytes
+	long bytes;		// bytes moved by the thread, blocks in the allocation phase
+	long runs;		// runs of consecutive blocks in the chain of the thread
+	int errors;
+	} bench_job;
+
+// the scan reads the whole volume over and over until it is told to stop
+static int scan_stop;
+static long scan_blocks;
+static uint64_t volume_blocks;
+
+/**
+ * This helper function returns a monotonic time in seconds
+ *
+ * @return - the time
+ */
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * This thread function writes the file of its job
+ *
+ * @param arg - the bench_job of the thread
+ *
+ * @return - NULL
+ */
+static void * write_worker(void * arg) {
+	bench_job * job = arg;
+	b_io_fd fd = b_open(job->path, O_WRONLY | O_CREAT | O_TRUNC);
+	if (fd < 0) {
+		job->errors++;
+	} else {
+		int written = b_write(fd, job->data, BENCH_FILE_SIZE);
+		if (written != BENCH_FILE_SIZE) {
+			job->errors++;
+		}
+		job->bytes += written > 0 ? written : 0;
+		b_close(fd);
+	}
+	fs_thread_exit();
+	return NULL;
+}
+
+/**
+ * This thread function reads the file of its job BENCH_READ_PASSES times
+ * and checks the content every time
+ *
+ * @param arg - the bench_job of the thread
+ *
+ * @return - NULL
+ */
+static void * read_worker(void * arg) {
+	bench_job * job = arg;
+	char * buf = malloc(BENCH_FILE_SIZE);
+	for (int pass = 0; pass < BENCH_READ_PASSES; pass++) {
+		b_io_fd fd = b_open(job->path, O_RDONLY);
+		if (fd < 0) {
+			job->errors++;
+			break;
+		}
+		int got = b_read(fd, buf, BENCH_FILE_SIZE);
+		if (got != BENCH_FILE_SIZE || memcmp(buf, job->data, BENCH_FILE_SIZE) != 0) {
+			job->errors++;
+		}
+		job->bytes += got > 0 ? got : 0;
+		b_close(fd);
+	}
+	free(buf);
+	fs_thread_exit();
+	return NULL;
+}
+
+/**
+ * This thread function grows a chain of its own one block at a time
+ * through a reservation, the way b_write does, then frees it
+ *
+ * @param arg - the bench_job of the thread
+ *
+ * @return - NULL
+ */
+static void * alloc_worker(void * arg) {
+	bench_job * job = arg;
+	job->runs = 1;
+	uint32_t first = allocate_blocks(1);
+	if (first == -1) {
+		job->errors++;
+		fs_thread_exit();
+		return NULL;
+	}
+
+	fat_reservation reserve;
+	fat_reservation_init(&reserve, first);
+	uint32_t last = first;
+	for (int i = 0; i < BENCH_ALLOC_BLOCKS; i++) {
+		uint32_t block = allocate_next_block(last, &reserve);
+		if (block == -1) {
+			job->errors++;
+			break;
+		}
+		if (block != last + 1) {
+			job->runs++;
+		}
+		last = block;
+		job->bytes++;
+	}
+	fat_reservation_release(&reserve);
+	release_blocks(first);
+	fs_thread_exit();
+	return NULL;
+}
+
+/**
+ * This thread function reads the volume from start to end in the given
+ * I/O class, the way a check or defragmentation pass would
+ *
+ * @param arg - pointer to the I/O class
+ *
+ * @return - NULL
+ */
+static void * scan_worker(void * arg) {
+	LBAsetclass(*(int *) arg);
+	char * buf = malloc(BENCH_SCAN_BLOCKS * BENCH_BLOCK_SIZE);
+	uint64_t block = 0;
+	while (!__atomic_load_n(&scan_stop, __ATOMIC_RELAXED)) {
+		uint64_t got = LBAread(buf, BENCH_SCAN_BLOCKS, block);
+		__atomic_add_fetch(&scan_blocks, got, __ATOMIC_RELAXED);
+		block = got < BENCH_SCAN_BLOCKS || block + got >= volume_blocks ? 0 : block + got;
+	}
+	free(buf);
+	return NULL;
+}
+
+/**
+ * This helper function orders latencies for the percentiles
+ *
+ * @param a - pointer to a latency
+ * @param b - pointer to a latency
+ *
+ * @return - negative, zero or positive like strcmp
+ */
+static int by_latency(const void * a, const void * b) {
+	double la = *(const double *) a;
+	double lb = *(const double *) b;
+	return (la > lb) - (la < lb);
+}
+
+/**
+ * This helper function times BENCH_LAT_OPS foreground reads of a file,
+ * each one opens it, reads BENCH_LAT_BYTES and closes it, while a scan
+ * of the volume runs in the given class, and prints the percentiles
+ *
+ * @param job - the job whose file is read
+ * @param label - name of the run
+ * @param scan_class - I/O class of the scan, -1 for no scan
+ *
+ * @return - number of failed reads
+ */
+static int latency_run(bench_job * job, const char * label, int scan_class) {
+	double * lat = malloc(BENCH_LAT_OPS * sizeof(double));
+	char * buf = malloc(BENCH_LAT_BYTES);
+	pthread_t scanner;
+	int errors = 0;
+
+	scan_stop = 0;
+	scan_blocks = 0;
+	if (scan_class >= 0) {
+		pthread_create(&scanner, NULL, scan_worker, &scan_class);
+	}
+	double start = now();
+	for (int i = 0; i < BENCH_LAT_OPS; i++) {
+		double t = now();
+		b_io_fd fd = b_open(job->path, O_RDONLY);
+		if (fd < 0 || b_read(fd, buf, BENCH_LAT_BYTES) != BENCH_LAT_BYTES
+				|| memcmp(buf, job->data, BENCH_LAT_BYTES) != 0) {
+			errors++;
+		}
+		if (fd >= 0) {
+			b_close(fd);
+		}
+		lat[i] = (now() - t) * 1e6;
+	}
+	double secs = now() - start;
+	if (scan_class >= 0) {
+		__atomic_store_n(&scan_stop, 1, __ATOMIC_RELAXED);
+		pthread_join(scanner, NULL);
+	}
+
+	qsort(lat, BENCH_LAT_OPS, sizeof(double), by_latency);
+	fprintf(stderr, "%-11s  %8.1f  %8.1f  %8.1f  %9.2f  %6d\n", label,
+			lat[BENCH_LAT_OPS / 2], lat[BENCH_LAT_OPS * 99 / 100], lat[BENCH_LAT_OPS - 1],
+			scan_blocks * (double) BENCH_BLOCK_SIZE / secs / (1024 * 1024), errors);
+	free(buf);
+	free(lat);
+	return errors;
+}
+
+/**
+ * This helper function runs one phase with the given number of threads
+ *
+ * @param jobs - one job per thread
+ * @param threads - number of threads
+ * @param worker - the thread function
+ * @param bytes - set to the bytes moved by all threads
+ * @param errors - set to the errors of all threads
+ *
+ * @return - the wall time of the phase in seconds
+ */
+static double run_phase(bench_job * jobs, int threads, void * (*worker)(void *),
+		long * bytes, int * errors) {
+	double start = now();
+	for (int i = 0; i < threads; i++) {
+		jobs[i].bytes = 0;
+		jobs[i].errors = 0;
+		pthread_create(&jobs[i].thread, NULL, worker, &jobs[i]);
+	}
+	*bytes = 0;
+	*errors = 0;
+	for (int i = 0; i < threads; i++) {
+		pthread_join(jobs[i].thread, NULL);
+		*bytes += jobs[i].bytes;
+		*errors += jobs[i].errors;
+	}
+	return now() - start;
+}
+
+int main(int argc, char * argv[]) {
+	char * volume = argc > 1 ? argv[1] : BENCH_VOLUME;
+	int max_threads = argc > 2 ? atoi(argv[2]) : BENCH_MAX_THREADS;
+	if (max_threads < 1 || max_threads > BENCH_MAX_THREADS) {
+		max_threads = BENCH_MAX_THREADS;
+	}
+
+	// every run starts from a fresh volume
+	remove(volume);
+	uint64_t volume_size = BENCH_VOLUME_SIZE;
+	uint64_t block_size = BENCH_BLOCK_SIZE;
+	if (freopen("/dev/null", "w", stdout) == NULL) {
+		fprintf(stderr, "[ BENCH ] : can't silence the file system logs\n");
+	}
+	if (startPartitionSystem(volume, &volume_size, &block_size) != PART_NOERROR
+			|| initFileSystem(volume_size / block_size, block_size) != 0) {
+		fprintf(stderr, "[ BENCH ] : can't start the volume %s\n", volume);
+		return 1;
+	}
+
+	volume_blocks = volume_size / block_size;
+
+	bench_job jobs[BENCH_MAX_THREADS];
+	for (int i = 0; i < max_threads; i++) {
+		jobs[i].id = i;
+		snprintf(jobs[i].path, sizeof(jobs[i].path), "/bench%d", i);
+		jobs[i].data = malloc(BENCH_FILE_SIZE);
+		for (int j = 0; j < BENCH_FILE_SIZE; j++) {
+			jobs[i].data[j] = 'a' + (i + j) % 26;
+		}
+	}
+
+	fprintf(stderr, "threads  phase   MB/s      speedup  errors\n");
+	double base_write = 0;
+	double base_read = 0;
+	for (int threads = 1; threads <= max_threads; threads *= 2) {
+		long bytes;
+		int errors;
+
+		double secs = run_phase(jobs, threads, write_worker, &bytes, &errors);
+		// the phase ends when the data is on disk, not when it is queued
+		double start = now();
+		wb_sync();
+		elv_flush();
+		secs += now() - start;
+		double rate = bytes / secs / (1024 * 1024);
+		if (threads == 1) base_write = rate;
+		fprintf(stderr, "%7d  write  %9.2f  %7.2fx  %6d\n", threads, rate,
+				base_write > 0 ? rate / base_write : 0, errors);
+
+		secs = run_phase(jobs, threads, read_worker, &bytes, &errors);
+		rate = bytes / secs / (1024 * 1024);
+		if (threads == 1) base_read = rate;
+		fprintf(stderr, "%7d  read   %9.2f  %7.2fx  %6d\n", threads, rate,
+				base_read > 0 ? rate / base_read : 0, errors);
+	}
+
+	fprintf(stderr, "\nthreads  alloc blocks/s  speedup  avg run  errors\n");
+	double base_alloc = 0;
+	for (int threads = 1; threads <= max_threads; threads *= 2) {
+		long blocks;
+		int errors;
+		double secs = run_phase(jobs, threads, alloc_worker, &blocks, &errors);
+		double rate = blocks / secs;
+		long runs = 0;
+		for (int i = 0; i < threads; i++) {
+			runs += jobs[i].runs;
+		}
+		if (threads == 1) base_alloc = rate;
+		fprintf(stderr, "%7d  %14.0f  %6.2fx  %7.1f  %6d\n", threads, rate,
+				base_alloc > 0 ? rate / base_alloc : 0,
+				runs > 0 ? (double) blocks / runs : 0, errors);
+	}
+
+	// foreground reads alone, next to a background scan held to its rate,
+	// and next to the same scan in the foreground class
+	fprintf(stderr, "\nscan         p50 us    p99 us    max us  scan MB/s  errors\n");
+	latency_run(&jobs[0], "none", -1);
+	latency_run(&jobs[0], "background", IO_CLASS_BACKGROUND);
+	latency_run(&jobs[0], "foreground", IO_CLASS_SYNC);
+
+	elv_stats st;
+	elv_get_stats(&st);
+	fprintf(stderr, "\nwrite queue: %lu writes in %lu dispatches (%.2f merged), avg %.1f blocks, max depth %d\n",
+			st.requests, st.dispatches,
+			st.dispatches > 0 ? (double) st.requests / st.dispatches : 0,
+			st.dispatches > 0 ? (double) st.dispatched_blocks / st.dispatches : 0,
+			st.max_depth);
+
+	if (argc > 3) {
+		FILE * out = fopen(argv[3], "w");
+		if (out == NULL || metrics_dump(out) != 0) {
+			fprintf(stderr, "[ BENCH ] : can't write the metrics to %s\n", argv[3]);
+		}
+		if (out != NULL) {
+			fclose(out);
+		}
+	}
+
+	for (int i = 0; i < max_threads; i++) {
+		free(jobs[i].data);
+	}
+	exitFileSystem();
+	closePartitionSystem();
+	remove(volume);
+	return 0;
+}
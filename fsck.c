@@ -0,0 +1,1040 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: fsck.c
+*
+* Description: Consistency checker for a volume that is not in
+*	use. A pool of threads walks the directory tree from the
+*	root and follows every chain in the FAT, claiming its blocks
+*	in a bitmap. Every thread has its own deque of directories
+*	and long files to look at and steals from the others when
+*	it runs dry. A block claimed twice is a cross-link, a chain
+*	that leaves the volume or runs into a free block is broken,
+*	and a block in use that no chain claimed is a leak. One
+*	thread repairs what the walk found, frees the leaks and
+*	rebuilds the free block counts of the VCB and the summary. The file system
+*	logs go to /dev/null, the findings are printed on stderr.
+*
+*	Usage: fsck volume [-n] [-j threads]
+*		-n	only report, nothing is changed
+*		-j	threads of the walk, one per core if left out
+*
+*	Exit status: 0 nothing found, 1 everything found was
+*	repaired, 4 problems are left, 8 the volume can't be checked.
+**************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fsLow.h"
+#include "mfs.h"
+#include "FAT.h"
+#include "vcb_.h"
+#include "root_init.h"
+#include "dir_cache.h"
+#include "elevator.h"
+#include "geometry.h"
+
+#define FSCK_MAX_THREADS	64
+#define FSCK_TASK_BLOCKS	256	// files with more blocks are followed as their own task
+#define FSCK_DEQUE_TASKS	64	// first size of the deque of a thread
+
+#define FSCK_CLEAN	0
+#define FSCK_REPAIRED	1
+#define FSCK_LEFT	4
+#define FSCK_FAILED	8
+
+
+// kinds of problems, repaired in this order so chains are cut before
+// another chain copies their blocks
+enum {
+	FSCK_NO_END,		// the last block of a chain is marked reserved, not EOF
+	FSCK_BAD_LINK,		// a chain leaves the volume or runs into a free block
+	FSCK_CROSS_LINK,	// a chain runs into a block claimed by a chain, maybe itself
+	FSCK_SHORT,		// a file is larger than its chain
+	FSCK_BAD_START,		// an entry starts outside the volume or on a free block
+	FSCK_BAD_DIR,		// a directory chain is too short or does not hold a directory
+	FSCK_DOTDOT		// .. does not lead to the parent
+};
+
+// a directory to read, or a long file chain to follow
+typedef struct fsck_task
+	{
+	int is_dir;
+	uint32_t parent;	// first block of the directory holding the entry
+	int index;		// slot of the entry in the parent, 0 for the root
+	uint32_t cluster;	// first block of the chain
+	uint64_t size;		// bytes in the entry
+	int blocks;		// blocks of a directory chain, claimed by the parent
+	} fsck_task;
+
+// something the walk found wrong with one entry
+typedef struct fsck_problem
+	{
+	int kind;
+	int is_dir;
+	uint32_t dir;		// first block of the directory holding the entry
+	int index;		// slot of the entry, 0 for the root
+	uint32_t cluster;	// first block of the entry
+	uint32_t prev;		// last good block of the chain, -1 if it is the first
+	uint32_t block;		// block where the chain goes wrong
+	int blocks;		// blocks of the chain claimed before it went wrong
+	uint32_t value;		// parent for ..
+	} fsck_problem;
+
+// one thread of the walk and its deque, the owner takes the newest task
+// at the bottom, thieves take the oldest at the top
+typedef struct fsck_worker
+	{
+	pthread_t thread;
+	int id;
+	pthread_mutex_t lock;	// protects the deque
+	fsck_task * tasks;
+	int top;
+	int bottom;
+	int capacity;
+	Directory_Entry * dir;	// buffer of the directory being read
+	long dirs;
+	long files;
+	long blocks;		// blocks claimed
+	long steals;
+	int errors;		// directories that could not be read
+	} fsck_worker;
+
+static fsck_worker * workers;
+static int worker_count;
+
+// tasks not finished yet and tasks sitting in a deque, idle threads sleep
+// on pool_cond until one of them is queued or all of them are finished
+static int pending;
+static int queued;
+static int idle;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+
+static uint64_t * owned;	// one bit per block, set by the chain that claims it
+static uint32_t data_start;	// first block a chain can use
+static uint32_t volume_end;	// blocks in the volume
+static int dir_blocks;		// blocks of every directory
+
+static fsck_problem * problems;
+static int problem_count;
+static int problem_capacity;
+static pthread_mutex_t problem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void run_task(fsck_task * t, fsck_worker * w);
+static void push_task(fsck_worker * w, fsck_task * t);
+
+/**
+ * This helper function returns a monotonic time in seconds
+ *
+ * @return - the time
+ */
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * This helper function claims a block for the chain being followed
+ *
+ * @param block - the block
+ *
+ * @return - 1 if the block was not claimed yet, 0 if another chain has it
+ */
+static int claim(uint32_t block) {
+	uint64_t bit = 1ULL << (block & 63);
+	uint64_t old = __atomic_fetch_or(&owned[block >> 6], bit, __ATOMIC_RELAXED);
+	return (old & bit) == 0;
+}
+
+/**
+ * This helper function gives up the claim on the first blocks of a chain
+ *
+ * @param block - first block of the chain
+ * @param blocks - blocks to give up
+ *
+ * @return - void
+ */
+static void unclaim(uint32_t block, int blocks) {
+	for (int i = 0; i < blocks; i++) {
+		__atomic_fetch_and(&owned[block >> 6], ~(1ULL << (block & 63)), __ATOMIC_RELAXED);
+		block = get_next_block(block);
+	}
+}
+
+/**
+ * This helper function tells if a block is claimed
+ *
+ * @param block - the block
+ *
+ * @return - 1 if claimed, 0 if not
+ */
+static int is_claimed(uint32_t block) {
+	return (__atomic_load_n(&owned[block >> 6], __ATOMIC_RELAXED) >> (block & 63)) & 1;
+}
+
+/**
+ * This helper function tells if a chain can go through a block, it has to
+ * be a data block that is in use
+ *
+ * @param block - the block
+ *
+ * @return - 1 if it can, 0 if not
+ */
+static int usable(uint32_t block) {
+	return block >= data_start && block < volume_end
+		&& get_next_block(block) != FREE_BLOCK;
+}
+
+/**
+ * This helper function records a problem of the entry of a task
+ *
+ * @param kind - the kind of problem
+ * @param t - the entry
+ * @param prev - last good block of the chain, -1 if none
+ * @param block - block where the chain goes wrong
+ * @param blocks - blocks claimed before it
+ * @param value - extra value of the kind
+ *
+ * @return - void
+ */
+static void add_problem(int kind, fsck_task * t, uint32_t prev, uint32_t block, int blocks, uint32_t value) {
+	pthread_mutex_lock(&problem_lock);
+	if (problem_count == problem_capacity) {
+		int capacity = problem_capacity == 0 ? 64 : problem_capacity * 2;
+		fsck_problem * grown = realloc(problems, capacity * sizeof(fsck_problem));
+		if (grown == NULL) {
+			pthread_mutex_unlock(&problem_lock);
+			fprintf(stderr, "[ FSCK ] : Out of memory, a problem was dropped.\n");
+			return;
+		}
+		problems = grown;
+		problem_capacity = capacity;
+	}
+	fsck_problem * p = &problems[problem_count++];
+	p->kind = kind;
+	p->is_dir = t->is_dir;
+	p->dir = t->parent;
+	p->index = t->index;
+	p->cluster = t->cluster;
+	p->prev = prev;
+	p->block = block;
+	p->blocks = blocks;
+	p->value = value;
+	pthread_mutex_unlock(&problem_lock);
+}
+
+/**
+ * This helper function follows the chain of an entry and claims its blocks.
+ * It stops at the first block that is wrong and records the problem.
+ *
+ * @param t - the entry
+ * @param w - worker counting the blocks
+ *
+ * @return - blocks in the chain, -1 if the chain is broken
+ */
+static int walk_chain(fsck_task * t, fsck_worker * w) {
+	uint32_t prev = -1;
+	uint32_t block = t->cluster;
+	int count = 0;
+	int ret = -1;
+	while (1) {
+		if (!usable(block)) {
+			add_problem(prev == (uint32_t) -1 ? FSCK_BAD_START : FSCK_BAD_LINK,
+				t, prev, block, count, 0);
+			break;
+		}
+		if (!claim(block)) {
+			add_problem(FSCK_CROSS_LINK, t, prev, block, count, 0);
+			break;
+		}
+		count++;
+		uint32_t next = get_next_block(block);
+		if (next == EOF_BLOCK) {
+			ret = count;
+			break;
+		}
+		if (next == RESERVED_BLOCK) {
+			// a block taken for the chain that was never marked as its end
+			add_problem(FSCK_NO_END, t, prev, block, count, 0);
+			ret = count;
+			break;
+		}
+		prev = block;
+		block = next;
+	}
+	w->blocks += count;
+	return ret;
+}
+
+/**
+ * This helper function reads a directory whose chain was claimed, a run of
+ * blocks that follow each other on disk at a time
+ *
+ * @param dir - buffer of dir_blocks blocks
+ * @param cluster - first block of the directory
+ *
+ * @return - 0 on success, -1 if a read failed
+ */
+static int read_dir(Directory_Entry * dir, uint32_t cluster) {
+	char * buf = (char *) dir;
+	uint32_t block = cluster;
+	int done = 0;
+	while (done < dir_blocks) {
+		uint32_t start = block;
+		int run = 1;
+		block = get_next_block(block);
+		while (done + run < dir_blocks && block == start + run) {
+			run++;
+			block = get_next_block(block);
+		}
+		if (elv_read(buf + done * bytes_per_block, run, start) != run) {
+			return -1;
+		}
+		done += run;
+	}
+	return 0;
+}
+
+/**
+ * This helper function checks that a file chain holds the bytes of the file
+ *
+ * @param t - the file
+ * @param w - worker running it
+ *
+ * @return - void
+ */
+static void run_file(fsck_task * t, fsck_worker * w) {
+	int blocks = walk_chain(t, w);
+	int64_t needed = GEO_BLOCKS(t->size);
+	if (blocks != -1 && blocks < needed) {
+		add_problem(FSCK_SHORT, t, -1, t->cluster, blocks, 0);
+	}
+}
+
+/**
+ * This helper function checks a directory. Its files are followed here or
+ * queued when they are long, its subdirectories have their chain claimed
+ * here and are queued.
+ *
+ * @param t - the directory
+ * @param w - worker running it
+ *
+ * @return - void
+ */
+static void run_dir(fsck_task * t, fsck_worker * w) {
+	Directory_Entry * dir = w->dir;
+	if (read_dir(dir, t->cluster) == -1) {
+		fprintf(stderr, "[ FSCK ] : Can't read the directory at block %u.\n", t->cluster);
+		w->errors++;
+		return;
+	}
+	w->dirs++;
+	int is_root = t->index == 0;
+	if (dir[0].dir_first_cluster != t->cluster || !(dir[0].dir_attr & IS_DIR)) {
+		if (is_root) {
+			fprintf(stderr, "[ FSCK ] : The root directory is not at block %u.\n", t->cluster);
+			w->errors++;
+		} else {
+			add_problem(FSCK_BAD_DIR, t, -1, t->cluster, t->blocks, 0);
+		}
+		return;
+	}
+	if (dir[1].dir_first_cluster != t->parent) {
+		add_problem(FSCK_DOTDOT, t, -1, dir[1].dir_first_cluster, 0, t->parent);
+	}
+
+	for (int i = 2; i < vcb->entries_per_dir; i++) {
+		if (!(dir[i].dir_attr & IS_ACTIVE)) {
+			continue;
+		}
+		fsck_task child;
+		child.is_dir = (dir[i].dir_attr & IS_DIR) != 0;
+		child.parent = t->cluster;
+		child.index = i;
+		child.cluster = dir[i].dir_first_cluster;
+		child.size = dir[i].dir_file_size;
+		child.blocks = 0;
+
+		if (child.is_dir) {
+			// claimed here, a directory is read once even if two entries name it
+			int blocks = walk_chain(&child, w);
+			if (blocks == -1) {
+				continue;
+			}
+			if (blocks < dir_blocks) {
+				add_problem(FSCK_BAD_DIR, &child, -1, child.cluster, blocks, 0);
+				continue;
+			}
+			child.blocks = blocks;
+			push_task(w, &child);
+		} else {
+			w->files++;
+			if (child.size > (uint64_t) FSCK_TASK_BLOCKS * bytes_per_block) {
+				push_task(w, &child);
+			} else {
+				run_file(&child, w);
+			}
+		}
+	}
+}
+
+/**
+ * This helper function runs one task
+ *
+ * @param t - the task
+ * @param w - worker running it
+ *
+ * @return - void
+ */
+static void run_task(fsck_task * t, fsck_worker * w) {
+	if (t->is_dir) {
+		run_dir(t, w);
+	} else {
+		run_file(t, w);
+	}
+}
+
+/**
+ * This helper function queues a task at the bottom of the deque of a worker
+ * and wakes an idle worker to steal it
+ *
+ * @param w - the worker
+ * @param t - the task, copied
+ *
+ * @return - void
+ */
+static void push_task(fsck_worker * w, fsck_task * t) {
+	__atomic_add_fetch(&pending, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_lock(&w->lock);
+	if (w->bottom == w->capacity && w->top > 0) {
+		memmove(w->tasks, w->tasks + w->top, (w->bottom - w->top) * sizeof(fsck_task));
+		w->bottom -= w->top;
+		w->top = 0;
+	}
+	if (w->bottom == w->capacity) {
+		fsck_task * grown = realloc(w->tasks, w->capacity * 2 * sizeof(fsck_task));
+		if (grown == NULL) {
+			// no room to queue it, the pusher runs it now
+			pthread_mutex_unlock(&w->lock);
+			run_task(t, w);
+			__atomic_sub_fetch(&pending, 1, __ATOMIC_SEQ_CST);
+			return;
+		}
+		w->tasks = grown;
+		w->capacity *= 2;
+	}
+	w->tasks[w->bottom++] = *t;
+	pthread_mutex_unlock(&w->lock);
+
+	__atomic_add_fetch(&queued, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&idle, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&pool_lock);
+		pthread_cond_broadcast(&pool_cond);
+		pthread_mutex_unlock(&pool_lock);
+	}
+}
+
+/**
+ * This helper function takes the newest task of the own deque, or steals
+ * the oldest task of another worker
+ *
+ * @param w - the worker
+ * @param t - receives the task
+ *
+ * @return - 1 if a task was taken, 0 if every deque is empty
+ */
+static int take_task(fsck_worker * w, fsck_task * t) {
+	for (int k = 0; k < worker_count; k++) {
+		fsck_worker * victim = &workers[(w->id + k) % worker_count];
+		int taken = 0;
+		pthread_mutex_lock(&victim->lock);
+		if (victim->bottom > victim->top) {
+			if (k == 0) {
+				*t = victim->tasks[--victim->bottom];
+			} else {
+				*t = victim->tasks[victim->top++];
+			}
+			taken = 1;
+		}
+		pthread_mutex_unlock(&victim->lock);
+		if (taken) {
+			__atomic_sub_fetch(&queued, 1, __ATOMIC_SEQ_CST);
+			if (k > 0) {
+				w->steals++;
+			}
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * This thread function runs tasks until every task is finished
+ *
+ * @param arg - the fsck_worker of the thread
+ *
+ * @return - NULL
+ */
+static void * worker_main(void * arg) {
+	fsck_worker * w = (fsck_worker *) arg;
+	fsck_task t;
+	while (1) {
+		if (take_task(w, &t)) {
+			run_task(&t, w);
+			if (__atomic_sub_fetch(&pending, 1, __ATOMIC_SEQ_CST) == 0) {
+				pthread_mutex_lock(&pool_lock);
+				pthread_cond_broadcast(&pool_cond);
+				pthread_mutex_unlock(&pool_lock);
+			}
+			continue;
+		}
+
+		pthread_mutex_lock(&pool_lock);
+		__atomic_add_fetch(&idle, 1, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&queued, __ATOMIC_SEQ_CST) == 0
+				&& __atomic_load_n(&pending, __ATOMIC_SEQ_CST) > 0) {
+			pthread_cond_wait(&pool_cond, &pool_lock);
+		}
+		__atomic_sub_fetch(&idle, 1, __ATOMIC_SEQ_CST);
+		int done = __atomic_load_n(&pending, __ATOMIC_SEQ_CST) == 0;
+		pthread_mutex_unlock(&pool_lock);
+		if (done) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * This helper function orders problems by kind, then by entry
+ *
+ * @param a - a problem
+ * @param b - another problem
+ *
+ * @return - negative, 0 or positive like strcmp
+ */
+static int problem_order(const void * a, const void * b) {
+	const fsck_problem * x = a;
+	const fsck_problem * y = b;
+	if (x->kind != y->kind) {
+		return x->kind - y->kind;
+	}
+	if (x->dir != y->dir) {
+		return x->dir < y->dir ? -1 : 1;
+	}
+	return x->index - y->index;
+}
+
+/**
+ * This helper function writes the name of the entry of a problem
+ *
+ * @param p - the problem
+ * @param name - receives the path
+ * @param size - bytes in name
+ *
+ * @return - void
+ */
+static void name_of(fsck_problem * p, char * name, int size) {
+	Directory_Entry * dir = dir_get(p->dir);
+	if (dir == NULL) {
+		snprintf(name, size, "block %u", p->cluster);
+		return;
+	}
+	dir_read_lock(dir);
+	const char * path = dir[0].path;
+	if (p->index == 0) {
+		snprintf(name, size, "%s", path);
+	} else {
+		int len = strlen(path);
+		snprintf(name, size, "%s%s%.*s", path, len > 0 && path[len - 1] == '/' ? "" : "/",
+			NAME_MAX_LENGTH, dir[p->index].dir_name);
+	}
+	dir_unlock(dir);
+	dir_put(dir);
+}
+
+/**
+ * This helper function changes one entry of a directory and writes the directory
+ *
+ * @param dir_cluster - first block of the directory
+ * @param index - slot of the entry
+ * @param remove - 1 to clear the entry
+ * @param size - new size when not removed, -1 to keep it
+ * @param cluster - new first block when not removed, -1 to keep it
+ *
+ * @return - 0 on success, -1 if the directory could not be read or written
+ */
+static int change_entry(uint32_t dir_cluster, int index, int remove, int64_t size, uint32_t cluster) {
+	Directory_Entry * dir = dir_get(dir_cluster);
+	if (dir == NULL) {
+		return -1;
+	}
+	dir_write_lock(dir);
+	Directory_Entry * de = &dir[index];
+	if (remove) {
+		strcpy(de->dir_name, "entry");
+		strcpy(de->path, "");
+		de->dir_attr = 0;
+		de->dir_first_cluster = 0;
+		de->dir_file_size = 0;
+	} else {
+		if (size != -1) {
+			de->dir_file_size = size;
+		}
+		if (cluster != (uint32_t) -1) {
+			de->dir_first_cluster = cluster;
+		}
+	}
+	int ret = write_to_disk(dir, dir[0].dir_first_cluster, dir_blocks, bytes_per_block);
+	dir_unlock(dir);
+	dir_put(dir);
+	return ret;
+}
+
+/**
+ * This helper function cuts the size of a file down to what its chain holds
+ *
+ * @param p - the problem of the file
+ * @param blocks - blocks in the chain now
+ *
+ * @return - 0 on success, -1 on failure
+ */
+static int fit_size(fsck_problem * p, int blocks) {
+	Directory_Entry * dir = dir_get(p->dir);
+	if (dir == NULL) {
+		return -1;
+	}
+	uint64_t size = dir[p->index].dir_file_size;
+	dir_put(dir);
+	uint64_t held = (uint64_t) blocks * bytes_per_block;
+	return size > held ? change_entry(p->dir, p->index, 0, held, -1) : 0;
+}
+
+/**
+ * This helper function ends a file chain after its good blocks
+ *
+ * @param p - the problem
+ *
+ * @return - 0 on success, -1 on failure
+ */
+static int cut_file(fsck_problem * p) {
+	set_next_block(p->prev, EOF_BLOCK);
+	return fit_size(p, p->blocks);
+}
+
+/**
+ * This helper function removes the entry of a problem
+ *
+ * @param p - the problem
+ *
+ * @return - 0 on success, -1 on failure
+ */
+static int remove_entry(fsck_problem * p) {
+	if (p->is_dir) {
+		dir_invalidate(p->cluster);
+	}
+	return change_entry(p->dir, p->index, 1, -1, -1);
+}
+
+/**
+ * This helper function copies a chain from a block to its end into new
+ * blocks, the copy is claimed
+ *
+ * @param block - first block to copy
+ * @param copied - receives the blocks in the copy
+ *
+ * @return - first block of the copy, -1 if there is no room or the copy failed
+ */
+static uint32_t copy_tail(uint32_t block, int * copied) {
+	int blocks = 0;
+	for (uint32_t b = block; usable(b) && blocks < volume_end; b = get_next_block(b)) {
+		blocks++;
+		uint32_t next = get_next_block(b);
+		if (next == EOF_BLOCK || next == RESERVED_BLOCK) {
+			break;
+		}
+	}
+	uint32_t first = allocate_blocks(blocks);
+	char * buf = malloc(bytes_per_block);
+	if (first == (uint32_t) -1 || buf == NULL) {
+		if (first != (uint32_t) -1) {
+			release_blocks(first);
+		}
+		free(buf);
+		return -1;
+	}
+	uint32_t from = block;
+	uint32_t to = first;
+	for (int i = 0; i < blocks; i++) {
+		if (elv_read(buf, 1, from) != 1 || elv_write(buf, 1, to) != 1) {
+			release_blocks(first);
+			free(buf);
+			return -1;
+		}
+		from = get_next_block(from);
+		to = get_next_block(to);
+	}
+	free(buf);
+	for (uint32_t b = first; b != EOF_BLOCK; b = get_next_block(b)) {
+		claim(b);
+	}
+	*copied = blocks;
+	return first;
+}
+
+/**
+ * This helper function tells if a chain loops, the block it runs into is
+ * one of its own
+ *
+ * @param p - a cross-link problem
+ *
+ * @return - 1 if it loops, 0 if the block belongs to another chain
+ */
+static int loops(fsck_problem * p) {
+	uint32_t b = p->cluster;
+	for (int i = 0; i < p->blocks; i++) {
+		if (b == p->block) {
+			return 1;
+		}
+		b = get_next_block(b);
+	}
+	return 0;
+}
+
+/**
+ * This helper function prints a problem and repairs it
+ *
+ * @param p - the problem
+ * @param apply - 1 to repair, 0 to only print
+ *
+ * @return - 1 if repaired, 0 if only printed, -1 if the repair failed
+ */
+static int fix_problem(fsck_problem * p, int apply) {
+	char name[MAX_PATH_LENGTH + NAME_MAX_LENGTH + 2];
+	char what[128];
+	const char * action = NULL;
+	int ret = 0;
+	name_of(p, name, sizeof(name));
+
+	// a directory that goes away gives up the blocks it claimed, they are
+	// counted and freed with the leaks, also when nothing is repaired
+	if (p->is_dir && (p->kind == FSCK_BAD_LINK || p->kind == FSCK_CROSS_LINK
+			|| p->kind == FSCK_BAD_START || p->kind == FSCK_BAD_DIR)) {
+		unclaim(p->cluster, p->blocks);
+	}
+
+	switch (p->kind) {
+	case FSCK_NO_END:
+		snprintf(what, sizeof(what), "block %u ends the chain but is marked reserved", p->block);
+		action = "marked as the end";
+		if (apply) {
+			set_next_block(p->block, EOF_BLOCK);
+		}
+		break;
+	case FSCK_BAD_LINK:
+		snprintf(what, sizeof(what), "chain runs %s at block %u after %d blocks",
+			p->block < volume_end ? "into a free block" : "out of the volume",
+			p->block, p->blocks);
+		if (p->is_dir) {
+			action = "removed";
+			ret = apply ? remove_entry(p) : 0;
+		} else {
+			action = "cut";
+			ret = apply ? cut_file(p) : 0;
+		}
+		break;
+	case FSCK_CROSS_LINK:
+		if (p->prev != (uint32_t) -1 && loops(p)) {
+			snprintf(what, sizeof(what), "chain loops back to block %u after %d blocks",
+				p->block, p->blocks);
+		} else {
+			snprintf(what, sizeof(what), "shares block %u with another chain", p->block);
+		}
+		if (p->is_dir) {
+			action = "removed";
+			ret = apply ? remove_entry(p) : 0;
+		} else if (p->prev != (uint32_t) -1 && loops(p)) {
+			action = "cut";
+			ret = apply ? cut_file(p) : 0;
+		} else {
+			action = "copied";
+			if (apply) {
+				// the shared tail may be shorter than the one the file lost
+				int copied;
+				uint32_t copy = copy_tail(p->block, &copied);
+				if (copy == (uint32_t) -1) {
+					ret = -1;
+				} else if (p->prev == (uint32_t) -1) {
+					ret = change_entry(p->dir, p->index, 0, -1, copy);
+				} else {
+					set_next_block(p->prev, copy);
+				}
+				if (ret == 0) {
+					ret = fit_size(p, p->blocks + copied);
+				}
+			}
+		}
+		break;
+	case FSCK_SHORT:
+		snprintf(what, sizeof(what), "is larger than its %d blocks", p->blocks);
+		action = "size cut";
+		ret = apply ? change_entry(p->dir, p->index, 0,
+			(int64_t) p->blocks * bytes_per_block, -1) : 0;
+		break;
+	case FSCK_BAD_START:
+		snprintf(what, sizeof(what), "starts at block %u, %s", p->block,
+			p->block >= data_start && p->block < volume_end ? "a free block" : "not a data block");
+		action = "removed";
+		ret = apply ? remove_entry(p) : 0;
+		break;
+	case FSCK_BAD_DIR:
+		if (p->blocks < dir_blocks) {
+			snprintf(what, sizeof(what), "directory chain has %d of %d blocks", p->blocks, dir_blocks);
+		} else {
+			snprintf(what, sizeof(what), "block %u does not hold the directory", p->cluster);
+		}
+		action = "removed";
+		ret = apply ? remove_entry(p) : 0;
+		break;
+	case FSCK_DOTDOT:
+		snprintf(what, sizeof(what), ".. leads to block %u, not to the parent at %u",
+			p->block, p->value);
+		action = "relinked";
+		if (apply) {
+			Directory_Entry * dir = dir_get(p->cluster);
+			if (dir == NULL) {
+				ret = -1;
+				break;
+			}
+			dir_write_lock(dir);
+			dir[1].dir_first_cluster = p->value;
+			ret = write_to_disk(dir, p->cluster, dir_blocks, bytes_per_block);
+			dir_unlock(dir);
+			dir_put(dir);
+		}
+		break;
+	}
+
+	if (!apply) {
+		fprintf(stderr, "[ FSCK ] : %s: %s\n", name, what);
+		return 0;
+	}
+	if (ret == -1) {
+		fprintf(stderr, "[ FSCK ] : %s: %s, not repaired\n", name, what);
+		return -1;
+	}
+	fprintf(stderr, "[ FSCK ] : %s: %s, %s\n", name, what, action);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	char * volume = NULL;
+	int report_only = 0;
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0) {
+			report_only = 1;
+		} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+			threads = atoi(argv[++i]);
+		} else if (volume == NULL && argv[i][0] != '-') {
+			volume = argv[i];
+		} else {
+			volume = NULL;
+			break;
+		}
+	}
+	if (volume == NULL) {
+		fprintf(stderr, "Usage: %s volume [-n] [-j threads]\n", argv[0]);
+		return FSCK_FAILED;
+	}
+	if (threads < 1) {
+		threads = 1;
+	}
+	if (threads > FSCK_MAX_THREADS) {
+		threads = FSCK_MAX_THREADS;
+	}
+
+	// startPartitionSystem would create a missing volume
+	if (access(volume, R_OK | W_OK) != 0) {
+		fprintf(stderr, "[ FSCK ] : can't open the volume %s\n", volume);
+		return FSCK_FAILED;
+	}
+	uint64_t volume_size = 0;
+	uint64_t block_size = 0;
+	if (freopen("/dev/null", "w", stdout) == NULL) {
+		fprintf(stderr, "[ FSCK ] : can't silence the file system logs\n");
+	}
+	// with -n the mount and the exit leave the volume as it is
+	fs_read_only = report_only;
+	if (startPartitionSystem(volume, &volume_size, &block_size) != PART_NOERROR
+			|| initFileSystem(volume_size / block_size, block_size) != 0) {
+		fprintf(stderr, "[ FSCK ] : can't start the volume %s\n", volume);
+		return FSCK_FAILED;
+	}
+
+	volume_end = vcb->total_blocks;
+	data_start = vcb->reserved_blocks_count;
+	dir_blocks = GEO_BLOCK_OF(dir_cache_bytes());
+	owned = calloc((volume_end + 63) / 64, sizeof(uint64_t));
+	workers = calloc(threads, sizeof(fsck_worker));
+	if (owned == NULL || workers == NULL) {
+		fprintf(stderr, "[ FSCK ] : Out of memory.\n");
+		return FSCK_FAILED;
+	}
+	// the VCB and the FAT, and the last block that formatting marks as the end
+	for (uint32_t b = 0; b < data_start; b++) {
+		claim(b);
+	}
+	if (get_next_block(volume_end - 1) == EOF_BLOCK) {
+		claim(volume_end - 1);
+	}
+
+	worker_count = threads;
+	for (int i = 0; i < threads; i++) {
+		workers[i].id = i;
+		pthread_mutex_init(&workers[i].lock, NULL);
+		workers[i].capacity = FSCK_DEQUE_TASKS;
+		workers[i].tasks = malloc(FSCK_DEQUE_TASKS * sizeof(fsck_task));
+		workers[i].dir = malloc(dir_cache_bytes());
+		if (workers[i].tasks == NULL || workers[i].dir == NULL) {
+			fprintf(stderr, "[ FSCK ] : Out of memory.\n");
+			return FSCK_FAILED;
+		}
+	}
+
+	double start = now();
+	fsck_task root;
+	root.is_dir = 1;
+	root.parent = vcb->root_cluster;
+	root.index = 0;
+	root.cluster = vcb->root_cluster;
+	root.size = dir_cache_bytes();
+	root.blocks = walk_chain(&root, &workers[0]);
+	if (root.blocks < dir_blocks) {
+		fprintf(stderr, "[ FSCK ] : The chain of the root directory is broken, can't check %s\n", volume);
+		return FSCK_FAILED;
+	}
+	push_task(&workers[0], &root);
+	for (int i = 0; i < threads; i++) {
+		pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+	}
+	long dirs = 0, files = 0, blocks = 0, steals = 0;
+	int errors = 0;
+	for (int i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		dirs += workers[i].dirs;
+		files += workers[i].files;
+		blocks += workers[i].blocks;
+		steals += workers[i].steals;
+		errors += workers[i].errors;
+	}
+	double walked = now() - start;
+	fprintf(stderr, "[ FSCK ] : %ld directories, %ld files, %ld blocks in chains, "
+		"walked in %.3f s by %d threads with %ld steals\n",
+		dirs, files, blocks, walked, threads, steals);
+
+	// repairs, one at a time
+	qsort(problems, problem_count, sizeof(fsck_problem), problem_order);
+	int found = 0;
+	int repaired = 0;
+	for (int i = 0; i < problem_count; i++) {
+		int ret = fix_problem(&problems[i], !report_only);
+		found++;
+		if (ret == 1) {
+			repaired++;
+		}
+	}
+
+	// blocks in use that no chain claimed, reservations that were never
+	// handed out or given back among them
+	long leaked = 0;
+	long reserved = 0;
+	for (uint32_t b = data_start; b < volume_end; b++) {
+		uint32_t next = get_next_block(b);
+		if (next == FREE_BLOCK || is_claimed(b)) {
+			continue;
+		}
+		leaked++;
+		if (next == RESERVED_BLOCK) {
+			reserved++;
+		}
+		if (!report_only) {
+			set_next_block(b, FREE_BLOCK);
+		}
+	}
+	if (leaked > 0) {
+		fprintf(stderr, "[ FSCK ] : %ld blocks in use belong to no file, %ld of them reserved%s\n",
+			leaked, reserved, report_only ? "" : ", freed");
+		found++;
+		if (!report_only) {
+			repaired++;
+		}
+	}
+
+	// the free counts of the groups are loaded from the summary at mount,
+	// count them again from the FAT the walk just read
+	int wrong_groups = fat_rebuild_summary();
+	if (wrong_groups > 0) {
+		fprintf(stderr, "[ FSCK ] : The summary has wrong free counts for %d groups%s\n",
+			wrong_groups, report_only ? "" : ", counts rebuilt");
+		found++;
+		if (!report_only) {
+			repaired++;
+		}
+	}
+
+	uint32_t free_blocks = get_total_free_blocks();
+	if (vcb->free_space != free_blocks) {
+		fprintf(stderr, "[ FSCK ] : The VCB counts %llu free blocks, the FAT has %u%s\n",
+			(ull_t) vcb->free_space, free_blocks, report_only ? "" : ", count rebuilt");
+		found++;
+		if (!report_only) {
+			vcb->free_space = free_blocks;
+			if (vcb_write_to_disk(vcb) == -1) {
+				errors++;
+			} else {
+				repaired++;
+			}
+		}
+	}
+	if (!report_only && repaired > 0) {
+		update_fat_on_disk();
+	}
+
+	int status = FSCK_CLEAN;
+	if (errors > 0 || repaired < found) {
+		status = errors > 0 ? FSCK_FAILED : FSCK_LEFT;
+	} else if (found > 0) {
+		status = FSCK_REPAIRED;
+	}
+	if (report_only) {
+		fprintf(stderr, "[ FSCK ] : %d problems found, nothing changed\n", found);
+	} else {
+		fprintf(stderr, "[ FSCK ] : %d problems found, %d repaired\n", found, repaired);
+	}
+
+	for (int i = 0; i < threads; i++) {
+		pthread_mutex_destroy(&workers[i].lock);
+		free(workers[i].tasks);
+		free(workers[i].dir);
+	}
+	free(workers);
+	free(owned);
+	free(problems);
+	exitFileSystem();
+	closePartitionSystem();
+	return status;
+}
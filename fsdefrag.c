@@ -0,0 +1,85 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: fsdefrag.c
+*
+* Description: Offline defragmenter. Mounts an existing volume,
+*	defragments it and prints the fragmentation before and
+*	after. The file system logs go to /dev/null, the reports
+*	are printed on stderr.
+*
+*	Usage: fsdefrag volume [-n] [KB/s]
+*		-n	only report, nothing is moved
+*		KB/s	most data copied per second, no limit if left out
+**************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fsLow.h"
+#include "mfs.h"
+#include "defrag.h"
+
+int main(int argc, char * argv[]) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s volume [-n] [KB/s]\n", argv[0]);
+		return 1;
+	}
+	char * volume = argv[1];
+	int report_only = 0;
+	uint64_t rate = 0;
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0) {
+			report_only = 1;
+		} else if (atoi(argv[i]) > 0) {
+			rate = (uint64_t) atoi(argv[i]) * 1024;
+		} else {
+			fprintf(stderr, "Usage: %s volume [-n] [KB/s]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// startPartitionSystem would create a missing volume
+	if (access(volume, R_OK | W_OK) != 0) {
+		fprintf(stderr, "[ DEFRAG ] : can't open the volume %s\n", volume);
+		return 1;
+	}
+	uint64_t volume_size = 0;
+	uint64_t block_size = 0;
+	if (freopen("/dev/null", "w", stdout) == NULL) {
+		fprintf(stderr, "[ DEFRAG ] : can't silence the file system logs\n");
+	}
+	if (startPartitionSystem(volume, &volume_size, &block_size) != PART_NOERROR
+			|| initFileSystem(volume_size / block_size, block_size) != 0) {
+		fprintf(stderr, "[ DEFRAG ] : can't start the volume %s\n", volume);
+		return 1;
+	}
+
+	// nobody else uses the volume, the copy runs as fast as asked
+	if (rate == 0) {
+		LBAsetrate(IO_CLASS_BACKGROUND, 0, 0);
+	}
+
+	defrag_report before, after;
+	int ret;
+	if (report_only) {
+		ret = defrag_scan(&before);
+		defrag_print(stderr, "now", &before);
+	} else {
+		ret = defrag_volume(rate, &before, &after);
+		defrag_print(stderr, "before", &before);
+		defrag_print(stderr, "after", &after);
+	}
+
+	exitFileSystem();
+	closePartitionSystem();
+	return ret == 0 ? 0 : 1;
+}
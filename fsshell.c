@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -30,6 +31,11 @@
 
 #include "fsLow.h"
 #include "mfs.h"
+#include "elevator.h"
+#include "defrag.h"
+#include "FAT.h"
+#include "trace.h"
+#include "metrics.h"
 
 #define PERMISSIONS (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)
 
@@ -73,6 +79,10 @@ int cmd_cd (int argcnt, char *argvec[]);
 int cmd_pwd (int argcnt, char *argvec[]);
 int cmd_history (int argcnt, char *argvec[]);
 int cmd_help (int argcnt, char *argvec[]);
+int cmd_stats (int argcnt, char *argvec[]);
+int cmd_defrag (int argcnt, char *argvec[]);
+int cmd_fstrim (int argcnt, char *argvec[]);
+int cmd_trace (int argcnt, char *argvec[]);
 
 dispatch_t dispatchTable[] = {
 	{"ls", cmd_ls, "Lists the file in a directory"},
@@ -87,38 +97,46 @@ dispatch_t dispatchTable[] = {
 	{"cd", cmd_cd, "Changes directory"},
 	{"pwd", cmd_pwd, "Prints the working directory"},
 	{"history", cmd_history, "Prints out the history"},
+	{"stats", cmd_stats, "Prints the counters of the write queue, the FAT pages, the io classes and the operations - [-o file] [reset]"},
+	{"defrag", cmd_defrag, "Defragments the volume - [-n to only report] [KB/s]"},
+	{"fstrim", cmd_fstrim, "Gives the space of every free block back to the host"},
+	{"trace", cmd_trace, "Prints the last traced messages - [count] or echo level"},
 	{"help", cmd_help, "Prints out help"}
 };
 
 static int dispatchcount = sizeof (dispatchTable) / sizeof (dispatch_t);
 
 // Display files for use by ls command
+// Entries come from fs_readdirplus in batches, the type and size are already
+// filled in from the loaded directory so nothing is looked up per entry
+#define DISPLAY_BATCH	32
 int displayFiles (fdDir * dirp, int flall, int fllong)
 	{
 #if (CMDLS_ON == 1)				
 	if (dirp == NULL)	//get out if error
 		return (-1);
 	
-	struct fs_diriteminfo * di;
-	struct fs_stat statbuf;
+	struct fs_diriteminfo items[DISPLAY_BATCH];
+	int count;
 	
-	di = fs_readdir (dirp);
 	printf("\n");
-	while (di != NULL) 
+	while ((count = fs_readdirplus (dirp, items, DISPLAY_BATCH)) > 0) 
 		{
-		if ((di->d_name[0] != '.') || (flall)) //if not all and starts with '.' it is hidden
+		for (int i = 0; i < count; i++)
 			{
-			if (fllong)
+			struct fs_diriteminfo * di = &items[i];
+			if ((di->d_name[0] != '.') || (flall)) //if not all and starts with '.' it is hidden
 				{
-				fs_stat (di->d_name, &statbuf);
-				printf ("%s    %9ld   %s\n", fs_isDir(di->d_name)?"D":"-", statbuf.st_size, di->d_name);
-				}
-			else
-				{
-				printf ("%s\n", di->d_name);
+				if (fllong)
+					{
+					printf ("%s    %9ld   %s\n", (di->fileType == DT_DIR)?"D":"-", (long) di->d_size, di->d_name);
+					}
+				else
+					{
+					printf ("%s\n", di->d_name);
+					}
 				}
 			}
-		di = fs_readdir (dirp);
 		}
 	fs_closedir (dirp);
 #endif
@@ -202,7 +220,11 @@ int cmd_ls (int argcnt, char *argvec[])
 		//processing arguments after options
 		for (int k = optind; k < argcnt; k++)
 			{
-			if (fs_isDir(argvec[k]))
+			lookup_result entry;
+			int found = (fs_lookup (argvec[k], &entry) == 0) && entry.exists;
+			int isdir = entry.is_dir;
+			fs_lookup_release (&entry);
+			if (found && isdir)
 				{
 				fdDir * dirp;
 				dirp = fs_opendir (argvec[k]);
@@ -210,7 +232,7 @@ int cmd_ls (int argcnt, char *argvec[])
 				}
 			else // it is just a file ?
 				{
-				if (fs_isFile (argvec[k]))
+				if (found)
 					{
 					//no support for long format here
 					printf ("%s\n", argvec[k]);
@@ -346,8 +368,11 @@ int cmd_cp (int argcnt, char *argvec[])
 		}
 	
 	
+	// the destination gets all its blocks at once from the source size
+	struct fs_stat st;
+	off_t size_hint = fs_stat (src, &st) == 0 ? st.st_size : 0;
 	testfs_src_fd = b_open (src, O_RDONLY);
-	testfs_dest_fd = b_open (dest, O_WRONLY | O_CREAT | O_TRUNC);
+	testfs_dest_fd = b_open_sized (dest, O_WRONLY | O_CREAT | O_TRUNC, size_hint);
 	do 
 		{
 		readcnt = b_read (testfs_src_fd, buf, BUFFERLEN);
@@ -373,8 +398,17 @@ int cmd_mv (int argcnt, char *argvec[])
 
 	printf("does it go in move\n");
 
-	int source_type = fs_isFile(argvec[1]);
-	int dest_type = fs_isFile(argvec[2]);
+	lookup_result entry;
+	int source_type = -1;
+	int dest_type = -1;
+
+	//one lookup per path, -1 when it does not exist
+	if (fs_lookup(argvec[1], &entry) == 0 && entry.exists)
+		source_type = !entry.is_dir;
+	fs_lookup_release(&entry);
+	if (fs_lookup(argvec[2], &entry) == 0 && entry.exists)
+		dest_type = !entry.is_dir;
+	fs_lookup_release(&entry);
 
 	//fs_renameDirectoryOrFile(argvec[1], argvec[2]);
 
@@ -388,8 +422,7 @@ int cmd_mv (int argcnt, char *argvec[])
 	if (source_type == 1 && dest_type == 0) {
         // Move a file into a directory
 		printf("[mv] moved a file to dir\n");
-		fs_mvFile(argvec[1], argvec[2]); 
-		fs_delete(argvec[1]);
+		return fs_mvFile(argvec[1], argvec[2]); 
     } else if (source_type == 1 && dest_type == 1) {
         // Rename a file
 		printf("[Error] You can't move a file into a file\n");
@@ -442,16 +475,20 @@ int cmd_rm (int argcnt, char *argvec[])
 		}
 		
 	char * path = argvec[1];	
+	lookup_result entry;
 	
 	//must determine if file or directory
-	if (fs_isDir (path))
-		{
-		return (fs_rmdir (path));
-		}		
-	if (fs_isFile (path))
+	if (fs_lookup (path, &entry) == 0 && entry.exists)
 		{
+		int isdir = entry.is_dir;
+		fs_lookup_release (&entry);
+		if (isdir)
+			{
+			return (fs_rmdir (path));
+			}
 		return (fs_delete(path));
 		}	
+	fs_lookup_release (&entry);
 		
 	printf("The path %s is neither a file not a directory\n", path);
 #endif
@@ -533,8 +570,11 @@ int cmd_cp2fs (int argcnt, char *argvec[])
 		}
 	
 	
-	testfs_fd = b_open (dest, O_WRONLY | O_CREAT | O_TRUNC);
+	// the host file size lets the copy get all its blocks at once
 	linux_fd = open (src, O_RDONLY);
+	struct stat st;
+	off_t size_hint = fstat (linux_fd, &st) == 0 ? st.st_size : 0;
+	testfs_fd = b_open_sized (dest, O_WRONLY | O_CREAT | O_TRUNC, size_hint);
 	do 
 		{
 		readcnt = read (linux_fd, buf, BUFFERLEN);
@@ -625,6 +665,190 @@ int cmd_history (int argcnt, char *argvec[])
 	return 0;
 	}
 	
+/****************************************************
+*  Stats commmand
+****************************************************/
+int cmd_stats (int argcnt, char *argvec[])
+	{
+	static const char * bucket_names[ELV_SIZE_BUCKETS] =
+		{"1", "2-7", "8-31", "32-127", "128+"};
+
+	if (argcnt == 2 && strcmp (argvec[1], "reset") == 0)
+		{
+		metrics_reset ();
+		return 0;
+		}
+	if (argcnt == 3 && strcmp (argvec[1], "-o") == 0)
+		{
+		FILE * out = fopen (argvec[2], "w");
+		if (out == NULL)
+			{
+			printf ("stats: can't open %s\n", argvec[2]);
+			return (-1);
+			}
+		int ret = metrics_dump (out);
+		if (fclose (out) != 0 || ret != 0)
+			{
+			printf ("stats: can't write %s\n", argvec[2]);
+			return (-1);
+			}
+		return 0;
+		}
+	if (argcnt != 1)
+		{
+		printf ("Usage: stats [-o file] [reset]\n");
+		return (-1);
+		}
+
+	elv_stats st;
+	elv_get_stats (&st);
+
+	printf ("write queue\n");
+	printf ("  depth            %d now, %d max\n", st.depth, st.max_depth);
+	printf ("  queued           %lu writes, %lu blocks\n", st.requests, st.blocks);
+	printf ("  dispatched       %lu writes, %lu blocks in %lu sweeps\n",
+		st.dispatches, st.dispatched_blocks, st.sweeps);
+	printf ("  merge ratio      %.2f writes per dispatch\n",
+		st.dispatches > 0 ? (double) (st.requests - st.depth) / st.dispatches : 0);
+	printf ("  avg dispatch     %.1f blocks\n",
+		st.dispatches > 0 ? (double) st.dispatched_blocks / st.dispatches : 0);
+	printf ("  barriers         %lu\n", st.barriers);
+	printf ("  errors           %lu\n", st.errors);
+	printf ("  dispatch sizes  ");
+	for (int i = 0; i < ELV_SIZE_BUCKETS; i++)
+		{
+		printf (" %s:%lu", bucket_names[i], st.sizes[i]);
+		}
+	printf ("\n");
+
+	fat_cache_stats fs;
+	fat_get_stats (&fs);
+	printf ("fat pages\n");
+	printf ("  loaded           %d now, %d changed\n", fs.pages, fs.dirty);
+	printf ("  lookups          %lu hits, %lu misses, hit rate %.1f%%\n", fs.hits, fs.misses,
+		fs.hits + fs.misses > 0 ? 100.0 * fs.hits / (fs.hits + fs.misses) : 0);
+	printf ("  evictions        %lu\n", fs.evictions);
+	printf ("  write backs      %lu\n", fs.writebacks);
+	printf ("  discarded        %lu blocks in %lu runs\n", fs.discarded_blocks, fs.discards);
+
+	static const char * class_names[IO_CLASSES] = {"sync", "async", "background"};
+	printf ("io classes        requests     blocks  avg wait us  throttled\n");
+	for (int i = 0; i < IO_CLASSES; i++)
+		{
+		io_class_stats cs;
+		LBAgetstats (i, &cs);
+		printf ("  %-12s %11llu %10llu %12.1f %10llu\n", class_names[i], cs.ios, cs.blocks,
+			cs.ios > 0 ? cs.wait_ns / 1000.0 / cs.ios : 0, cs.throttled);
+		}
+
+	// operations that were never called are left out
+	static metric_hist hist;
+	printf ("operations             calls     avg us     p50 us     p99 us     max us\n");
+	for (int op = 0; op < METRIC_OPS; op++)
+		{
+		metrics_get (op, &hist);
+		if (hist.count == 0)
+			{
+			continue;
+			}
+		printf ("  %-16s %10llu %10.1f %10.1f %10.1f %10.1f\n", metrics_op_name (op),
+			(unsigned long long) hist.count, hist.total_ns / 1000.0 / hist.count,
+			metrics_percentile (&hist, 0.5) / 1000.0, metrics_percentile (&hist, 0.99) / 1000.0,
+			hist.max_ns / 1000.0);
+		}
+	printf ("caches\n");
+	for (int c = 0; c < METRIC_COUNTERS; c++)
+		{
+		printf ("  %-16s %10llu\n", metrics_counter_name (c),
+			(unsigned long long) metrics_get_counter (c));
+		}
+	return 0;
+	}
+
+/****************************************************
+*  Defrag commmand
+****************************************************/
+int cmd_defrag (int argcnt, char *argvec[])
+	{
+	int report_only = 0;
+	uint64_t rate = 0;
+
+	for (int i = 1; i < argcnt; i++)
+		{
+		if (strcmp (argvec[i], "-n") == 0)
+			{
+			report_only = 1;
+			}
+		else if (atoi (argvec[i]) > 0)
+			{
+			rate = (uint64_t) atoi (argvec[i]) * 1024;
+			}
+		else
+			{
+			printf ("Usage: defrag [-n] [KB/s]\n");
+			return (-1);
+			}
+		}
+
+	defrag_report before, after;
+	if (report_only)
+		{
+		int ret = defrag_scan (&before);
+		defrag_print (stdout, "now", &before);
+		return ret;
+		}
+
+	int ret = defrag_volume (rate, &before, &after);
+	defrag_print (stdout, "before", &before);
+	defrag_print (stdout, "after", &after);
+	return ret;
+	}
+
+/****************************************************
+*  Fstrim commmand
+****************************************************/
+int cmd_fstrim (int argcnt, char *argvec[])
+	{
+	if (argcnt != 1)
+		{
+		printf ("Usage: fstrim\n");
+		return (-1);
+		}
+
+	long extents = 0;
+	long blocks = fat_trim (&extents);
+	if (blocks < 0)
+		{
+		printf ("fstrim: the volume file can't give space back\n");
+		return (-1);
+		}
+	printf ("fstrim: %ld blocks discarded in %ld runs\n", blocks, extents);
+	return 0;
+	}
+
+/****************************************************
+*  Trace commmand
+****************************************************/
+int cmd_trace (int argcnt, char *argvec[])
+	{
+	if (argcnt == 3 && strcmp (argvec[1], "echo") == 0)
+		{
+		fs_trace_echo = atoi (argvec[2]);
+		return 0;
+		}
+	if (argcnt > 2 || (argcnt == 2 && atoi (argvec[1]) <= 0))
+		{
+		printf ("Usage: trace [count] | trace echo level\n");
+		return (-1);
+		}
+	int count = argcnt == 2 ? atoi (argvec[1]) : 0;
+	if (trace_dump (stdout, count) == 0)
+		{
+		printf ("trace: nothing traced, up to level %d is kept\n", FS_TRACE_LEVEL);
+		}
+	return 0;
+	}
+
 /****************************************************
 *  Help commmand
 ****************************************************/
@@ -777,6 +1001,8 @@ int main (int argc, char * argv[])
 		return (retVal);
 		}
 		
+	// the shell shows why a command was refused, on stderr
+	fs_trace_echo = TRACE_LEVEL_WARN;
 	retVal = initFileSystem (volumeSize / blockSize, blockSize);
 	
 	if (retVal != 0)
@@ -0,0 +1,68 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: geometry.c
+*
+* Description: Block geometry of the mounted volume.
+**************************************************************/
+#include "geometry.h"
+
+fs_geometry fs_geo;
+// the block size as an int, for the code that sizes buffers with it
+int bytes_per_block;
+
+/**
+ * This helper function returns the log2 of a power of 2
+ *
+ * @param value - a power of 2
+ *
+ * @return - the shift that gives value from 1
+ */
+static uint32_t log2_of(uint32_t value) {
+	uint32_t shift = 0;
+	while ((1U << shift) < value) {
+		shift++;
+	}
+	return shift;
+}
+
+/**
+ * This function sets the geometry of the volume
+ *
+ * @param block_size - bytes in a block of the file system, a power of 2
+ * @param disk_blocks - blocks of the disk in a block, a power of 2
+ *
+ * @return - void
+ */
+void geo_set(uint32_t block_size, uint32_t disk_blocks) {
+	fs_geo.block_size = block_size;
+	fs_geo.block_shift = log2_of(block_size);
+	fs_geo.block_mask = block_size - 1;
+	fs_geo.disk_shift = log2_of(disk_blocks);
+	bytes_per_block = block_size;
+}
+
+/**
+ * This function checks that the build can mount blocks of a size
+ *
+ * @param block_size - bytes in a block of the file system
+ *
+ * @return - 1 if the size can be mounted, 0 otherwise
+ */
+int geo_supported(uint32_t block_size) {
+	if (block_size == 0 || (block_size & (block_size - 1)) != 0) {
+		return 0;
+	}
+#ifdef FS_BLOCK_SIZE
+	return block_size == FS_BLOCK_SIZE;
+#else
+	return 1;
+#endif
+}
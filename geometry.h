@@ -0,0 +1,72 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: geometry.h
+*
+* Description: Block geometry of the mounted volume. A block of
+*	the file system is one cluster, a power of 2 bytes, so a
+*	byte offset turns into a block and an offset inside it with
+*	a shift and a mask, and no layer divides by the block size.
+*	Built with FS_BLOCK_SIZE set to 512 or 4096 the shift is a
+*	constant the compiler folds, and volumes with other blocks
+*	are refused at mount.
+**************************************************************/
+#ifndef _GEOMETRY_H
+#define _GEOMETRY_H
+#include <stdint.h>
+
+// sizes of the mounted volume, set once at mount by geo_set
+typedef struct fs_geometry
+	{
+	uint32_t block_size;	// bytes in a block, one cluster
+	uint32_t block_shift;	// log2 of block_size
+	uint32_t block_mask;	// block_size - 1
+	uint32_t disk_shift;	// log2 of the disk blocks in a block
+	} fs_geometry;
+
+extern fs_geometry fs_geo;
+// the block size as an int, for the code that sizes buffers with it
+extern int bytes_per_block;
+
+#ifdef FS_BLOCK_SIZE
+#if FS_BLOCK_SIZE == 512
+#define GEO_SHIFT	9
+#elif FS_BLOCK_SIZE == 4096
+#define GEO_SHIFT	12
+#else
+#error "FS_BLOCK_SIZE can only be 512 or 4096"
+#endif
+#else
+#define GEO_SHIFT	(fs_geo.block_shift)
+#endif
+
+// bytes in a block, and the mask of an offset inside one
+#define GEO_SIZE	(1U << GEO_SHIFT)
+#define GEO_MASK	(GEO_SIZE - 1)
+
+// blocks needed to hold bytes, rounded up
+#define GEO_BLOCKS(bytes)	(((uint64_t) (bytes) + GEO_MASK) >> GEO_SHIFT)
+// block holding the byte at offset
+#define GEO_BLOCK_OF(offset)	((uint64_t) (offset) >> GEO_SHIFT)
+// position of the byte at offset inside its block
+#define GEO_OFFSET_OF(offset)	((uint32_t) ((offset) & GEO_MASK))
+// bytes in a number of blocks
+#define GEO_BYTES(blocks)	((uint64_t) (blocks) << GEO_SHIFT)
+
+// Sets the geometry to blocks of block_size bytes, each disk_blocks blocks
+// of the disk, both powers of 2. bytes_per_block follows it. The caller
+// makes sure no write is queued in the old geometry.
+void geo_set(uint32_t block_size, uint32_t disk_blocks);
+
+// Returns 1 if this build can mount a volume with blocks of block_size
+// bytes, 0 if it is not a power of 2 or not the FS_BLOCK_SIZE built for.
+int geo_supported(uint32_t block_size);
+
+#endif
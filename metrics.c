@@ -0,0 +1,322 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: metrics.c
+*
+* Description: Shards of the operation metrics. A thread gets
+*	its shard the first time it records and keeps it, only
+*	that thread writes it. The shards stay on the list after
+*	their thread exits so its calls are still counted.
+**************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "metrics.h"
+
+typedef struct metric_shard
+	{
+	struct metric_shard * next;
+	metric_hist ops[METRIC_OPS];
+	uint64_t counters[METRIC_COUNTERS];
+	} metric_shard;
+
+static metric_shard * shards = NULL;	// every shard, newest first
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread metric_shard * my_shard = NULL;
+
+static const char * op_names[METRIC_OPS] =
+	{
+	"fs_mkdir", "fs_rmdir", "fs_opendir", "fs_readdir", "fs_readdirplus",
+	"fs_closedir", "fs_getcwd", "fs_setcwd", "fs_isFile", "fs_isDir",
+	"fs_delete", "fs_mkfile", "fs_mvFile", "fs_stat", "fs_lookup",
+	"b_open", "b_fallocate", "b_read", "b_write", "b_seek", "b_fsync", "b_close",
+	"LBAread", "LBAwrite",
+	"allocate_blocks", "allocate_extent",
+	"dir_load"
+	};
+
+static const char * counter_names[METRIC_COUNTERS] =
+	{
+	"dir_cache_hit", "dir_cache_miss",
+	"fat_page_hit", "fat_page_miss"
+	};
+
+// only the owner adds to a shard, the readers load it at any time
+#define SHARD_ADD(field, value) \
+	__atomic_store_n(&(field), (field) + (value), __ATOMIC_RELAXED)
+#define SHARD_LOAD(field)	__atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+/**
+ * This helper function returns the shard of the calling thread, made and
+ * put on the list the first time
+ *
+ * @return - the shard, NULL if it can't be allocated
+ */
+static metric_shard * get_shard() {
+	if (my_shard == NULL) {
+		metric_shard * shard = calloc(1, sizeof(metric_shard));
+		if (shard == NULL) {
+			return NULL;
+		}
+		pthread_mutex_lock(&shards_lock);
+		shard->next = shards;
+		shards = shard;
+		pthread_mutex_unlock(&shards_lock);
+		my_shard = shard;
+	}
+	return my_shard;
+}
+
+/**
+ * This helper function returns the bucket of a time. Below
+ * METRIC_SUB_BUCKETS ns each ns has a bucket, above it the power of 2 of the
+ * time picks a row of buckets and its next bits the bucket in the row.
+ *
+ * @param ns - the time
+ *
+ * @return - index of the bucket
+ */
+static int bucket_of(uint64_t ns) {
+	if (ns < METRIC_SUB_BUCKETS) {
+		return (int) ns;
+	}
+	int shift = 63 - __builtin_clzll(ns);
+	if (shift > METRIC_MAX_SHIFT) {
+		return METRIC_BUCKETS - 1;
+	}
+	return (shift - METRIC_SUB_BITS + 1) * METRIC_SUB_BUCKETS
+		+ (int) ((ns >> (shift - METRIC_SUB_BITS)) & (METRIC_SUB_BUCKETS - 1));
+}
+
+/**
+ * This function returns the lowest time of a bucket
+ *
+ * @param bucket - index of the bucket
+ *
+ * @return - the time in ns
+ */
+uint64_t metrics_bucket_low(int bucket) {
+	if (bucket < METRIC_SUB_BUCKETS) {
+		return (uint64_t) bucket;
+	}
+	int shift = bucket / METRIC_SUB_BUCKETS + METRIC_SUB_BITS - 1;
+	return (uint64_t) (METRIC_SUB_BUCKETS + bucket % METRIC_SUB_BUCKETS) << (shift - METRIC_SUB_BITS);
+}
+
+/**
+ * This function returns the monotonic time
+ *
+ * @return - the time in ns
+ */
+uint64_t metrics_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * This function records a call of an operation in the shard of the thread
+ *
+ * @param op - the operation
+ * @param start - when the call started, from metrics_now
+ *
+ * @return - void
+ */
+void metrics_record(int op, uint64_t start) {
+	uint64_t ns = metrics_now() - start;
+	metric_shard * shard = get_shard();
+	if (shard == NULL) {
+		return;
+	}
+	metric_hist * hist = &shard->ops[op];
+	SHARD_ADD(hist->count, 1);
+	SHARD_ADD(hist->total_ns, ns);
+	SHARD_ADD(hist->buckets[bucket_of(ns)], 1);
+	if (ns > hist->max_ns) {
+		__atomic_store_n(&hist->max_ns, ns, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * This function records the call a METRIC_SCOPE timed when it goes out of
+ * scope
+ *
+ * @param scope - the scope
+ *
+ * @return - void
+ */
+void metrics_scope_end(metric_scope * scope) {
+	metrics_record(scope->op, scope->start);
+}
+
+/**
+ * This function counts one event in the shard of the thread
+ *
+ * @param counter - the event
+ *
+ * @return - void
+ */
+void metrics_count(int counter) {
+	metric_shard * shard = get_shard();
+	if (shard != NULL) {
+		SHARD_ADD(shard->counters[counter], 1);
+	}
+}
+
+/**
+ * This function adds up the latencies of an operation over the shards
+ *
+ * @param op - the operation
+ * @param out - receives the sum
+ *
+ * @return - void
+ */
+void metrics_get(int op, metric_hist * out) {
+	memset(out, 0, sizeof(metric_hist));
+	pthread_mutex_lock(&shards_lock);
+	for (metric_shard * shard = shards; shard != NULL; shard = shard->next) {
+		metric_hist * hist = &shard->ops[op];
+		out->count += SHARD_LOAD(hist->count);
+		out->total_ns += SHARD_LOAD(hist->total_ns);
+		uint64_t max = SHARD_LOAD(hist->max_ns);
+		if (max > out->max_ns) {
+			out->max_ns = max;
+		}
+		for (int i = 0; i < METRIC_BUCKETS; i++) {
+			out->buckets[i] += SHARD_LOAD(hist->buckets[i]);
+		}
+	}
+	pthread_mutex_unlock(&shards_lock);
+}
+
+/**
+ * This function adds up a counter over the shards
+ *
+ * @param counter - the event
+ *
+ * @return - the number of events
+ */
+uint64_t metrics_get_counter(int counter) {
+	uint64_t total = 0;
+	pthread_mutex_lock(&shards_lock);
+	for (metric_shard * shard = shards; shard != NULL; shard = shard->next) {
+		total += SHARD_LOAD(shard->counters[counter]);
+	}
+	pthread_mutex_unlock(&shards_lock);
+	return total;
+}
+
+/**
+ * This function finds the time under which a fraction of the calls finished
+ *
+ * @param hist - the latencies
+ * @param q - the fraction, 0.5 for the median
+ *
+ * @return - the top of the bucket the call falls in, at most the longest
+ *           call, 0 if there were no calls
+ */
+uint64_t metrics_percentile(const metric_hist * hist, double q) {
+	uint64_t total = 0;
+	for (int i = 0; i < METRIC_BUCKETS; i++) {
+		total += hist->buckets[i];
+	}
+	if (total == 0) {
+		return 0;
+	}
+	uint64_t rank = (uint64_t) (q * total + 0.5);
+	if (rank < 1) {
+		rank = 1;
+	}
+	uint64_t seen = 0;
+	for (int i = 0; i < METRIC_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank) {
+			uint64_t top = i + 1 < METRIC_BUCKETS ? metrics_bucket_low(i + 1) - 1 : hist->max_ns;
+			return top < hist->max_ns ? top : hist->max_ns;
+		}
+	}
+	return hist->max_ns;
+}
+
+const char * metrics_op_name(int op) {
+	return op >= 0 && op < METRIC_OPS ? op_names[op] : "?";
+}
+
+const char * metrics_counter_name(int counter) {
+	return counter >= 0 && counter < METRIC_COUNTERS ? counter_names[counter] : "?";
+}
+
+/**
+ * This function zeroes every shard
+ *
+ * @return - void
+ */
+void metrics_reset(void) {
+	pthread_mutex_lock(&shards_lock);
+	for (metric_shard * shard = shards; shard != NULL; shard = shard->next) {
+		uint64_t * field = (uint64_t *) shard->ops;
+		uint64_t * end = (uint64_t *) (shard->counters + METRIC_COUNTERS);
+		for (; field < end; field++) {
+			__atomic_store_n(field, 0, __ATOMIC_RELAXED);
+		}
+	}
+	pthread_mutex_unlock(&shards_lock);
+}
+
+/**
+ * This function writes the metrics as one JSON object. An operation has its
+ * count, total, longest call, percentiles and the buckets that are not
+ * empty, each as the lowest time of the bucket and its count.
+ *
+ * @param out - where to write
+ *
+ * @return - 0 on success, -1 if the write failed
+ */
+int metrics_dump(FILE * out) {
+	static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+	static const char * quantile_names[] = {"p50_ns", "p90_ns", "p99_ns", "p999_ns"};
+	metric_hist * hist = malloc(sizeof(metric_hist));
+	if (hist == NULL) {
+		return -1;
+	}
+
+	fprintf(out, "{\n  \"operations\": {");
+	for (int op = 0; op < METRIC_OPS; op++) {
+		metrics_get(op, hist);
+		fprintf(out, "%s\n    \"%s\": {\"count\": %llu, \"total_ns\": %llu, \"max_ns\": %llu",
+			op == 0 ? "" : ",", op_names[op], (unsigned long long) hist->count,
+			(unsigned long long) hist->total_ns, (unsigned long long) hist->max_ns);
+		for (int q = 0; q < 4; q++) {
+			fprintf(out, ", \"%s\": %llu", quantile_names[q],
+				(unsigned long long) metrics_percentile(hist, quantiles[q]));
+		}
+		fprintf(out, ", \"buckets\": [");
+		int first = 1;
+		for (int i = 0; i < METRIC_BUCKETS; i++) {
+			if (hist->buckets[i] == 0) {
+				continue;
+			}
+			fprintf(out, "%s[%llu, %llu]", first ? "" : ", ",
+				(unsigned long long) metrics_bucket_low(i), (unsigned long long) hist->buckets[i]);
+			first = 0;
+		}
+		fprintf(out, "]}");
+	}
+	fprintf(out, "\n  },\n  \"counters\": {");
+	for (int c = 0; c < METRIC_COUNTERS; c++) {
+		fprintf(out, "%s\n    \"%s\": %llu", c == 0 ? "" : ",", counter_names[c],
+			(unsigned long long) metrics_get_counter(c));
+	}
+	fprintf(out, "\n  }\n}\n");
+	free(hist);
+	return ferror(out) ? -1 : 0;
+}
@@ -0,0 +1,109 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: metrics.h
+*
+* Description: Counters and latency histograms of the file
+*	system operations. Each thread records in a shard of its
+*	own, so recording takes no lock, and the shards are added
+*	up when the numbers are read. A histogram has buckets of
+*	about 12% of their value at every scale, from nanoseconds
+*	to minutes, in the way of HDR histograms.
+**************************************************************/
+#ifndef _METRICS_H
+#define _METRICS_H
+#include <stdint.h>
+#include <stdio.h>
+
+// operations that are timed
+enum metric_op
+	{
+	M_FS_MKDIR, M_FS_RMDIR, M_FS_OPENDIR, M_FS_READDIR, M_FS_READDIRPLUS,
+	M_FS_CLOSEDIR, M_FS_GETCWD, M_FS_SETCWD, M_FS_ISFILE, M_FS_ISDIR,
+	M_FS_DELETE, M_FS_MKFILE, M_FS_MVFILE, M_FS_STAT, M_FS_LOOKUP,
+	M_B_OPEN, M_B_FALLOCATE, M_B_READ, M_B_WRITE, M_B_SEEK, M_B_FSYNC, M_B_CLOSE,
+	M_LBA_READ, M_LBA_WRITE,
+	M_ALLOCATE_BLOCKS, M_ALLOCATE_EXTENT,
+	M_DIR_LOAD,
+	METRIC_OPS
+	};
+
+// events that are only counted
+enum metric_counter
+	{
+	MC_DIR_CACHE_HIT, MC_DIR_CACHE_MISS,
+	MC_FAT_PAGE_HIT, MC_FAT_PAGE_MISS,
+	METRIC_COUNTERS
+	};
+
+// a bucket splits each power of 2 in 2^METRIC_SUB_BITS
+#define METRIC_SUB_BITS		3
+#define METRIC_SUB_BUCKETS	(1 << METRIC_SUB_BITS)
+// times of 2^METRIC_MAX_SHIFT ns and more, about 18 minutes, share the last bucket
+#define METRIC_MAX_SHIFT	40
+#define METRIC_BUCKETS		((METRIC_MAX_SHIFT - METRIC_SUB_BITS + 2) * METRIC_SUB_BUCKETS)
+
+// latencies of one operation
+typedef struct metric_hist
+	{
+	uint64_t count;			// calls
+	uint64_t total_ns;		// time of all the calls
+	uint64_t max_ns;		// longest call
+	uint64_t buckets[METRIC_BUCKETS];	// calls by time, see metrics_bucket_low
+	} metric_hist;
+
+// a timed call in progress, see METRIC_SCOPE
+typedef struct metric_scope
+	{
+	int op;
+	uint64_t start;
+	} metric_scope;
+
+// Returns the monotonic time in ns.
+uint64_t metrics_now(void);
+
+// Records a call of op that started at start, as given by metrics_now.
+void metrics_record(int op, uint64_t start);
+
+// Ends a scope, called by the cleanup of METRIC_SCOPE.
+void metrics_scope_end(metric_scope * scope);
+
+// Counts one event.
+void metrics_count(int counter);
+
+// Times the rest of the enclosing block as a call of op, every return included.
+#define METRIC_SCOPE(op) \
+	metric_scope metric_scope_ __attribute__ ((cleanup (metrics_scope_end))) = {(op), metrics_now()}
+
+// Adds up the shards of every thread for op into out.
+void metrics_get(int op, metric_hist * out);
+
+// Adds up the shards of every thread for a counter.
+uint64_t metrics_get_counter(int counter);
+
+// Returns the lowest time in ns of a bucket.
+uint64_t metrics_bucket_low(int bucket);
+
+// Returns the time in ns under which a fraction q of the calls finished,
+// the top of the bucket it falls in, 0 if there were no calls.
+uint64_t metrics_percentile(const metric_hist * hist, double q);
+
+// Returns the name of an operation or a counter, as used in the dump.
+const char * metrics_op_name(int op);
+const char * metrics_counter_name(int counter);
+
+// Zeroes every shard. Calls in progress on other threads may still land.
+void metrics_reset(void);
+
+// Writes every operation and counter as JSON. Returns 0, or -1 if the
+// file can't be written.
+int metrics_dump(FILE * out);
+
+#endif
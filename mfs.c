@@ -18,20 +18,59 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 
 #include "fsLow.h"
 #include "vcb_.h"
 #include "FAT.h"
 #include "root_init.h"
 #include "mfs.h"
-#include "fsLow.h"
+#include "dir_cache.h"
+#include "vnode.h"
+#include "writeback.h"
+#include "geometry.h"
+#include "trace.h"
+#include "metrics.h"
 
 extern int entries_per_dir; // need to know the number of the entries per directory
-extern int bytes_per_block; // 
 
 int get_empty_entry(Directory_Entry * parent); 
 void free_dir(Directory_Entry *dir);
 int is_dir(Directory_Entry entry);
+int is_used(Directory_Entry entry);
+void fill_diriteminfo(struct fs_diriteminfo *di, Directory_Entry *entry);
+static void lookup_refresh(lookup_result *result);
+static int mkfile_locked(lookup_result *entry);
+static int truncate_locked(lookup_result *entry);
+
+/**
+ * This function returns the working directory of the calling thread.
+ * A thread that never changed directory works from the root.
+ *
+ * @return - the current directory of the thread
+ *         
+ */
+Directory_Entry *working_directory()
+{
+	if (current_directory == NULL) {
+		current_directory = root_directory;
+		dir_hold(current_directory);
+	}
+	return current_directory;
+}
+
+/**
+ * This function gives back what a worker thread holds in the file system,
+ * its working directory.
+ *
+ * @return - void
+ *         
+ */
+void fs_thread_exit()
+{
+	free_dir(current_directory);
+	current_directory = NULL;
+}
 
 /**
  * This function changes the current working directory to the specified path.
@@ -45,9 +84,10 @@ int is_dir(Directory_Entry entry);
  */
 char *fs_getcwd(char *path, size_t size)
 {
+	METRIC_SCOPE(M_FS_GETCWD);
 
 	// Uses the current_directory[0].path which is the full path for the cwd
-    strncpy(path, current_directory[0].path, size);
+    strncpy(path, working_directory()[0].path, size);
 
     return path;
 }
@@ -63,42 +103,45 @@ char *fs_getcwd(char *path, size_t size)
  */
 int fs_setcwd(char *path)
 {
-	//represents the entry that holds entry.parent and entry.name to use
+	METRIC_SCOPE(M_FS_SETCWD);
+	//represents the result that holds the parent and index to use
 	//to update the current working directory
-    parsed_entry entry;
+    lookup_result entry;
 
-	//First Check setup for parse_directory_path return value
+	//First Check setup for fs_lookup return value
 	//0 Succeeds, -1 fails
-    if ( parse_directory_path(path, &entry) == -1) {
-		printf("[ FS SETCWD ]: Invalid path.\n");
-        free_dir(entry.parent);
+    if (fs_lookup(path, &entry) == -1) {
+		TRACE_WARN("[ FS SETCWD ]: Invalid path.\n");
 		return -1;
 	}
     
-	//Second Check setup for if entry values are correctly updated from parse path
-	//Checks if the parent of the directory exists, will be itself if root dir
-    if (entry.index == -1 || entry.parent == NULL) {
-		printf("[ FS SETCWD ] Directory does not exist within current directory\n");
-		free_dir(entry.parent);
+	//Second Check setup for if the directory was found by the lookup
+    if (!entry.exists) {
+		TRACE_WARN("[ FS SETCWD ] Directory does not exist within current directory\n");
+		fs_lookup_release(&entry);
 		return -1;
 	}
 
 	//Changing directory requires the path to be a directory in order to set
 	//The current directory to it
-    if (!fs_isDir(path)){
-        printf("[ FS SETCWD ]: Not a directory\n");
-        free_dir(entry.parent);
+    if (!entry.is_dir){
+        TRACE_WARN("[ FS SETCWD ]: Not a directory\n");
+        fs_lookup_release(&entry);
         return -1;
     }
 
-	//Saves previous current_directory, in case current_directory gets incorrectly assigned
-	//Creates a temp save point before cwd is lost 
-    Directory_Entry* temp = current_directory;
-
 	//Gets new target directory through return value of get_target (a directory entry)
-    Directory_Entry* target = get_target_directory(entry.parent[entry.index]);
+    Directory_Entry* target = dir_get(entry.location);
+
+	//the parent is released while current_directory is still the old one,
+	//so the old current directory is never freed here
+    fs_lookup_release(&entry);
     if (target == NULL) return -1; //Quick Check for target value existing
 
+	//Saves previous current_directory, in case current_directory gets incorrectly assigned
+	//Creates a temp save point before cwd is lost 
+    Directory_Entry* temp = working_directory();
+
 	//Actual Update and setting the new current directory
     current_directory = target;
     
@@ -114,8 +157,8 @@ int fs_setcwd(char *path)
  * This function searches for a directory entry that matches the provided token (directory name)
  * within the given array of directory entries (current_dir_ent).
  * It iterates through each directory entry in the current directory until a match is found.
- * If a match is found, it allocates memory for a new directory entry, copies the matching entry into it,
- * and returns the new directory entry. If no match is found, it returns NULL.
+ * The directory is taken from the directory pool with one more reference,
+ * the caller gives it back with free_dir.
  *
  * @param entry - A Directory_Entry representing the directory the function is trying to get
  *
@@ -125,25 +168,13 @@ int fs_setcwd(char *path)
  */
 Directory_Entry *get_target_directory(Directory_Entry entry)
 {
-    // check if we want root or current dir
-    if (strcmp(entry.path, "/") == 0)
-        return root_directory;
-    if (strcmp(entry.path, current_directory[0].path) == 0)
-        return current_directory;
-
-    // if not load it to memory
-
-	//Block_size and blocks_need are used to forumalate amount of memory needed
-	//for a the target directory to have
-    int block_size = bytes_per_block; 
-    int blocks_need = (entry.dir_file_size + block_size - 1) / block_size;
-    Directory_Entry *ret = malloc(blocks_need * block_size);
-
-	//Runs through read Disk which runs through the fat implementation of getNew
-	//Returns of successful or failure (-0,-1)
-    if (read_from_disk(ret, entry.dir_first_cluster, blocks_need, block_size) == -1)
+	//every directory comes from the pool, if somebody already has it
+	//loaded (root, cwd, an open fdDir or another walk) the copy is shared
+	//and nothing is read from disk
+    Directory_Entry *ret = dir_get(entry.dir_first_cluster);
+    if (ret == NULL)
     {
-        printf("[LOAD DIR] can't load dir\n");
+        TRACE_ERROR("[LOAD DIR] can't load dir\n");
         return NULL;
     }
     return ret;
@@ -154,19 +185,24 @@ Directory_Entry *get_target_directory(Directory_Entry entry)
  * This function gets the target entry
  *
  * @param current_dir_ent - A Directory_Entry representing the path for the current directory entry
- * @param token - A char pointer representing the token needed to find target entry
+ * @param token - A char pointer to the name to find, it does not need to be terminated
+ * @param len - The length of the name in token
  *
- * @return - On success of setting current working directory, return 0
- *         - If the directory does not exist return -1
+ * @return - On success, return the index of the entry in current_dir_ent
+ *         - If the entry does not exist return -1
  *         
  */
-int find_target_entry(Directory_Entry *current_dir_ent, char *token)
+int find_target_entry(Directory_Entry *current_dir_ent, const char *token, int len)
 {
+    // names are stored in NAME_MAX_LENGTH bytes, a longer one can't match
+    if (len > NAME_MAX_LENGTH)
+        return -1;
 
     for (int i = 0; i < entries_per_dir; i++)
     {
-    
-        if (strcmp(current_dir_ent[i].dir_name, token) == 0)
+        const char *name = current_dir_ent[i].dir_name;
+        // the stored name is only terminated when it is shorter than the field
+        if (strncmp(name, token, len) == 0 && (len == NAME_MAX_LENGTH || name[len] == '\0'))
         {
             // Found matching directory entry at index i);
             return i;
@@ -176,6 +212,38 @@ int find_target_entry(Directory_Entry *current_dir_ent, char *token)
     return -1;
 }
 
+/**
+ * This function finds the next component of a path without modifying the path
+ *
+ * @param cursor - A pointer to the position in the path, moved past the component
+ * @param name - Set to the first character of the component
+ * @param len - Set to the length of the component
+ *
+ * @return - If a component was found, return 1
+ *         - At the end of the path, return 0
+ *         
+ */
+int path_next_component(const char **cursor, const char **name, int *len)
+{
+    const char *p = *cursor;
+
+    // skip the separators in front of the component
+    while (*p == '/')
+        p++;
+    if (*p == '\0')
+    {
+        *cursor = p;
+        return 0;
+    }
+
+    *name = p;
+    while (*p != '\0' && *p != '/')
+        p++;
+    *len = p - *name;
+    *cursor = p;
+    return 1;
+}
+
 /**
  * This function is used to parse the given path and set the entry struct variables
  *
@@ -185,7 +253,7 @@ int find_target_entry(Directory_Entry *current_dir_ent, char *token)
  * @return - On success of parseing through and setting correct entry values, return 0
  *         
  */
-int parse_directory_path(char *path, parsed_entry *entry) {
+int parse_directory_path(const char *path, parsed_entry *entry) {
 	
 	//Checks if path has a value
 	if (path == NULL) return -1;
@@ -194,44 +262,69 @@ int parse_directory_path(char *path, parsed_entry *entry) {
 	Directory_Entry *start_dir;
 	// checking for starting point
 	if ( path[0] != '/') { //Checking if the path is the current directory
-		start_dir = current_directory;
+		start_dir = working_directory();
 	} else { //otherwise it is the root_directory
 		start_dir = root_directory;
 	}
 
 	//We set the start_dir to the parent
 	//This will allow us to save the parent as move to the new directory
-	//that will be gotten from the tokenization
+	//that will be gotten from the components of the path
 	Directory_Entry * parent = start_dir;
+	//the walk holds its own reference on the directory it is in,
+	//the caller releases the one left in entry->parent
+	dir_hold(parent);
 
 	int index = -1;
-	char * token = strtok(path, "/");
+	const char * cursor = path;
+	const char * token;
+	int token_len;
 
 	// either it is current dir or root
-	if (token == NULL) {
+	if (!path_next_component(&cursor, &token, &token_len)) {
 		entry->parent = start_dir;
 		entry->index = 0;
+		entry->name = "";
+		entry->name_len = 0;
 		return 0;
 	}
 
-	//if it is not the current directory or root
-	//we need to actualy tokenize and use the find target entry
-	//to start setting the entry.names
-	while (token != NULL) {
-		char * token2 = strtok(NULL, "/");
-
-		if (token2 == NULL) {
-			index = find_target_entry(parent, token);
+	//walk the components as slices of the path, the path is never copied
+	//or modified and the directories on the way are shared from the pool
+	while (1) {
+		const char * next;
+		int next_len;
+		int more = path_next_component(&cursor, &next, &next_len);
+
+		if (!more) {
+			//the caller looks at the last component under its own lock
+			dir_read_lock(parent);
+			index = find_target_entry(parent, token, token_len);
+			dir_unlock(parent);
 			entry->name = token;
-		} else {
-			index = find_target_entry(parent, token);
-			if (index == -1) return -1;
-			if (!is_dir(parent[index])) return -1;
-			Directory_Entry *temp = get_target_directory(parent[index]);
-			if (parent != start_dir) free_dir(parent);
-			parent = temp;
+			entry->name_len = token_len;
+			break;
+		}
+
+		//a missing or non directory component in the middle of the path
+		dir_read_lock(parent);
+		index = find_target_entry(parent, token, token_len);
+		if (index == -1 || !is_dir(parent[index])) {
+			dir_unlock(parent);
+			free_dir(parent);
+			return -1;
 		}
-		token = token2;
+		Directory_Entry child_entry = parent[index];
+		dir_unlock(parent);
+
+		//only one directory lock is held at a time on the way down
+		Directory_Entry * child = get_target_directory(child_entry);
+		free_dir(parent);
+		parent = child;
+		if (parent == NULL) return -1;
+
+		token = next;
+		token_len = next_len;
 	}
 	//updating parent and index in the entry
 	entry->parent = parent;
@@ -239,6 +332,129 @@ int parse_directory_path(char *path, parsed_entry *entry) {
 	return 0;
 }
 
+/**
+ * This function resolves a path once and fills in everything callers need
+ * about it: if it exists, its type, size, location and its loaded parent.
+ * The parent stays valid until fs_lookup_release is called. The walk reads
+ * the path in place and takes its directories from the directory pool, so
+ * once the pool has grown a lookup does not call malloc.
+ *
+ * @param path - A char pointer representing the path to resolve, it is not modified
+ * @param result - A lookup_result pointer that gets filled with the entry infomation
+ *
+ * @return - On success of finding the parent of the last component, return 0
+ *         - If the path is invalid, return -1
+ *
+ */
+int fs_lookup(const char *path, lookup_result *result) {
+	METRIC_SCOPE(M_FS_LOOKUP);
+
+	//start with an empty result so callers can always release it
+	result->exists = 0;
+	result->is_dir = 0;
+	result->size = 0;
+	result->location = 0;
+	result->parent = NULL;
+	result->index = -1;
+	result->name[0] = '\0';
+	result->locked = 0;
+
+	if (path == NULL) return -1;
+
+	parsed_entry entry;
+	if (parse_directory_path(path, &entry) == -1 || entry.parent == NULL) {
+		return -1;
+	}
+
+	result->parent = entry.parent;
+	int len = entry.name_len > MAX_PATH_LENGTH ? MAX_PATH_LENGTH : entry.name_len;
+	memcpy(result->name, entry.name, len);
+	result->name[len] = '\0';
+
+	//the entry is looked up again under the lock, the walk only
+	//looked at the parent while it held the lock for a moment
+	dir_read_lock(result->parent);
+	result->index = entry.index;
+	lookup_refresh(result);
+	dir_unlock(result->parent);
+	return 0;
+}
+
+/**
+ * This helper function fills the result from the entry found in the parent,
+ * the caller holds a lock on the parent
+ *
+ * @param result - A lookup_result pointer with parent, index and name set
+ *
+ * @return - void
+ *
+ */
+static void lookup_refresh(lookup_result *result) {
+	result->exists = 0;
+	result->is_dir = 0;
+	result->size = 0;
+	result->location = 0;
+	if (result->index != -1) {
+		Directory_Entry *found = &result->parent[result->index];
+		result->exists = 1;
+		result->is_dir = is_dir(*found) ? 1 : 0;
+		result->size = result->is_dir ? found->dir_file_size
+			: vnode_size_of(result->parent[0].dir_first_cluster, result->index, found->dir_file_size);
+		result->location = found->dir_first_cluster;
+	}
+}
+
+/**
+ * This function takes the write lock of the parent found by fs_lookup and
+ * finds the last component again, another thread may have changed the
+ * parent between the lookup and the lock. The lock is released by
+ * fs_lookup_unlock or fs_lookup_release.
+ *
+ * @param result - A lookup_result pointer filled by fs_lookup
+ *
+ * @return - void
+ *
+ */
+void fs_lookup_lock(lookup_result *result) {
+	dir_write_lock(result->parent);
+	result->locked = 1;
+	if (result->name[0] != '\0')
+		result->index = find_target_entry(result->parent, result->name, strlen(result->name));
+	lookup_refresh(result);
+}
+
+/**
+ * This function releases the lock taken by fs_lookup_lock
+ *
+ * @param result - A lookup_result pointer locked by fs_lookup_lock
+ *
+ * @return - void
+ *
+ */
+void fs_lookup_unlock(lookup_result *result) {
+	if (result->locked) {
+		result->locked = 0;
+		dir_unlock(result->parent);
+	}
+}
+
+/**
+ * This function releases the parent directory held by a lookup result
+ *
+ * @param result - A lookup_result pointer filled by fs_lookup
+ *
+ * @return - void
+ *
+ */
+void fs_lookup_release(lookup_result *result) {
+	if (result->parent != NULL) {
+		fs_lookup_unlock(result);
+		free_dir(result->parent);
+		result->parent = NULL;
+	}
+	result->index = -1;
+}
+
 /**
  * This is a helper function to get a empty entry
  *
@@ -268,39 +484,49 @@ int get_empty_entry(Directory_Entry * parent) {
  */
 int fs_mkdir(const char *pathname, mode_t mode)
 {
-	//represents the entry that holds entry.parent and entry.name to use
+	METRIC_SCOPE(M_FS_MKDIR);
+	//represents the result that holds the parent and name to use
 	//to create a new directory
-	parsed_entry entry;
+	lookup_result entry;
 
-	//First Check setup for parse_directory_path return value
+	//First Check setup for fs_lookup return value
 	//0 Succeeds, -1 fails
-	if ( parse_directory_path(pathname, &entry) == -1) {
-		printf(" [MKDIR] invalid path\n");
+	if (fs_lookup(pathname, &entry) == -1) {
+		TRACE_WARN(" [MKDIR] invalid path\n");
 		return -1;
 	}
+	//nobody else changes the parent until the new entry is on disk
+	fs_lookup_lock(&entry);
 
 	//Check for if is the name of the entry is an empty string OR
-	//Check for if the index of the entex is not error or -1 OR
-	//Check if the parent of the entry is not NULL and exists as 
-	//either root or another directory
-	if ( strcmp(entry.name, "") == 0  || entry.index != -1 || entry.parent == NULL){
-		free_dir(entry.parent);
-		printf("[MKDRI] error\n");
+	//Check for if the entry already exists
+	if ( strcmp(entry.name, "") == 0  || entry.exists){
+		fs_lookup_release(&entry);
+		TRACE_WARN("[MKDIR] %s already exists\n", entry.name);
 		return -1;
 	}
 	
 	int ret = 0;
 
+	//gets an empty entry using entry to be able to store new infomation to
+	int index = get_empty_entry(entry.parent);
+	if (index == -1) {
+		TRACE_WARN("[MKDIR] directory is full\n");
+		fs_lookup_release(&entry);
+		return -1;
+	}
+
 	//initialize an directory for a child needed for creation of a director, thus 
 	//making a new directory from using its parent and its name
 	Directory_Entry *child = init_directory(bytes_per_block, entry.parent, entry.name);
-
-	//gets an empty entry using entry to be able to store new infomation to
-	int index = get_empty_entry(entry.parent);
+	if (child == NULL) {
+		fs_lookup_release(&entry);
+		return -1;
+	}
 
 	//initialze new values of entry.parent[index] with the entry infomation and child
 
-	//Directly use the entry.name passed in from the parse function
+	//Directly use the entry.name found by the lookup
 	strncpy(entry.parent[index].dir_name, entry.name, NAME_MAX_LENGTH);
 
 	//Uses the child's 0 indexto update the infomation that is in entry.parent[index]
@@ -308,19 +534,22 @@ int fs_mkdir(const char *pathname, mode_t mode)
 	entry.parent[index].dir_file_size = child[0].dir_file_size;
 	entry.parent[index].dir_first_cluster = child[0].dir_first_cluster;
 	entry.parent[index].dir_attr = child[0].dir_attr;
+	entry.parent[index].dir_create_time = child[0].dir_create_time;
+	entry.parent[index].dir_mod_time = child[0].dir_mod_time;
+	entry.parent[index].dir_access_time = child[0].dir_access_time;
 
 	// commit new data to disk
 	int block_size = bytes_per_block; 
-	int blocks_need = (entry.parent[0].dir_file_size + block_size -1) / block_size; 
+	int blocks_need = GEO_BLOCKS(entry.parent[0].dir_file_size); 
 	if ( write_to_disk(
 			entry.parent,
 			entry.parent[0].dir_first_cluster,
 			blocks_need,
 			block_size) == -1) {
-		printf("[MKDIR] failed to write to disk\n");
+		TRACE_ERROR("[MKDIR] failed to write to disk\n");
 		ret = -1;
 	}
-	free_dir(entry.parent);
+	fs_lookup_release(&entry);
 	free_dir(child);
 	return ret;
 
@@ -340,68 +569,79 @@ int fs_mkdir(const char *pathname, mode_t mode)
  */
 
 int fs_rmdir(const char *pathname) {
+	METRIC_SCOPE(M_FS_RMDIR);
 
-	//represents the entry that holds entry.parent and entry.name that
+	//represents the result that holds the parent and name that
 	//wants to be removed
-	parsed_entry entry;
-	if (parse_directory_path(strdup(pathname), &entry) == -1) {
-		printf("[RMDIR] invalid path\n");
-		free_dir(entry.parent);
+	lookup_result entry;
+	if (fs_lookup(pathname, &entry) == -1) {
+		TRACE_WARN("[RMDIR] invalid path\n");
 		return -1;
 	}
+	fs_lookup_lock(&entry);
 
 	//Checks if the dir that you are trying to delete exists in the file system
-	if (entry.index == -1 || entry.parent == NULL) {
-		printf("[RMDIR] dir not exist\n");
-		free_dir(entry.parent);
+	if (!entry.exists) {
+		TRACE_WARN("[RMDIR] dir not exist\n");
+		fs_lookup_release(&entry);
 		return -1;
 	}
 
 	//returns -1 if you are trying to remove a file from calling
 	//rmdir which should only remove a directory
-	if (fs_isFile(strdup(pathname))) {
-		free_dir(entry.parent);
-		printf("[RMDIR] file\n");
+	if (!entry.is_dir) {
+		fs_lookup_release(&entry);
+		TRACE_WARN("[RMDIR] file\n");
 		return -1;
 	}
 
 	if (strcmp(entry.name, "") == 0 || strcmp(entry.name, "/") == 0) {
-		printf("[RMDIR] get lost\n");
-		free_dir(entry.parent);
+		TRACE_WARN("[RMDIR] can't remove the root\n");
+		fs_lookup_release(&entry);
 		return -1;
 	}
 
-	//can't delete the directory if the directory is not completely empty
-	//we need to use an logical and to check the attr and DIRTY_Dir 
-	if (entry.parent[entry.index].dir_attr & DIRTY_DIR) {
-		printf("[RMDIR] not empty dir\n");
-		free_dir(entry.parent);
-		return -1;
-	}
-
-	// load child
-	Directory_Entry * child = get_target_directory(entry.parent[entry.index]);
+	// load child, it is only needed until this operation ends
+	Directory_Entry * child = dir_get(entry.location);
 	if ( child == NULL) {
-		printf("[RMDIR] NULL CHILD ?\n");
-		free_dir(entry.parent);
+		TRACE_ERROR("[RMDIR] failed to load %s\n", entry.name);
+		fs_lookup_release(&entry);
 		return -1;
 	}
 
+	// the parent is locked before the child, the same order as a path walk
+	dir_write_lock(child);
+
+	//can't delete the directory if anything after . and .. is in use,
+	//nothing can be made in it while its lock is held
+	for (int i = 2; i < entries_per_dir; i++) {
+		if (is_used(child[i])) {
+			TRACE_WARN("[RMDIR] not empty dir\n");
+			dir_unlock(child);
+			free_dir(child);
+			fs_lookup_release(&entry);
+			return -1;
+		}
+	}
 	child[1].dir_first_cluster = -1; // unlink the .. entry that links to the parent
 
 	int block_size = bytes_per_block;
 	int bytes_need = child[0].dir_file_size;
-	int blocks_need = (block_size + bytes_need -1 ) / block_size;
+	int blocks_need = GEO_BLOCKS(bytes_need);
 	int child_start = child[0].dir_first_cluster;
-	if (write_to_disk(child, child_start, blocks_need, block_size) == -1 ) {
-		printf("Can't write to disk\n");
-		free_dir(entry.parent);
+	int check = write_to_disk(child, child_start, blocks_need, block_size);
+	dir_unlock(child);
+	if (check == -1 ) {
+		TRACE_ERROR("Can't write to disk\n");
+		fs_lookup_release(&entry);
 		free_dir(child);
 		return -1;
 	}
 
 	free_dir(child);
 
+	// a copy still held by an open fdDir can't be found again once the blocks are reused
+	dir_invalidate(child_start);
 	release_blocks(child_start);
 
 	strcpy(entry.parent[entry.index].dir_name, "entry");
@@ -411,12 +651,12 @@ int fs_rmdir(const char *pathname) {
 	entry.parent[entry.index].dir_attr = 0;
 
 	if (write_to_disk(entry.parent, entry.parent[0].dir_first_cluster, blocks_need, block_size) == -1) {
-		printf("can't write to disk\n");
-		free_dir(entry.parent);
+		TRACE_ERROR("can't write to disk\n");
+		fs_lookup_release(&entry);
 		return -1;
 	}
 
-	free_dir(entry.parent);
+	fs_lookup_release(&entry);
 	
 	return 0;
 }
@@ -432,12 +672,23 @@ int fs_rmdir(const char *pathname) {
  */
 int fs_isFile(char *filename)
 {
-	//Check to see if the filename is a directory
-	int ret = fs_isDir(filename);
+	METRIC_SCOPE(M_FS_ISFILE);
+	lookup_result entry;
+	if (fs_lookup(filename, &entry) == -1) {
+		TRACE_WARN("[IS FILE] invalid path\n");
+		return -1;
+	}
+
+	if (!entry.exists) {
+		TRACE_DEBUG("[IS FILE] %s does not exist\n", entry.name);
+		fs_lookup_release(&entry);
+		return -1;
+	}
 
-	//Takes the opposite, which means if it is not a directory, it is a path
-	if (ret == -1) return ret;
-	return !ret;
+	//if it is not a directory, it is a file
+	int ret = !entry.is_dir;
+	fs_lookup_release(&entry);
+	return ret;
 }
 
 /**
@@ -451,29 +702,28 @@ int fs_isFile(char *filename)
  */
 int fs_isDir(char *pathname)
 {
-	//represents the entry that holds entry.parent and entry.name to use
-	//to get the entry.parent[index]
-	parsed_entry entry;
-	if ( parse_directory_path(pathname, &entry) == -1) {
-		printf("[IS DIR] invalid path\n");
+	METRIC_SCOPE(M_FS_ISDIR);
+	//represents the result that holds the parent, index and type
+	//of the entry found by the lookup
+	lookup_result entry;
+	if (fs_lookup(pathname, &entry) == -1) {
+		TRACE_WARN("[IS DIR] invalid path\n");
 		return -1;
 	}
 
-	//Checks to see if the entry that is gotten through parse path 
+	//Checks to see if the entry that is gotten through the lookup
 	//exists as a directory
-	if (entry.index == -1 || entry.parent == NULL) {
-		printf("[IS DIR] %s does not exist\n", entry.name);
-		free_dir(entry.parent);
+	if (!entry.exists) {
+		TRACE_DEBUG("[IS DIR] %s does not exist\n", entry.name);
+		fs_lookup_release(&entry);
 		return -1;
 	}
 
-	//runs a is_dir using entry.parent[entry.index] and
-	//returns entry.dir_attr & IS_DIR
-	//using attr to check if it is a directory or not
-	int ret = is_dir(entry.parent[entry.index]);
+	//the lookup already checked the attr of entry.parent[entry.index]
+	int ret = entry.is_dir;
 
 	//free entry after use, because it is simply used check
-	free_dir(entry.parent);
+	fs_lookup_release(&entry);
 	return ret;
  
 }
@@ -490,50 +740,151 @@ int fs_isDir(char *pathname)
  *         
  */
 int fs_mkfile(char *filename) {
+	METRIC_SCOPE(M_FS_MKFILE);
 
-	//represents the entry that holds entry.parent and entry.name to use
+	//represents the result that holds the parent and name to use
 	//to create the new file
-	parsed_entry entry;
-	if (parse_directory_path(strdup(filename), &entry) == -1) {
-		printf("[MKFILE] invalid path\n");
+	lookup_result entry;
+	if (fs_lookup(filename, &entry) == -1) {
+		TRACE_WARN("[MKFILE] invalid path\n");
 		return -1;
 	}
 
+	int ret = fs_mkfile_at(&entry);
+	fs_lookup_release(&entry);
+	return ret;
+}
+
+/**
+ * This Function is used to create a new file in the parent found by fs_lookup
+ *
+ * @param entry - A lookup_result pointer of the file to create, updated on success
+ *
+ * @return - On success of creation of file, return 0
+ *         - if no name given, return -1
+ *         - if file name already exists, return -1
+ *         - if no file created, return -1
+ *         
+ */
+int fs_mkfile_at(lookup_result *entry) {
+	int was_locked = entry->locked;
+	if (!was_locked)
+		fs_lookup_lock(entry);
+	int ret = mkfile_locked(entry);
+	if (!was_locked)
+		fs_lookup_unlock(entry);
+	return ret;
+}
+
+/**
+ * This helper function does the work of fs_mkfile_at, the caller holds the
+ * write lock of the parent through fs_lookup_lock
+ *
+ * @param entry - A lookup_result pointer of the file to create, updated on success
+ *
+ * @return - On success of creation of file, return 0
+ *         - On failure, return -1
+ *         
+ */
+static int mkfile_locked(lookup_result *entry) {
+
 	//Checking to see if something is inputtted as a name for
 	//the new file
-	if (strcmp(entry.name, "") == 0) {
-		printf("[MKFILE] name ?\n");
-		free_dir(entry.parent);
+	if (strcmp(entry->name, "") == 0) {
+		TRACE_WARN("[MKFILE] missing name\n");
 		return -1;
 	}
 
 	//Checks to see if entry already exists 
-	if (entry.index != -1 || entry.parent == NULL) {
-		printf("[MKFILE] %s already exists\n", entry.name);
-		free_dir(entry.parent);
+	if (entry->exists) {
+		TRACE_WARN("[MKFILE] %s already exists\n", entry->name);
 		return -1;
 	}
 
-	int index = get_empty_entry(entry.parent);
-	printf("%d \n", index);
-	strncpy(entry.parent[index].dir_name, entry.name, NAME_MAX_LENGTH);
+	int index = get_empty_entry(entry->parent);
+	if (index == -1) {
+		TRACE_WARN("[MKFILE] directory is full\n");
+		return -1;
+	}
+	Directory_Entry *parent = entry->parent;
+	strncpy(parent[index].dir_name, entry->name, NAME_MAX_LENGTH);
 	int blocks = 1;
-	entry.parent[index].dir_first_cluster = allocate_blocks(blocks);
-	entry.parent[index].dir_attr |= IS_ACTIVE;
-	printf("[MKFILE] file location: %d\n", entry.parent[index].dir_first_cluster);
+	parent[index].dir_first_cluster = allocate_blocks(blocks);
+	parent[index].dir_file_size = 0;
+	parent[index].dir_attr = IS_ACTIVE;
+	parent[index].dir_create_time = time(NULL);
+	parent[index].dir_mod_time = parent[index].dir_create_time;
+	parent[index].dir_access_time = parent[index].dir_create_time;
+	TRACE_DEBUG("[MKFILE] file location: %d\n", parent[index].dir_first_cluster);
 
 	// commit new data to disk
 	int block_size = bytes_per_block;
-	int blocks_need = (entry.parent[0].dir_file_size + block_size -1) / block_size;
-	if (write_to_disk(entry.parent, entry.parent[0].dir_first_cluster, blocks_need, block_size) == -1) {
-		printf("[MKFILE] failed to make file\n");
-		free_dir(entry.parent);
+	int blocks_need = GEO_BLOCKS(parent[0].dir_file_size);
+	if (write_to_disk(parent, parent[0].dir_first_cluster, blocks_need, block_size) == -1) {
+		TRACE_WARN("[MKFILE] failed to make file\n");
 		return -1;
 	}
-	
-	free_dir(entry.parent);
 
+	//the result now describes the new file
+	entry->exists = 1;
+	entry->is_dir = 0;
+	entry->index = index;
+	entry->size = 0;
+	entry->location = parent[index].dir_first_cluster;
+	return 0;
+}
+
+/**
+ * This Function is used to cut a file found by fs_lookup back to zero bytes.
+ * The first block stays with the file, the rest of the chain is released.
+ *
+ * @param entry - A lookup_result pointer of the file to truncate, updated on success
+ *
+ * @return - On success of truncating the file, return 0
+ *         - if the file does not exist or is a directory, return -1
+ *         - if failure to write to disk, return -1
+ *         
+ */
+int fs_truncate_at(lookup_result *entry) {
+	int was_locked = entry->locked;
+	if (!was_locked)
+		fs_lookup_lock(entry);
+	int ret = truncate_locked(entry);
+	if (!was_locked)
+		fs_lookup_unlock(entry);
+	return ret;
+}
+
+/**
+ * This helper function does the work of fs_truncate_at, the caller holds the
+ * write lock of the parent through fs_lookup_lock
+ *
+ * @param entry - A lookup_result pointer of the file to truncate, updated on success
+ *
+ * @return - On success of truncating the file, return 0
+ *         - On failure, return -1
+ *         
+ */
+static int truncate_locked(lookup_result *entry) {
+
+	if (!entry->exists || entry->is_dir) {
+		return -1;
+	}
+
+	Directory_Entry *file = &entry->parent[entry->index];
+
+	//keep the first block and give the rest of the chain back
+	release_after(file->dir_first_cluster);
+	file->dir_file_size = 0;
+	file->dir_mod_time = time(NULL);
 
+	int block_size = bytes_per_block;
+	int blocks_need = GEO_BLOCKS(entry->parent[0].dir_file_size);
+	if (write_to_disk(entry->parent, entry->parent[0].dir_first_cluster, blocks_need, block_size) == -1) {
+		TRACE_ERROR("[TRUNCATE] failed to write to disk\n");
+		return -1;
+	}
+	entry->size = 0;
 	return 0;
 }
 
@@ -552,81 +903,148 @@ int fs_mkfile(char *filename) {
  *         
  */
 int fs_mvFile(char *filename, char *pathname) {
+	METRIC_SCOPE(M_FS_MVFILE);
 
-	//the src needs to be a directory
-	if ( fs_isDir(filename) == 1) {
-		return -1;
-	}
+	//a closed file may still have data queued for the flusher, it is
+	//written under the old slot before the entry moves
+	wb_sync();
 
-	
-	//represents the entry that holds entry.parent and entry.name the source 
+	//represents the result that holds the parent and name the source 
 	//(file) that is being moved to the destination (directory)
-	parsed_entry source;
-	if ( parse_directory_path (filename, &source) == -1) {
-		printf("[MVFILE] invalid path\n");
+	lookup_result source;
+	if (fs_lookup(filename, &source) == -1) {
+		TRACE_WARN("[MVFILE] invalid path\n");
 		return -1;
 	}
 
 	//Checks to see if the source that is being passed exists in the directory
-	if ( source.index == -1 || source.parent == NULL) {
-		printf("[MVILFE] %s does not exist\n", source.name);
-		free_dir(source.parent);
+	if (!source.exists) {
+		TRACE_WARN("[MVILFE] %s does not exist\n", source.name);
+		fs_lookup_release(&source);
 		return -1;
 	}
 
-	//Checks to see if the source (file) is actually a file, can't move a directory
-	if (fs_isFile(pathname) == 1) {
-		printf(" [MVILFE] a file\n");
+	//the src can't be a directory
+	if (source.is_dir) {
+		fs_lookup_release(&source);
 		return -1;
 	}
 
-	//represents the entry that holds entry.parent and entry.name for the destination 
+	//represents the result that holds the parent and name for the destination 
 	//(directory) that the source (file) is being moved to
-	parsed_entry destination;
-	if (parse_directory_path(pathname, &destination) == -1) {
-		printf("[MVFILE] invalid path\n");
-		free_dir(destination.parent);
+	lookup_result destination;
+	if (fs_lookup(pathname, &destination) == -1) {
+		TRACE_WARN("[MVFILE] invalid path\n");
+		fs_lookup_release(&source);
 		return -1;
 	}
 
 	//Checks to see if the destination (directory) that is being passed exists in the file system
-	if (destination.index == -1 || destination.parent == NULL) {
-		free_dir(destination.parent);
-		printf("[MFILE] dir does not exists\n");
+	if (!destination.exists) {
+		fs_lookup_release(&source);
+		fs_lookup_release(&destination);
+		TRACE_WARN("[MFILE] dir does not exists\n");
+		return -1;
+	}
+
+	//Checks to see if the destination is actually a directory, can't move into a file
+	if (!destination.is_dir) {
+		TRACE_WARN(" [MVILFE] a file\n");
+		fs_lookup_release(&source);
+		fs_lookup_release(&destination);
+		return -1;
+	}
+
+	Directory_Entry * dest_dir = dir_get(destination.location);
+	fs_lookup_release(&destination);
+	if (dest_dir == NULL) {
+		fs_lookup_release(&source);
+		return -1;
+	}
+	if (dest_dir == source.parent) { // same dir
+		TRACE_WARN("[MVFILE] same dir\n");
+		fs_lookup_release(&source);
+		free_dir(dest_dir);
 		return -1;
 	}
 
-	Directory_Entry * dest_dir = get_target_directory(destination.parent[destination.index]);
-	printf("dedst_dir path %s \n",dest_dir[0].path );
-	printf("dedst_dir path %s \n",source.parent[0].path);
-	if ( strcmp(dest_dir[0].path, source.parent[0].path) == 0) { // same dir
-		printf("[MVFILE] same dir\n");
-		free_dir(source.parent);
-		free_dir(destination.parent);
+	//two unrelated directories are locked in the order of their first block
+	if (dest_dir[0].dir_first_cluster < source.parent[0].dir_first_cluster) {
+		dir_write_lock(dest_dir);
+		fs_lookup_lock(&source);
+	} else {
+		fs_lookup_lock(&source);
+		dir_write_lock(dest_dir);
+	}
+
+	//the source may have gone while nothing was locked
+	if (!source.exists || source.is_dir) {
+		TRACE_WARN("[MVILFE] %s does not exist\n", source.name);
+		dir_unlock(dest_dir);
+		fs_lookup_release(&source);
 		free_dir(dest_dir);
+		return -1;
+	}
+
+	//an open file's vnode is tied to the slot, it can't move under it.
+	//A new open waits for the lock on the parent, so the check holds.
+	if (vnode_is_open(source.parent[0].dir_first_cluster, source.index)) {
+		TRACE_WARN("[MVFILE] %s is open\n", source.name);
+		dir_unlock(dest_dir);
+		fs_lookup_release(&source);
+		free_dir(dest_dir);
+		errno = EBUSY;
+		return -1;
 	}
 
 
 	int index = get_empty_entry(dest_dir);
+	if (index == -1) {
+		TRACE_WARN("[MVFILE] directory is full\n");
+		dir_unlock(dest_dir);
+		fs_lookup_release(&source);
+		free_dir(dest_dir);
+		return -1;
+	}
 	int block_size = bytes_per_block;
-	int blocks_need = (dest_dir[0].dir_file_size + block_size - 1) / block_size;
+	int blocks_need = GEO_BLOCKS(dest_dir[0].dir_file_size);
 
 	// start the moving process
-	strcpy(dest_dir[index].dir_name, source.name);
-	dest_dir[index].dir_file_size = source.parent[source.index].dir_file_size;
-	dest_dir[index].dir_first_cluster = source.parent[source.index].dir_first_cluster;
-	dest_dir[index].dir_attr = source.parent[source.index].dir_attr;
-
-	free_dir(source.parent);
-	free_dir(destination.parent);
-
-	if (write_to_disk(dest_dir, dest_dir[0].dir_first_cluster, blocks_need, block_size) == -1) {
-		printf("[MVFILE] failed to write to disk\n");
+	Directory_Entry *moved = &source.parent[source.index];
+	strncpy(dest_dir[index].dir_name, moved->dir_name, NAME_MAX_LENGTH);
+	dest_dir[index].dir_file_size = moved->dir_file_size;
+	dest_dir[index].dir_first_cluster = moved->dir_first_cluster;
+	dest_dir[index].dir_attr = moved->dir_attr;
+	dest_dir[index].dir_create_time = moved->dir_create_time;
+	dest_dir[index].dir_mod_time = moved->dir_mod_time;
+	dest_dir[index].dir_access_time = moved->dir_access_time;
+
+	int check = write_to_disk(dest_dir, dest_dir[0].dir_first_cluster, blocks_need, block_size);
+	dir_unlock(dest_dir);
+	if (check == -1) {
+		TRACE_ERROR("[MVFILE] failed to write to disk\n");
+		fs_lookup_release(&source);
+		free_dir(dest_dir);
 		return -1;
 	}
 
 	free_dir(dest_dir);
 
+	// the blocks now belong to the new entry, only clear the old slot
+	strcpy(moved->dir_name, "entry");
+	strcpy(moved->path, "");
+	moved->dir_attr = 0;
+	moved->dir_first_cluster = 0;
+	moved->dir_file_size = 0;
+
+	blocks_need = GEO_BLOCKS(source.parent[0].dir_file_size);
+	if (write_to_disk(source.parent, source.parent[0].dir_first_cluster, blocks_need, block_size) == -1) {
+		TRACE_ERROR("[MVFILE] failed to write to disk\n");
+		fs_lookup_release(&source);
+		return -1;
+	}
+
+	fs_lookup_release(&source);
 
 	return 0;
 
@@ -645,27 +1063,43 @@ int fs_mvFile(char *filename, char *pathname) {
  */
 int fs_delete(char *filename)
 {
+	METRIC_SCOPE(M_FS_DELETE);
+
+    // a closed file may still have data queued for the flusher,
+    // it is written before the blocks are freed
+    wb_sync();
 
-    // checks if it is a directory, which you can't delete
-    if (fs_isDir(strdup(filename)) == 1)
-    {
-        printf("Can't delete a directory\n");
-		return -1;
-    }
-    
     // grab the directory entry of the file
-    parsed_entry entry;
-    if (parse_directory_path(strdup(filename), &entry) == -1) {
+    lookup_result entry;
+    if (fs_lookup(filename, &entry) == -1) {
 	    return -1;
     }
+    fs_lookup_lock(&entry);
 
 	//Needs to be a valid file that can be deleted
-    if (entry.index == -1 || entry.parent == NULL){
-	free_dir(entry.parent);
-        printf("not a valid file\n");
+    if (!entry.exists){
+	fs_lookup_release(&entry);
+        TRACE_WARN("not a valid file\n");
         return -1;
     }
 
+    // checks if it is a directory, which you can't delete
+    if (entry.is_dir)
+    {
+        TRACE_WARN("Can't delete a directory\n");
+	fs_lookup_release(&entry);
+		return -1;
+    }
+
+    // an open file would write its size into the freed slot and grow a
+    // freed chain, a new open waits for the lock on the parent
+    if (vnode_is_open(entry.parent[0].dir_first_cluster, entry.index)) {
+        TRACE_WARN("[FS DELETE] %s is open\n", entry.name);
+	fs_lookup_release(&entry);
+	errno = EBUSY;
+	return -1;
+    }
+
     // free the blocks
     release_blocks(entry.parent[entry.index].dir_first_cluster);
 
@@ -678,17 +1112,17 @@ int fs_delete(char *filename)
     
     // update data to disk 
     int bytes_need = entry.parent[0].dir_file_size;
-    int blocks_need = (bytes_need + bytes_per_block -1) / bytes_per_block;
+    int blocks_need = GEO_BLOCKS(bytes_need);
     if (write_to_disk(entry.parent,
 			    entry.parent[0].dir_first_cluster,
 			    blocks_need, bytes_per_block) == -1) {
-	    printf("[FS DELETE] can't write to disk\n");
-	    free_dir(entry.parent);
+	    TRACE_ERROR("[FS DELETE] can't write to disk\n");
+	    fs_lookup_release(&entry);
 	    return -1;
     }
 
     // free directory if not root or current dir
-    free_dir(entry.parent);
+    fs_lookup_release(&entry);
 
 
     return 0;
@@ -703,43 +1137,48 @@ int fs_delete(char *filename)
  *         - if name already exists, return -1
  *         
  */
-int fs_renameDirectoryOrFile(const char *path, const *newName)
+int fs_renameDirectoryOrFile(const char *path, const char *newName)
 {
-	parsed_entry entry;
+	lookup_result entry;
 
 	//Check for if name exists as an already created file or directory
-	//Looks to see if the given path in newName is file/dir which would return 0
-	if (fs_isFile(newName) == 0 || fs_isDir(newName) == 0 ){
-			printf("[ FS RENAME ]: Name already exists.\n");
+	if (fs_lookup(newName, &entry) == 0 && entry.exists) {
+			TRACE_WARN("[ FS RENAME ]: Name already exists.\n");
+			fs_lookup_release(&entry);
 			return -1;
     }
+	fs_lookup_release(&entry);
 
-	//Changes print statement based on whether it is a dir or file
-	if (fs_isDir(path)){
-        printf("[ FS RENAME ]: Changing dir name of %s to %s\n", path, newName);
-    }
-	else{
-		printf("[ FS RENAME ]: Changing file name of %s to %s\n", path, newName);
+	//Looks up the path to rename once and sends it over to entry struct
+    if (fs_lookup(path, &entry) == -1) {
+		TRACE_WARN("[ FS RENAME ]: Invalid path.\n");
+		return -1;
 	}
-
-	//Parses through path to build the path and send it over to entry struct
-    if ( parse_directory_path(path, &entry) == -1) {
-		printf("[ FS RENAME ]: Invalid path.\n");
-        free_dir(entry.parent);
+	fs_lookup_lock(&entry);
+	if (!entry.exists) {
+		TRACE_WARN("[ FS RENAME ]: Invalid path.\n");
+        fs_lookup_release(&entry);
 		return -1;
 	}
 
-	//Need to get the current Directory entry that you are changing the name for
-	//Entry struct containers the parent with with the correct index from running
-	//the parse_directory_path function
-    Directory_Entry* target = get_target_directory(entry.parent[entry.index]);
+	//Changes print statement based on whether it is a dir or file
+	if (entry.is_dir){
+        TRACE_INFO("[ FS RENAME ]: Changing dir name of %s to %s\n", path, newName);
+    }
+	else{
+		TRACE_INFO("[ FS RENAME ]: Changing file name of %s to %s\n", path, newName);
+	}
 
 	//Needs to copy the user inputted name into the directory or file after correct checks
-	strcpy(entry.parent[entry.index].dir_name, newName);
+	strncpy(entry.parent[entry.index].dir_name, newName, NAME_MAX_LENGTH);
+
+	int block_size = bytes_per_block;
+	int blocks_need = GEO_BLOCKS(entry.parent[0].dir_file_size);
+	int ret = write_to_disk(entry.parent, entry.parent[0].dir_first_cluster, blocks_need, block_size);
 
 	//Immeditate clean of the entry after copying over
-	free_dir(entry.parent);
-    return 0;
+	fs_lookup_release(&entry);
+    return ret;
 
 }
 
@@ -763,32 +1202,34 @@ int fs_renameDirectoryOrFile(const char *path, const *newName)
  */
 fdDir *fs_opendir(const char *pathname)
 {
-    // check if pathname is a directory or a file
-    if (fs_isFile(strdup(pathname)) == 1)
-    {
-        printf("not a directory\n");
-        return NULL;
-    }
-    
-	//represents the entry that holds entry.parent and entry.name that is being 
+	METRIC_SCOPE(M_FS_OPENDIR);
+	//represents the result that holds the parent and index of the directory being 
 	//opened, we need this entry to get it for a child Directory entry
-    parsed_entry entry;
-    if (parse_directory_path(strdup(pathname), &entry) == -1) {
-        printf ("invalid pathname\n");
+    lookup_result entry;
+    if (fs_lookup(pathname, &entry) == -1) {
+        TRACE_WARN("[OPEN DIR] invalid pathname %s\n", pathname);
         return NULL;
     }
 
 	//Checks if the directory actually exists thus allowing us to open it
-    if (entry.index == -1 || entry.parent == NULL) {
-	    printf("[OPEN DIR] dir not exists\n");
-	    free_dir(entry.parent);
+    if (!entry.exists) {
+	    TRACE_WARN("[OPEN DIR] dir not exists\n");
+	    fs_lookup_release(&entry);
 	    return NULL;
     }
 
-    Directory_Entry *child = get_target_directory(entry.parent[entry.index]);
+    // check if pathname is a directory or a file
+    if (!entry.is_dir)
+    {
+        TRACE_WARN("not a directory\n");
+	fs_lookup_release(&entry);
+        return NULL;
+    }
+
+    Directory_Entry *child = dir_get(entry.location);
     if (child == NULL) {
-	    printf("[OPEN DIR] can;t bring to mem\n");
-	    free_dir(entry.parent);
+	    TRACE_ERROR("[OPEN DIR] can't load the directory\n");
+	    fs_lookup_release(&entry);
 	    return NULL;
     }
 
@@ -799,9 +1240,8 @@ fdDir *fs_opendir(const char *pathname)
     dir->di = malloc(sizeof(struct fs_diriteminfo));
 
 
-    if (entry.parent != child){
-	    free_dir(entry.parent);
-    } 
+    // the handle keeps its own reference on child, even when child is the parent
+    fs_lookup_release(&entry);
 
     return dir;
 
@@ -840,6 +1280,32 @@ int is_dir(Directory_Entry entry)
     return entry.dir_attr & IS_DIR;
 }
 
+/**
+ * This Function is used to copy a directory entry into the structure returned to readdir callers
+ *
+ * @param di - A fs_diriteminfo pointer representing the item to fill
+ * @param entry - A directory entry pointer representing the entry to copy from
+ *
+ * @return - void
+ *         
+ */
+void fill_diriteminfo(struct fs_diriteminfo *di, Directory_Entry *entry)
+{
+    // dir_name is not terminated when the name uses every byte
+    strncpy(di->d_name, entry->dir_name, NAME_MAX_LENGTH);
+    di->d_name[NAME_MAX_LENGTH] = '\0';
+    di->d_reclen = sizeof(struct fs_diriteminfo);
+    if (is_dir(*entry))
+        di->fileType = DT_DIR;
+    else
+        di->fileType = DT_REG;
+    di->d_size = entry->dir_file_size;
+    di->d_first_cluster = entry->dir_first_cluster;
+    di->d_createtime = entry->dir_create_time;
+    di->d_modtime = entry->dir_mod_time;
+    di->d_accesstime = entry->dir_access_time;
+}
+
 /**
  * This Function is used to read a directory and returns it as a struct to get it item info
  *
@@ -851,26 +1317,66 @@ int is_dir(Directory_Entry entry)
  */
 struct fs_diriteminfo *fs_readdir(fdDir *dirp)
 {
+    METRIC_SCOPE(M_FS_READDIR);
     if (dirp == NULL)
         return NULL;
 
+    dir_read_lock(dirp->directory);
     for (int i = dirp->dirEntryPosition; i < dirp->d_reclen; i++)
     {
         dirp->dirEntryPosition++;
         if (is_used(dirp->directory[i]))
         {
-            strncpy(dirp->di->d_name, dirp->directory[i].dir_name, 256);
-            if (is_dir(dirp->directory[i]))
-                dirp->di->fileType = DT_DIR;
-            else
-                dirp->di->fileType = DT_REG;
-
+            fill_diriteminfo(dirp->di, &dirp->directory[i]);
+            if (dirp->di->fileType == DT_REG)
+                dirp->di->d_size = vnode_size_of(dirp->directory[0].dir_first_cluster, i, dirp->di->d_size);
+            dir_unlock(dirp->directory);
             return dirp->di;
         }
     }
+    dir_unlock(dirp->directory);
     return NULL;
 }
 
+/**
+ * This Function is used to read a batch of entries from an open directory.
+ * Everything comes from the directory buffer loaded by fs_opendir, so listing
+ * a directory never has to look each entry up again.
+ *
+ * @param dirp - A fdDir pointer representing the directory that you want to read
+ * @param items - An array of at least count fs_diriteminfo to fill
+ * @param count - The most entries to return in this call
+ *
+ * @return - the number of entries filled, 0 at the end of the directory
+ *         - return -1 if dirp or items is NULL
+ *         
+ */
+int fs_readdirplus(fdDir *dirp, struct fs_diriteminfo *items, int count)
+{
+    METRIC_SCOPE(M_FS_READDIRPLUS);
+    if (dirp == NULL || items == NULL)
+        return -1;
+
+    int filled = 0;
+    dir_read_lock(dirp->directory);
+    while (filled < count && dirp->dirEntryPosition < dirp->d_reclen)
+    {
+        Directory_Entry *entry = &dirp->directory[dirp->dirEntryPosition];
+        dirp->dirEntryPosition++;
+        if (is_used(*entry))
+        {
+            fill_diriteminfo(&items[filled], entry);
+            // an open file has a newer size than its entry
+            if (items[filled].fileType == DT_REG)
+                items[filled].d_size = vnode_size_of(dirp->directory[0].dir_first_cluster,
+                        dirp->dirEntryPosition - 1, items[filled].d_size);
+            filled++;
+        }
+    }
+    dir_unlock(dirp->directory);
+    return filled;
+}
+
 /**
  * This Function is used to Clean up of a directory
  *
@@ -882,15 +1388,16 @@ struct fs_diriteminfo *fs_readdir(fdDir *dirp)
  */
 int fs_closedir(fdDir *dirp)
 {
+    METRIC_SCOPE(M_FS_CLOSEDIR);
     if (dirp == NULL)
     {
-        printf("dirp is null\n");
+        TRACE_WARN("dirp is null\n");
         return -1;
     }
     free_dir(dirp->directory);
     free(dirp->di);
     dirp->di = NULL;
-    dirp = NULL;
+    free(dirp);
 
     return 0;
 }
@@ -907,44 +1414,51 @@ int fs_closedir(fdDir *dirp)
  */
 int fs_stat(const char *path, struct fs_stat *buf)
 {
-	parsed_entry entry;
-	if (parse_directory_path(strdup(path), &entry) == -1) {
-		printf("[FS STAT] invalid path\n");
+	METRIC_SCOPE(M_FS_STAT);
+	lookup_result entry;
+	if (fs_lookup(path, &entry) == -1) {
+		TRACE_WARN("[FS STAT] invalid path\n");
 		return -1;
 	}
-	if (entry.index == -1 || entry.parent == NULL) {
-		free_dir(entry.parent);
-		printf("[FS STAT] %s does not exists", entry.name);
+	if (!entry.exists) {
+		fs_lookup_release(&entry);
+		TRACE_DEBUG("[FS STAT] %s does not exists\n", entry.name);
 		return -1;
 	}
 
-	buf->st_size = entry.parent[entry.index].dir_file_size;
+	buf->st_size = entry.size;
 
 	int block_size = bytes_per_block;
-	int bytes_need = entry.parent[entry.index].dir_file_size;
-	int blocks_need = (bytes_need + block_size - 1) / block_size;
+	off_t bytes_need = entry.size;
+	off_t blocks_need = GEO_BLOCKS(bytes_need);
 	buf->st_blksize = block_size;
 	buf->st_blocks = blocks_need;
-	
+
+	dir_read_lock(entry.parent);
+	Directory_Entry *found = &entry.parent[entry.index];
+	buf->st_accesstime = found->dir_access_time;
+	buf->st_modtime = found->dir_mod_time;
+	buf->st_createtime = found->dir_create_time;
+	dir_unlock(entry.parent);
+
+	fs_lookup_release(&entry);
 	return 0;
 	
 }
 
 /**
- * This Function is used to clean up a directory
+ * This Function is used to give back a directory to the pool
  *
- * @param path - A directory entry pointer dir that we want to free
+ * @param path - A directory entry pointer dir that we are done with, NULL is ignored
  *
  * @return - void (nothing)
  *         
  */
 void free_dir(Directory_Entry * dir) {
 
-	//We need to keep current directory and the root directory in memory
-	if (dir != current_directory && dir != root_directory) {
-		free(dir);
-		dir == NULL;
-	}
+	//drops one reference, root and the current directory hold their own
+	//so they stay in memory, and the buffer is reused once nobody has it
+	dir_put(dir);
 }
 
 
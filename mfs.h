@@ -45,6 +45,11 @@ struct fs_diriteminfo
     unsigned short d_reclen;    /* length of this record */
     unsigned char fileType;    
     char d_name[256]; 			/* filename max filename is 255 characters */
+    off_t d_size;			/* size of the entry in bytes */
+    uint32_t d_first_cluster;		/* first block of the entry */
+    time_t d_createtime;		/* time the entry was created */
+    time_t d_modtime;			/* time the content was last modified */
+    time_t d_accesstime;		/* time the entry was last accessed */
 	};
 
 // This is a private structure used only by fs_opendir, fs_readdir, and fs_closedir
@@ -68,9 +73,25 @@ typedef struct
 	{
 		Directory_Entry *parent;
 		int index;
-		char * name;
+		const char * name;	/* last component, points into the parsed path */
+		int name_len;		/* length of name, it is not terminated */
 	} parsed_entry;
 
+// result structure for fs_lookup
+// one walk of the path fills in everything the callers used to get
+// from separate fs_isDir, fs_isFile, fs_stat and parse calls
+typedef struct
+	{
+	int exists;			/* 1 if the last component of the path was found */
+	int is_dir;			/* 1 if the entry found is a directory */
+	uint64_t size;			/* size of the entry in bytes */
+	uint32_t location;		/* first block of the entry */
+	Directory_Entry *parent;	/* loaded parent directory, freed by fs_lookup_release */
+	int index;			/* index of the entry in parent, -1 if it does not exist */
+	char name[MAX_PATH_LENGTH + 1];	/* last component of the path */
+	int locked;			/* 1 while fs_lookup_lock holds the parent */
+	} lookup_result;
+
 
 
 // Key directory functions
@@ -82,6 +103,11 @@ fdDir * fs_opendir(const char *pathname);
 struct fs_diriteminfo *fs_readdir(fdDir *dirp);
 int fs_closedir(fdDir *dirp);
 
+// Batched readdir - fills up to count items straight from the loaded directory,
+// including size, type, first block and timestamps, so no per entry stat is needed.
+// Returns the number of items filled, 0 at the end of the directory, -1 on error.
+int fs_readdirplus(fdDir *dirp, struct fs_diriteminfo *items, int count);
+
 // Misc directory functions
 char * fs_getcwd(char *pathname, size_t size);
 int fs_setcwd(char *pathname);   //linux chdir
@@ -90,6 +116,34 @@ int fs_isDir(char * pathname);		//return 1 if directory, 0 otherwise
 int fs_delete(char* filename);	//removes a file
 int fs_mkfile(char *filename); // make a file
 int fs_mvFile(char *filename, char *pathname);
+
+// Resolves a path once and fills in the result structure.
+// Returns 0 if the parent of the last component was found (result->exists
+// tells whether the last component itself exists), -1 for an invalid path.
+// On success the caller must call fs_lookup_release when done with result.
+int fs_lookup(const char *path, lookup_result *result);
+void fs_lookup_release(lookup_result *result);
+
+// Takes the write lock of the parent found by fs_lookup and looks the last
+// component up again, since another thread may have changed the parent.
+// fs_lookup_release also drops the lock.
+void fs_lookup_lock(lookup_result *result);
+void fs_lookup_unlock(lookup_result *result);
+
+// Working directory of the calling thread, the root until it calls fs_setcwd.
+Directory_Entry *working_directory();
+
+// Called by a worker thread before it exits, drops its working directory.
+void fs_thread_exit();
+
+// Same as fs_mkfile but works on the parent already found by fs_lookup.
+// On success result is updated to describe the new file. If another thread
+// created the file first it returns -1 with result describing that file.
+int fs_mkfile_at(lookup_result *result);
+
+// Cuts the file described by result back to zero bytes, keeping its first block.
+int fs_truncate_at(lookup_result *result);
+
 // extra handlers 
 char* build_absolute_path(const char *pathname) ;
 
@@ -108,12 +162,17 @@ Directory_Entry * get_target_directory(Directory_Entry entry);
 
 
 // This function parses a directory path and finds the corresponding directory entry.
-// It takes the path and the target parameter as input.
-// If the provided path is NULL, the function prints an error message and returns NULL.
-// Otherwise, it searches for the directory entry that matches the path.
-// If a matching directory entry is found, it returns a pointer to the directory entry.
-// If no matching directory entry is found or an error occurs, it returns NULL.
-int parse_directory_path(char *path, parsed_entry *parent_dir);
+// It takes the path and the target parameter as input, the path is not modified.
+// Directories on the way come from the shared directory pool, the parent it
+// returns holds a reference the caller gives back.
+// If the parent of the last component is found, it returns 0 and fills parent_dir.
+// If the provided path is NULL or a middle component is missing, it returns -1.
+int parse_directory_path(const char *path, parsed_entry *parent_dir);
+
+// Returns the next component of a path as a slice of the path itself.
+// cursor is moved past the component, repeated '/' are skipped.
+// Returns 1 if a component was found, 0 at the end of the path.
+int path_next_component(const char **cursor, const char **name, int *len);
 
 int add_entry_to_parent(Directory_Entry* parent_directory, Directory_Entry* new_directory, char* new_path);
 
@@ -135,5 +194,13 @@ struct fs_stat
 
 int fs_stat(const char *path, struct fs_stat *buf);
 
+// Set before initFileSystem to mount without writing to the volume. The
+// mount state is left as it is and exitFileSystem writes no checkpoint.
+extern int fs_read_only;
+
+// Set before initFileSystem to choose the blocks in a cluster of a volume
+// it formats, a power of 2. 0 picks it from the size of the volume.
+extern int fs_cluster_blocks;
+
 #endif
 
@@ -0,0 +1,140 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: mkfs.c
+*
+* Description: Formats a new volume. The volume file is created
+*	sparse, so its blocks take no space until they are
+*	written, and the format only writes the VCB, the pages of
+*	the FAT that are not free, the free count summary and the
+*	root directory. The file system logs go to /dev/null, the
+*	report is printed on stderr.
+*
+*	Usage: mkfs volume size [block size] [-c cluster size] [-f]
+*		size		bytes, with an optional K, M, G or T suffix
+*		block size	a power of 2, 512 if left out
+*		-c		bytes in a cluster, a power of 2 blocks,
+*				picked from the volume size if left out
+*		-f		replace a volume that already exists
+**************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fsLow.h"
+#include "mfs.h"
+
+/**
+ * This helper function reads a size with an optional K, M, G or T suffix
+ *
+ * @param text - the size as typed
+ *
+ * @return - the size in bytes, 0 if it can't be read
+ */
+static uint64_t parse_size(const char * text) {
+	char * end;
+	unsigned long long value = strtoull(text, &end, 10);
+	switch (*end) {
+		case 'T': case 't': value <<= 10; // falls through
+		case 'G': case 'g': value <<= 10; // falls through
+		case 'M': case 'm': value <<= 10; // falls through
+		case 'K': case 'k': value <<= 10; end++; break;
+		case '\0': break;
+		default: return 0;
+	}
+	return *end == '\0' ? value : 0;
+}
+
+int main(int argc, char * argv[]) {
+	char * volume = NULL;
+	uint64_t volume_size = 0;
+	uint64_t block_size = 512;
+	uint64_t cluster_size = 0;
+	int force = 0;
+	int args = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-f") == 0) {
+			force = 1;
+		} else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			cluster_size = parse_size(argv[++i]);
+			if (cluster_size == 0) {
+				volume = NULL;
+				break;
+			}
+		} else if (args == 0) {
+			volume = argv[i];
+			args++;
+		} else if (args == 1) {
+			volume_size = parse_size(argv[i]);
+			args++;
+		} else if (args == 2) {
+			block_size = parse_size(argv[i]);
+			args++;
+		} else {
+			volume = NULL;
+			break;
+		}
+	}
+	if (volume == NULL || volume_size == 0 || block_size == 0) {
+		fprintf(stderr, "Usage: %s volume size [block size] [-c cluster size] [-f]\n", argv[0]);
+		return 1;
+	}
+	fs_cluster_blocks = cluster_size / block_size;
+	if (cluster_size != 0 && (cluster_size % block_size != 0 || cluster_size > VCB_MAX_CLUSTER_BYTES
+			|| (fs_cluster_blocks & (fs_cluster_blocks - 1)) != 0)) {
+		fprintf(stderr, "[ MKFS ] : a cluster is a power of 2 blocks, at most %d bytes\n",
+			VCB_MAX_CLUSTER_BYTES);
+		return 1;
+	}
+
+	// startPartitionSystem only creates a volume that does not exist
+	if (access(volume, F_OK) == 0) {
+		if (!force) {
+			fprintf(stderr, "[ MKFS ] : %s exists, -f replaces it\n", volume);
+			return 1;
+		}
+		if (unlink(volume) != 0) {
+			fprintf(stderr, "[ MKFS ] : can't remove %s\n", volume);
+			return 1;
+		}
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (freopen("/dev/null", "w", stdout) == NULL) {
+		fprintf(stderr, "[ MKFS ] : can't silence the file system logs\n");
+	}
+	if (startPartitionSystem(volume, &volume_size, &block_size) != PART_NOERROR) {
+		fprintf(stderr, "[ MKFS ] : can't create the volume %s\n", volume);
+		return 1;
+	}
+	if (initFileSystem(volume_size / block_size, block_size) != 0) {
+		fprintf(stderr, "[ MKFS ] : can't format the volume %s\n", volume);
+		closePartitionSystem();
+		unlink(volume);
+		return 1;
+	}
+	uint64_t total_blocks = vcb->total_blocks;
+	uint64_t cluster_blocks = vcb->blocks_per_cluster;
+	uint64_t fat_blocks = vcb->FAT_size;
+	uint64_t reserved = vcb->reserved_blocks_count;
+	exitFileSystem();
+	closePartitionSystem();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	fprintf(stderr, "[ MKFS ] : %s: %llu clusters of %llu blocks of %llu bytes, FAT of %llu clusters, %llu reserved\n",
+		volume, (ull_t) total_blocks, (ull_t) cluster_blocks, (ull_t) block_size,
+		(ull_t) fat_blocks, (ull_t) reserved);
+	fprintf(stderr, "[ MKFS ] : formatted in %.3f s\n",
+		(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+	return 0;
+}
@@ -22,11 +22,13 @@
 #include "vcb_.h"
 #include "FAT.h"
 #include "root_init.h"
+#include "dir_cache.h"
+#include "elevator.h"
+#include "trace.h"
 
 // Initialize the current working directory and root directory
 Directory_Entry *root_directory = NULL;
-char * cwd = NULL;
-Directory_Entry *current_directory = NULL;
+__thread Directory_Entry *current_directory = NULL;
 
 /**
  * The function loads the root directory
@@ -35,29 +37,21 @@ Directory_Entry *current_directory = NULL;
  * 		   - If failure on loading root return -1
  */
 int load_root(){
-    int min_bytes_needed = vcb->entries_per_dir * sizeof(Directory_Entry);
-    int blocks_need = (min_bytes_needed + vcb->bytes_per_block -1) / vcb->bytes_per_block;
-    int malloc_bytes = blocks_need * vcb->bytes_per_block;
-    
     int start_block = vcb->root_cluster;
-    int block_size = vcb->bytes_per_block;
-    root_directory = malloc(malloc_bytes);
         
     printf("[LOAD ROOT] start root block: %d\n", start_block);
-    printf("[LOAD ROOT] numb of blocks for root: %d\n", blocks_need);
-    int check = read_from_disk( (void *) root_directory, start_block, blocks_need, block_size);
-    if (check == -1) {
+    // the root keeps the reference it gets from the pool until exit
+    root_directory = dir_get(start_block);
+    if (root_directory == NULL) {
 	    printf("[LOAD ROOT] failed to load root\n");
 	    return -1;
     }
-    current_directory = root_directory;
 
     // root already loaded in memory using LBAread why loading it again?
    // load_directory (vcb->bytes_per_block, root_directory);
-    cwd = malloc(NAME_MAX_LENGTH);
-    cwd[0] = '/';
-        cwd[1] = '\0';
+	// the current directory holds its own reference
 	current_directory = root_directory;
+	dir_hold(current_directory);
     return 0;
 }
 
@@ -71,9 +65,24 @@ int load_root(){
 Directory_Entry * init_directory(uint64_t block_size, Directory_Entry *parent, char *name) {
  	int min_bytes_needed = vcb->entries_per_dir * sizeof(Directory_Entry);
 	int blocks_need = (min_bytes_needed + block_size -1) / block_size;
-	int malloc_bytes = blocks_need * block_size;
 	
-	Directory_Entry * entries = malloc(malloc_bytes);
+	if (parent != NULL && strlen(name) + 1 + strlen(parent[0].path) > MAX_PATH_LENGTH){
+		TRACE_WARN("[ INIT DIR ] : Path of %s exceeds the length limit.\n", name);
+		return NULL;
+	}
+
+	// the blocks come first, the pool buffer is keyed by the first block
+	uint32_t first_cluster = allocate_blocks(blocks_need);
+	if (first_cluster == (uint32_t) -1) {
+		return NULL;
+	}
+
+	// zeroed buffer from the directory pool, one reference for the caller
+	Directory_Entry * entries = dir_new(first_cluster);
+	if (entries == NULL) {
+		release_blocks(first_cluster);
+		return NULL;
+	}
 
 
 	for (int i = 2; i < vcb->entries_per_dir; i++) {
@@ -84,17 +93,12 @@ Directory_Entry * init_directory(uint64_t block_size, Directory_Entry *parent, c
 	if (parent == NULL) { // root here
 		parent = entries;
 	}
-	
-	if (strlen(name) + 1 + strlen(parent[0].path) > MAX_PATH_LENGTH){
-		printf("path length exceed limit\n");
-		return NULL;
-	}
 
 	// initialze the directory itself
 	
 	// concat the parenth path to the child's name
 	// to make the child's path
-	if ( strcmp(parent[0].path, "/") != 0) {
+	if ( parent != entries && strcmp(parent[0].path, "/") != 0) {
 		strcpy(entries[0].path, parent[0].path);
 	}
 	strcat(entries[0].path, "/");
@@ -102,43 +106,39 @@ Directory_Entry * init_directory(uint64_t block_size, Directory_Entry *parent, c
 	
 	strcpy(entries[0].dir_name, ".");
 	entries[0].dir_file_size = min_bytes_needed;
-	entries[0].dir_first_cluster = allocate_blocks(blocks_need); // testing for root
+	entries[0].dir_first_cluster = first_cluster;
 	entries[0].dir_attr |= (IS_ACTIVE | IS_DIR);
+	entries[0].dir_create_time = time(NULL);
+	entries[0].dir_mod_time = entries[0].dir_create_time;
+	entries[0].dir_access_time = entries[0].dir_create_time;
 
 
 
-	//
-	//testing hex values
-	//
-	//
-	
-	printf("hex values of dir_name: %X\n",entries[0].dir_name[0]);
-	printf("hex values of block location: %X\n", entries[0].dir_first_cluster);
-	printf("hex values of file size: %X\n",entries[0].dir_file_size);
-	printf("hex values of : %X\n",entries[0].dir_attr);
-	//
-	//
-	//testing hex values
-	//
-	//
-	//
+	TRACE_DEBUG("[ INIT DIR ] : %s name %X, location %X, size %llX, attr %X\n", name,
+		entries[0].dir_name[0], entries[0].dir_first_cluster,
+		(unsigned long long) entries[0].dir_file_size, entries[0].dir_attr);
 
 
 	// link the second entry to the parent
-	parent[0].dir_attr |= DIRTY_DIR;
 	strcpy(entries[1].dir_name, "..");
 	entries[1].dir_file_size = parent[0].dir_file_size;
 	entries[1].dir_first_cluster = parent[0].dir_first_cluster;
 	strcpy(entries[1].path, parent[0].path);
 	entries[1].dir_attr = parent[0].dir_attr;
+	entries[1].dir_create_time = parent[0].dir_create_time;
+	entries[1].dir_mod_time = parent[0].dir_mod_time;
+	entries[1].dir_access_time = parent[0].dir_access_time;
 
 	// commit data to disk
 	int start_block = entries[0].dir_first_cluster;
 	int count_block = 0;
-	printf("[INIT ROOT] root start block: %d\n", start_block);
+	TRACE_DEBUG("[ INIT DIR ] : start block: %d\n", start_block);
 	int check = write_to_disk( (void *) entries, start_block, blocks_need, block_size);
 	
 	if (check == -1) { //failed to write to disk
+		dir_invalidate(first_cluster);
+		dir_put(entries);
+		release_blocks(first_cluster);
 		return NULL;
 	}
 	return entries;
@@ -150,8 +150,8 @@ int read_from_disk(void * buffer, int start_block, int blocks_need, int block_si
 	int offset = 0;
 
 	while (start_block != EOF_BLOCK && count_block != blocks_need) {
-		if (LBAread(buffer + offset, 1, start_block) != 1){
-			printf("failed to read from disk\n");
+		if (elv_read(buffer + offset, 1, start_block) != 1){
+			TRACE_ERROR("[ READ DIR ] : Failed to read block %d from disk.\n", start_block);
 			return -1;
 		}
 		//start_block++;
@@ -166,9 +166,8 @@ int write_to_disk(void * buffer, int start_block, int blocks_need, int block_siz
 	int offset = 0;
 
 	while (start_block != EOF_BLOCK && count_block != blocks_need) {
-		if (LBAwrite(buffer + offset, 1, start_block) != 1){
-			printf("%d\n", EOF_BLOCK);
-			printf("failed to write to disk\n");
+		if (elv_write(buffer + offset, 1, start_block) != 1){
+			TRACE_ERROR("[ WRITE DIR ] : Failed to write block %d to disk.\n", start_block);
 			return -1;
 		}
 		//start_block++;
@@ -27,18 +27,22 @@
 #define MAX_PATH_LENGTH		255
 #define IS_ACTIVE 	1<<27 // sixth bit of the dir_attr in DE will indicate whether in use or not
 #define IS_DIR		1<<28 // fifth bit indicating whether DE is a directory	
-#define DIRTY_DIR	1<<26 // bit to indicate whether a dir is empty or not
+#define DIRTY_DIR	1<<26 // no longer kept, rmdir looks at the entries, older volumes may have it set
 typedef struct Directory_Entry {
     char dir_name[NAME_MAX_LENGTH];
     char path[MAX_PATH_LENGTH];
     uint32_t dir_attr;
     uint32_t dir_first_cluster;
-    uint32_t dir_file_size;
+    uint64_t dir_file_size;	// size of the entry in bytes
+    uint64_t dir_create_time;	// time the entry was created
+    uint64_t dir_mod_time;	// time the content was last modified
+    uint64_t dir_access_time;	// time the entry was last accessed
 } Directory_Entry;
 
 extern Directory_Entry* root_directory;
-extern char * cwd;
-extern Directory_Entry * current_directory;
+// every thread has its own working directory, a thread that did not
+// change directory yet works from the root
+extern __thread Directory_Entry * current_directory;
 /*
 * This function initializes a new directory. 
 * If a parent directory is provided, it creates a new directory under it. 
@@ -0,0 +1,131 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: trace.c
+*
+* Description: Ring of the last messages traced. A writer takes
+*	the next sequence number with one atomic add, which gives
+*	it a slot of its own, and publishes the slot by storing the
+*	sequence number in it once the message is written. A reader
+*	copies a slot and keeps it only if the number was there
+*	before and after the copy.
+**************************************************************/
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+typedef struct trace_record
+	{
+	uint64_t seq;		// sequence number + 1 once written, 0 while being written
+	uint64_t nsec;		// monotonic time of the message
+	int thread;		// order the thread traced its first message in
+	int level;
+	char msg[TRACE_MSG_BYTES];
+	} trace_record;
+
+static trace_record ring[TRACE_RING_SIZE];
+static uint64_t next_seq = 0;		// messages ever traced, atomic
+static int next_thread = 0;
+static __thread int thread_id = -1;
+
+int fs_trace_echo = TRACE_LEVEL_ERROR;
+
+static const char * level_names[] = {"ERROR", "WARN", "INFO", "DEBUG"};
+
+/**
+ * This function records a message in the ring, and prints it on stderr
+ * when its level is echoed
+ *
+ * @param level - one of the TRACE_LEVEL values
+ * @param format - printf format of the message
+ *
+ * @return - void
+ */
+void trace_log(int level, const char * format, ...) {
+	va_list args;
+	uint64_t seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+	trace_record * rec = &ring[seq & (TRACE_RING_SIZE - 1)];
+	struct timespec now;
+
+	if (thread_id < 0) {
+		thread_id = __sync_fetch_and_add(&next_thread, 1);
+	}
+	__atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	rec->nsec = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+	rec->thread = thread_id;
+	rec->level = level;
+	va_start(args, format);
+	if (level <= fs_trace_echo) {
+		va_list echo;
+		va_copy(echo, args);
+		vfprintf(stderr, format, echo);
+		va_end(echo);
+	}
+	vsnprintf(rec->msg, TRACE_MSG_BYTES, format, args);
+	va_end(args);
+	// the messages end in a newline like the printf they replaced
+	size_t len = strlen(rec->msg);
+	if (len > 0 && rec->msg[len - 1] == '\n') {
+		rec->msg[len - 1] = '\0';
+	}
+
+	__atomic_store_n(&rec->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * This function prints the last messages of the ring, oldest first. A slot
+ * being written while it is copied is skipped.
+ *
+ * @param out - where to print
+ * @param count - number of messages to print, 0 for the whole ring
+ *
+ * @return - the number of messages printed
+ */
+int trace_dump(FILE * out, int count) {
+	uint64_t end = __atomic_load_n(&next_seq, __ATOMIC_ACQUIRE);
+	uint64_t start = end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0;
+	int printed = 0;
+	int skipped = 0;
+
+	if (count > 0 && end - start > (uint64_t) count) {
+		start = end - count;
+	}
+	for (uint64_t seq = start; seq < end; seq++) {
+		trace_record * rec = &ring[seq & (TRACE_RING_SIZE - 1)];
+		trace_record copy;
+		if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != seq + 1) {
+			skipped++;
+			continue;
+		}
+		memcpy(&copy, rec, sizeof(copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) != seq + 1) {
+			skipped++;
+			continue;
+		}
+		copy.msg[TRACE_MSG_BYTES - 1] = '\0';
+		fprintf(out, "%6llu.%06llu %-5s t%-2d %s\n",
+			(unsigned long long) (copy.nsec / 1000000000ULL),
+			(unsigned long long) (copy.nsec % 1000000000ULL / 1000),
+			copy.level >= 0 && copy.level <= TRACE_LEVEL_DEBUG ? level_names[copy.level] : "?",
+			copy.thread, copy.msg);
+		printed++;
+	}
+	if (skipped > 0) {
+		fprintf(out, "%d messages were being written\n", skipped);
+	}
+	return printed;
+}
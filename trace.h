@@ -0,0 +1,78 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: trace.h
+*
+* Description: Leveled tracing of the file system. Messages of
+*	a level above FS_TRACE_LEVEL are stripped at compile time,
+*	the others are kept in a ring of the last TRACE_RING_SIZE
+*	messages that threads fill without a lock, and only the
+*	levels up to the echo level are also printed, on stderr.
+*	Nothing traced goes to stdout. The shell dumps the ring
+*	with the trace command.
+*
+*	make FS_TRACE_LEVEL=3	keeps the debug messages
+*	make FS_TRACE_LEVEL=1	keeps only errors and warnings
+**************************************************************/
+#ifndef _TRACE_H
+#define _TRACE_H
+#include <stdio.h>
+
+// levels of a message, lower is more important
+#define TRACE_LEVEL_ERROR	0	// an operation failed in a way it should not
+#define TRACE_LEVEL_WARN	1	// a call was refused, a bad path or a full directory
+#define TRACE_LEVEL_INFO	2	// a change worth finding later, a file made or moved
+#define TRACE_LEVEL_DEBUG	3	// details of every call on the I/O path
+
+// most detailed level compiled in
+#ifndef FS_TRACE_LEVEL
+#define FS_TRACE_LEVEL		TRACE_LEVEL_INFO
+#endif
+
+// messages kept in the ring, a power of 2
+#define TRACE_RING_SIZE		1024
+// bytes of a message kept in the ring, longer ones are cut
+#define TRACE_MSG_BYTES		112
+
+// levels up to this one are printed on stderr as well, errors by default
+extern int fs_trace_echo;
+
+// Records a message of a level, formatted like printf.
+void trace_log(int level, const char * format, ...)
+	__attribute__ ((format (printf, 2, 3)));
+
+// Prints the last count messages of the ring to out, oldest first, all of
+// them if count is 0. Returns the number printed.
+int trace_dump(FILE * out, int count);
+
+// A level that is stripped keeps its arguments type checked but leaves no code
+#define TRACE_STRIPPED(...)	do { if (0) trace_log(__VA_ARGS__); } while (0)
+
+#define TRACE_ERROR(...)	trace_log(TRACE_LEVEL_ERROR, __VA_ARGS__)
+
+#if FS_TRACE_LEVEL >= TRACE_LEVEL_WARN
+#define TRACE_WARN(...)		trace_log(TRACE_LEVEL_WARN, __VA_ARGS__)
+#else
+#define TRACE_WARN(...)		TRACE_STRIPPED(TRACE_LEVEL_WARN, __VA_ARGS__)
+#endif
+
+#if FS_TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define TRACE_INFO(...)		trace_log(TRACE_LEVEL_INFO, __VA_ARGS__)
+#else
+#define TRACE_INFO(...)		TRACE_STRIPPED(TRACE_LEVEL_INFO, __VA_ARGS__)
+#endif
+
+#if FS_TRACE_LEVEL >= TRACE_LEVEL_DEBUG
+#define TRACE_DEBUG(...)	trace_log(TRACE_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define TRACE_DEBUG(...)	TRACE_STRIPPED(TRACE_LEVEL_DEBUG, __VA_ARGS__)
+#endif
+
+#endif
@@ -22,26 +22,74 @@
 #include "vcb_.h"
 #include "FAT.h"
 #include "root_init.h"
+#include "elevator.h"
+#include "geometry.h"
 
 
 VCB* vcb = NULL; //before setup, set to NULL
 int entries_per_dir = 128; //number of entries per each directory
 
+/**
+ * This helper function picks the cluster size of a volume formatted without one
+ *
+ * @param number_of_blocks - A uint64_t representing the number of blocks in the volume
+ * @param block_size - A uint32_t representing the block size of the volume
+ *
+ * @return - the blocks in a cluster, a power of 2
+ *         
+ */
+static uint32_t default_cluster_blocks(uint64_t number_of_blocks, uint32_t block_size) {
+#ifdef FS_BLOCK_SIZE
+    // a build for one block size only mounts clusters of that size
+    if (block_size <= FS_BLOCK_SIZE) {
+        return FS_BLOCK_SIZE / block_size;
+    }
+#endif
+    uint32_t blocks = 1;
+    if (number_of_blocks * block_size >= VCB_LARGE_VOLUME_BYTES) {
+        while ((uint64_t) blocks * block_size < VCB_LARGE_CLUSTER_BYTES) {
+            blocks *= 2;
+        }
+    }
+    // past what the FAT can number, the clusters grow instead of the volume being cut
+    while (number_of_blocks / blocks > FAT_MAX_BLOCKS
+            && (uint64_t) blocks * 2 * block_size <= VCB_MAX_CLUSTER_BYTES) {
+        blocks *= 2;
+    }
+    return blocks;
+}
+
+/**
+ * This helper function checks a cluster size
+ *
+ * @param blocks - blocks in a cluster
+ * @param block_size - A uint32_t representing the block size of the volume
+ *
+ * @return - 1 if it is a power of 2 no larger than VCB_MAX_CLUSTER_BYTES, 0 otherwise
+ *         
+ */
+static int valid_cluster(uint64_t blocks, uint32_t block_size) {
+    return blocks > 0 && (blocks & (blocks - 1)) == 0 && blocks * block_size <= VCB_MAX_CLUSTER_BYTES;
+}
+
 /**
  * This function is used for initalizing the volume control block
  *
- * @param number_of_blocks - A uint32_t representing the number of blocks needed for the VCB
+ * @param number_of_blocks - A uint64_t representing the number of blocks in the volume
  * @param block_size - A uint32_t representing the block size for each of the blocks needed for the VCB
  *
  * @return - On success of initalizng the volume control block return 0
+ *         - On a volume too small for the FAT and the root directory, return -1
  *         - On failure to allocate memory, return -1
  *         - On failure to read VCB from disk, return -1
  *         - On failure to write VCB to disk, return -1
  *         
  */
-int vcb_init(uint32_t number_of_blocks, uint16_t block_size) {
+int vcb_init(uint64_t number_of_blocks, uint32_t block_size) {
     printf("[ VCB INIT ] : Initializing Volume Control Block...\n");
 
+    // vcb_is_init already read the old block into vcb, drop it before allocating
+    free(vcb);
     vcb = (VCB*) malloc(block_size);
     if (!vcb) {
         printf("[ VCB INIT ] : Failed to allocate memory for VCB.\n");
@@ -53,24 +101,67 @@ int vcb_init(uint32_t number_of_blocks, uint16_t block_size) {
     if (ret_val == -1) {
         printf("[ VCB INIT ] : Failed to read VCB from disk.\n");
         free(vcb);
+        vcb = NULL;
         return ret_val;
     }
 
-    vcb->total_blocks_32 = 19531;
-    vcb->FAT_size_32 = 153;
-    vcb->root_cluster = 154;
-    vcb->reserved_blocks_count = 154;
+    uint64_t cluster_blocks = fs_cluster_blocks > 0 ? (uint64_t) fs_cluster_blocks
+        : default_cluster_blocks(number_of_blocks, block_size);
+    if (!valid_cluster(cluster_blocks, block_size)) {
+        printf("[ VCB INIT ] : Clusters of %llu blocks of %u bytes are not supported.\n",
+            (ull_t) cluster_blocks, block_size);
+        free(vcb);
+        vcb = NULL;
+        return -1;
+    }
+    uint32_t cluster_size = cluster_blocks * block_size;
+
+    // FAT entries are cluster numbers, a larger volume keeps the clusters they can name
+    uint64_t total_blocks = number_of_blocks / cluster_blocks;
+    if (total_blocks > FAT_MAX_BLOCKS) {
+        printf("[ VCB INIT ] : Only the first %llu of %llu clusters can be used.\n",
+            (ull_t) FAT_MAX_BLOCKS, (ull_t) total_blocks);
+        total_blocks = FAT_MAX_BLOCKS;
+    }
 
-    vcb->free_space = 19531 - 155;
+    // the VCB takes cluster 0, the FAT with one entry per cluster follows it,
+    // then the free count of every allocation group
+    uint64_t fat_bytes = total_blocks * sizeof(uint32_t);
+    uint64_t fat_blocks = (fat_bytes + cluster_size - 1) / cluster_size;
+    uint64_t summary_blocks = fat_summary_blocks(total_blocks, cluster_size);
+    uint64_t reserved = FAT_BLOCK_START_LOCATION + fat_blocks + summary_blocks;
+    uint64_t dir_blocks = (entries_per_dir * sizeof(Directory_Entry) + cluster_size - 1) / cluster_size;
+    // the last cluster is marked as the end of the volume by fat_init
+    if (total_blocks < reserved + dir_blocks + 1) {
+        printf("[ VCB INIT ] : %llu clusters of %u bytes can't hold the FAT and the root directory.\n",
+            (ull_t) total_blocks, cluster_size);
+        free(vcb);
+        vcb = NULL;
+        return -1;
+    }
+
+    vcb->total_blocks = total_blocks;
+    vcb->FAT_size = fat_blocks;
+    vcb->summary_size = summary_blocks;
+    vcb->reserved_blocks_count = reserved;
+    // the root is the first chain allocated, fsInit records where it went
+    vcb->root_cluster = reserved;
+
+    vcb->free_space = total_blocks - reserved - 1;
     vcb->magic_number = MAGIC_NUMBER;
-    vcb->entries_per_dir = 128;
+    vcb->entries_per_dir = entries_per_dir;
     vcb->bytes_per_block = block_size;
+    vcb->mount_state = VCB_MOUNTED;
+    vcb->blocks_per_cluster = cluster_blocks;
 
-
-    printf("[ VCB INIT ] : Writing VCB to disk, root cluster: %d\n", vcb->root_cluster);
-    if (LBAwrite(vcb, 1, VCB_BLOCK_LOCATION) != 1) {
+    printf("[ VCB INIT ] : %llu clusters of %u blocks, FAT of %llu clusters, %llu reserved clusters.\n",
+        (ull_t) vcb->total_blocks, vcb->blocks_per_cluster, (ull_t) vcb->FAT_size,
+        (ull_t) vcb->reserved_blocks_count);
+    printf("[ VCB INIT ] : Writing VCB to disk, root cluster: %llu\n", (ull_t) vcb->root_cluster);
+    if (elv_write(vcb, 1, VCB_BLOCK_LOCATION) != 1) {
         printf("[ VCB INIT ] : Failed to write VCB to disk.\n");
         free(vcb);
+        vcb = NULL;
         return -1;
     }
     return 0;
@@ -88,7 +179,7 @@ int vcb_init(uint32_t number_of_blocks, uint16_t block_size) {
 int vcb_read_from_disk(VCB *vcb) {
     printf("[ VCB READ FROM DISK ] : Reading VCB from disk...\n");
 
-    int ret_value = LBAread(vcb, 1, VCB_BLOCK_LOCATION);
+    int ret_value = elv_read(vcb, 1, VCB_BLOCK_LOCATION);
     if (ret_value != 1) {
         printf("[ VCB READ FROM DISK ] : Failed to read VCB from disk.\n");
         return -1;
@@ -97,22 +188,49 @@ int vcb_read_from_disk(VCB *vcb) {
     return 0;
 }
 
+/**
+ * This helper function is used for writing the vcb to disk
+ *
+ * @param vcb - A vcb representing which vcb you want to write
+ *
+ * @return - On success of writing the volume control block to disk return 0
+ *         - On failure to write VCB to disk, return -1
+ *         
+ */
+int vcb_write_to_disk(VCB *vcb) {
+    printf("[ VCB WRITE TO DISK ] : Writing VCB to disk...\n");
+
+    if (elv_write(vcb, 1, VCB_BLOCK_LOCATION) != 1) {
+        printf("[ VCB WRITE TO DISK ] : Failed to write VCB to disk.\n");
+        return -1;
+    }
+    return 0;
+}
+
 /**
  * This helper function is used to check if the vcb is initalized
  *
+ * @param block_size - A uint32_t representing the block size of the volume
+ *
  * @return - If vcb is initalized return 0
  *         - If Volume control block is not initalized return -1
  *         
  */
-int vcb_is_init() {
+int vcb_is_init(uint32_t block_size) {
     printf("[ VCB IS INIT ] : Checking if VCB is initialized...\n");
     
-    vcb = malloc(512);
-    vcb_read_from_disk(vcb);
+    // a whole block is read, the buffer is as large as a block
+    vcb = malloc(block_size);
     if (vcb == NULL) {
         printf("[ VCB IS INIT ] : Volume Control Block is not initialized.\n");
         return 0;
     }
+    if (vcb_read_from_disk(vcb) == -1) {
+        printf("[ VCB IS INIT ] : Volume Control Block is not initialized.\n");
+        free(vcb);
+        vcb = NULL;
+        return 0;
+    }
 
     if (vcb->magic_number == MAGIC_NUMBER) {
         printf("[ VCB IS INIT ] : Volume Control Block is initialized.\n");
@@ -122,3 +240,39 @@ int vcb_is_init() {
         return 0;
     }
 }
+
+/**
+ * This function makes the mounted volume work in clusters. From here on
+ * the geometry and bytes_per_block are the size of a cluster and the
+ * elevator counts in clusters, the VCB buffer grows to a whole cluster
+ * since it is written as cluster 0.
+ *
+ * @return - On success return 0
+ *         - If the VCB has a cluster size that is not valid, return -1
+ *         - On failure to allocate memory, return -1
+ *         
+ */
+int vcb_use_clusters(void) {
+    uint32_t block_size = vcb->bytes_per_block;
+    if (!valid_cluster(vcb->blocks_per_cluster, block_size)) {
+        printf("[ VCB CLUSTERS ] : Clusters of %u blocks are not supported.\n", vcb->blocks_per_cluster);
+        return -1;
+    }
+    uint32_t cluster_size = vcb->blocks_per_cluster * block_size;
+    if (!geo_supported(cluster_size)) {
+        printf("[ VCB CLUSTERS ] : Clusters of %u bytes can't be mounted by this build.\n", cluster_size);
+        return -1;
+    }
+    VCB * grown = realloc(vcb, cluster_size);
+    if (grown == NULL) {
+        printf("[ VCB CLUSTERS ] : Failed to allocate memory for VCB.\n");
+        return -1;
+    }
+    // the rest of cluster 0 is written with the VCB
+    memset((char *) grown + block_size, 0, cluster_size - block_size);
+    vcb = grown;
+    // what is queued was counted in disk blocks
+    elv_flush();
+    geo_set(cluster_size, vcb->blocks_per_cluster);
+    return 0;
+}
@@ -16,34 +16,66 @@
 #define _VCB__H
 #include <stdint.h> 
 
+// Every count and location in the VCB is in clusters of blocks_per_cluster
+// blocks, the unit the FAT numbers and every layer above the disk works in.
+// Only bytes_per_block is the block of the disk itself.
 typedef struct VCB {//size of fields, desc of field
-    uint32_t total_blocks_32;     // 4 bytes, the total number of blocks in the file system
-    uint32_t FAT_size_32;  // 4 bytes, total blocks in the FAT
-    uint32_t root_cluster;        // 4 bytes, location of the root
-    uint32_t free_space;          // 4 bytes, amount of free blocks
+    uint64_t total_blocks;        // 8 bytes, the total number of clusters in the file system
+    uint64_t FAT_size;            // 8 bytes, total blocks in the FAT
+    uint64_t root_cluster;        // 8 bytes, location of the root
+    uint64_t free_space;          // 8 bytes, amount of free blocks
+    uint64_t reserved_blocks_count;   // 8 bytes, blocks before the first data block, the VCB, the FAT and the summary
+    uint64_t summary_size;        // 8 bytes, blocks of the free count summary after the FAT
     uint32_t magic_number;        // 4 bytes, Magic Number
     uint32_t entries_per_dir;     // 4 bytes
-    uint16_t bytes_per_block;     //  2 bytes, blockSize,
-    uint16_t reserved_blocks_count;   // 2 bytes, reserved blocks count
+    uint32_t bytes_per_block;     // 4 bytes, blockSize
+    uint32_t mount_state;         // 4 bytes, VCB_CLEAN after a clean unmount, VCB_MOUNTED while in use
+    uint32_t blocks_per_cluster;  // 4 bytes, blocks of the disk in a cluster, a power of 2
 } VCB;
 
 extern VCB * vcb;
 
 #define     VCB_BLOCK_LOCATION              0
-#define 	MAGIC_NUMBER     9090
+#define 	MAGIC_NUMBER     9095 // bumped when the on-disk layout changes
+
+// A volume unmounted cleanly has a summary and a free count that match the
+// FAT, any other state makes the next mount count the free blocks again
+#define     VCB_MOUNTED                     1
+#define     VCB_CLEAN                       2
+
+// A volume formatted without a cluster size gets clusters of at least
+// VCB_LARGE_CLUSTER_BYTES from VCB_LARGE_VOLUME_BYTES up, and clusters
+// large enough for the FAT to number all of it. No cluster is larger
+// than VCB_MAX_CLUSTER_BYTES.
+#define     VCB_LARGE_VOLUME_BYTES          (1ULL << 30)
+#define     VCB_LARGE_CLUSTER_BYTES         4096
+#define     VCB_MAX_CLUSTER_BYTES           65536
 
 // The `vcb_init` funtion initializes the volume control block (VCB). 
-// It either reads the VCB from disk or initizializes it with defualt values if not alreaddy initiaized. 
-// If there are issues during any step of this process, it returns -1 after freeing any allocated memory.
-int vcb_init(uint32_t number_of_blocks, uint16_t block_size);
+// The cluster size comes from fs_cluster_blocks, or from the size of the volume when it is 0.
+// The FAT, its free count summary and the reserved area are sized in clusters,
+// a volume larger than the FAT can number only uses its first FAT_MAX_BLOCKS clusters.
+// If there are issues during any step of this process, or the volume is too small
+// for the FAT and the root directory, it returns -1 after freeing any allocated memory.
+int vcb_init(uint64_t number_of_blocks, uint32_t block_size);
 
 // The `vcb_read_from_disk` function reads the VCB from disk using the LBAread method. 
 // If the read opration is unsuccesfull, it returns -1.
 int vcb_read_from_disk(VCB *vcb);
 
+// The `vcb_write_to_disk` function writes the VCB back to its block with elv_write.
+// If the write fails, it returns -1.
+int vcb_write_to_disk(VCB *vcb);
+
 // The `vcb_is_init` function checks if the VCB is already initialized by checking its magic number. 
+// The first block is read into a buffer of block_size bytes that becomes vcb.
 // It returns 0 if the VCB is not initialized or if the VCB pointer is null.
-int vcb_is_init();
+int vcb_is_init(uint32_t block_size);
+
+// The `vcb_use_clusters` function makes the mounted volume work in its clusters: the geometry,
+// bytes_per_block and the elevator count in clusters from then on, and the VCB buffer grows to a cluster.
+// It returns -1 if the cluster size of the VCB is not valid for this build or memory ran out.
+int vcb_use_clusters(void);
 
 
 #endif // _VCB__H
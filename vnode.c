@@ -0,0 +1,595 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: vnode.c
+*
+* Description: Shared, reference counted open file objects.
+**************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "vnode.h"
+#include "dir_cache.h"
+#include "writeback.h"
+#include "elevator.h"
+#include "geometry.h"
+#include "trace.h"
+
+
+static vnode * buckets[VNODE_HASH_BUCKETS];
+// protects the hash and the reference counts
+static pthread_mutex_t table_mutex = PTHREAD_MUTEX_INITIALIZER;
+// signalled when a closing vnode leaves the hash
+static pthread_cond_t vnode_closed = PTHREAD_COND_INITIALIZER;
+// also guards the hash chains so sizes can be read without the table lock,
+// it is taken after the table lock and after directory locks
+static pthread_rwlock_t hash_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static int bucket_of(uint32_t parent_cluster, int index) {
+	return (parent_cluster * 31 + index) % VNODE_HASH_BUCKETS;
+}
+
+/**
+ * This function returns the vnode of an existing file
+ *
+ * @param entry - result of fs_lookup for the file, the lookup keeps its own reference
+ *
+ * @return - the vnode with one more reference
+ *         - NULL if the entry is a directory, does not exist or memory ran out
+ */
+vnode * vnode_get(lookup_result * entry) {
+	if (!entry->exists || entry->is_dir) {
+		return NULL;
+	}
+
+	uint32_t parent_cluster = entry->parent[0].dir_first_cluster;
+	int b = bucket_of(parent_cluster, entry->index);
+	pthread_mutex_lock(&table_mutex);
+	vnode * vn = buckets[b];
+	while (vn != NULL) {
+		if (vn->parent_cluster != parent_cluster || vn->index != entry->index) {
+			vn = vn->hash_next;
+			continue;
+		}
+		if (!vn->closing) {
+			// already open, the vnode is newer than the directory entry
+			vn->refcount++;
+			pthread_mutex_unlock(&table_mutex);
+			return vn;
+		}
+		// the last put is writing the size, the directory has it once
+		// the vnode is gone
+		pthread_cond_wait(&vnode_closed, &table_mutex);
+		vn = buckets[b];
+	}
+
+	vn = malloc(sizeof(vnode));
+	if (vn == NULL) {
+		pthread_mutex_unlock(&table_mutex);
+		TRACE_ERROR("[ VNODE ] : Out of memory.\n");
+		return NULL;
+	}
+	vn->parent_cluster = parent_cluster;
+	vn->index = entry->index;
+	// the directory buffer is shared, holding it keeps the entry valid
+	vn->parent = entry->parent;
+	dir_hold(vn->parent);
+	vn->tail_block = -1;
+	vn->pending = NULL;
+	vn->pending_off = 0;
+	vn->pending_len = 0;
+	vn->pending_cap = 0;
+	vn->tail_index = 0;
+	vn->chain_blocks = 0;
+	vn->chain_last = -1;
+	vn->space_reserved = 0;
+	vn->wb_queued = 0;
+	vn->wb_since = 0;
+	vn->wb_next = NULL;
+	vn->dirty = 0;
+	vn->data_gen = 0;
+	vn->refcount = 1;
+	vn->closing = 0;
+	pthread_rwlock_init(&vn->lock, NULL);
+	// the entry is read and the vnode published under the directory lock,
+	// so a thread holding that lock alone sees either both or neither
+	dir_read_lock(vn->parent);
+	Directory_Entry * de = &entry->parent[entry->index];
+	if (!(de->dir_attr & IS_ACTIVE) || strncmp(de->dir_name, entry->name, NAME_MAX_LENGTH) != 0) {
+		// deleted or moved since the lookup
+		dir_unlock(vn->parent);
+		pthread_mutex_unlock(&table_mutex);
+		pthread_rwlock_destroy(&vn->lock);
+		dir_put(vn->parent);
+		free(vn);
+		return NULL;
+	}
+	strncpy(vn->file_name, de->dir_name, NAME_MAX_LENGTH - 1);
+	vn->file_name[NAME_MAX_LENGTH - 1] = '\0';
+	vn->file_size = de->dir_file_size;
+	vn->location = de->dir_first_cluster;
+	// the file grows near its first block
+	fat_reservation_init(&vn->reserve, vn->location);
+	pthread_rwlock_wrlock(&hash_lock);
+	vn->hash_next = buckets[b];
+	buckets[b] = vn;
+	pthread_rwlock_unlock(&hash_lock);
+	dir_unlock(vn->parent);
+	pthread_mutex_unlock(&table_mutex);
+	return vn;
+}
+
+/**
+ * This function writes the size of a file to its directory
+ *
+ * @param vn - the vnode of the file
+ *
+ * @return - 0 on success or if nothing is dirty, -1 if the write failed
+ */
+int vnode_sync(vnode * vn) {
+	if (!vn->dirty) {
+		return 0;
+	}
+
+	if (vnode_flush(vn) == -1) {
+		return -1;
+	}
+
+	// the chain goes to disk before the size that covers it
+	update_fat_on_disk();
+
+	dir_write_lock(vn->parent);
+	Directory_Entry * de = &vn->parent[vn->index];
+	de->dir_file_size = vn->file_size;
+	de->dir_mod_time = time(NULL);
+
+	int blocks_need = GEO_BLOCKS(vn->parent[0].dir_file_size);
+	int check = write_to_disk(vn->parent, vn->parent_cluster, blocks_need, bytes_per_block);
+	dir_unlock(vn->parent);
+	if (check == -1) {
+		TRACE_ERROR("[ VNODE ] : Failed to write the size of %s.\n", vn->file_name);
+		return -1;
+	}
+	vn->dirty = 0;
+	return 0;
+}
+
+/**
+ * This function checks if a directory slot has a vnode, a file that is open
+ * or still has data for the flusher
+ *
+ * @param parent_cluster - first block of the directory holding the file
+ * @param index - slot of the file in that directory
+ *
+ * @return - 1 if the file has a vnode, 0 otherwise
+ */
+int vnode_is_open(uint32_t parent_cluster, int index) {
+	int found = 0;
+	pthread_rwlock_rdlock(&hash_lock);
+	for (vnode * vn = buckets[bucket_of(parent_cluster, index)]; vn != NULL; vn = vn->hash_next) {
+		if (vn->parent_cluster == parent_cluster && vn->index == index) {
+			found = 1;
+			break;
+		}
+	}
+	pthread_rwlock_unlock(&hash_lock);
+	return found;
+}
+
+/**
+ * This function returns the size of a file, from its vnode when it is open
+ * or still has data for the flusher, since that size is newer
+ *
+ * @param parent_cluster - first block of the directory holding the file
+ * @param index - slot of the file in that directory
+ * @param dir_size - the size recorded in the directory
+ *
+ * @return - the current size of the file
+ */
+off_t vnode_size_of(uint32_t parent_cluster, int index, off_t dir_size) {
+	off_t size = dir_size;
+	pthread_rwlock_rdlock(&hash_lock);
+	for (vnode * vn = buckets[bucket_of(parent_cluster, index)]; vn != NULL; vn = vn->hash_next) {
+		if (vn->parent_cluster == parent_cluster && vn->index == index) {
+			size = __atomic_load_n(&vn->file_size, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	pthread_rwlock_unlock(&hash_lock);
+	return size;
+}
+
+/**
+ * This function adds a reference to a vnode
+ *
+ * @param vn - the vnode, already referenced by the caller
+ *
+ * @return - void
+ */
+void vnode_hold(vnode * vn) {
+	pthread_mutex_lock(&table_mutex);
+	vn->refcount++;
+	pthread_mutex_unlock(&table_mutex);
+}
+
+/**
+ * This function drops a reference to a vnode
+ *
+ * @param vn - the vnode of the file, NULL is ignored
+ *
+ * @return - void
+ */
+void vnode_put(vnode * vn) {
+	if (vn == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&table_mutex);
+	vn->refcount--;
+	if (vn->refcount > 0) {
+		pthread_mutex_unlock(&table_mutex);
+		return;
+	}
+
+	// last close, the data and size reach the disk once. The vnode stays
+	// in the table marked closing while that is done without the table
+	// lock, an open of the same file waits for it to leave and then reads
+	// the new size from the directory.
+	vn->closing = 1;
+	pthread_mutex_unlock(&table_mutex);
+
+	vnode_sync(vn);
+	if (fat_reservation_release(&vn->reserve) > 0) {
+		update_fat_on_disk();
+	}
+	fat_unreserve_space(vn->space_reserved);
+	wb_account(-vn->pending_len);
+
+	pthread_mutex_lock(&table_mutex);
+	pthread_rwlock_wrlock(&hash_lock);
+	vnode ** link = &buckets[bucket_of(vn->parent_cluster, vn->index)];
+	while (*link != NULL) {
+		if (*link == vn) {
+			*link = vn->hash_next;
+			break;
+		}
+		link = &(*link)->hash_next;
+	}
+	pthread_rwlock_unlock(&hash_lock);
+	pthread_cond_broadcast(&vnode_closed);
+	pthread_mutex_unlock(&table_mutex);
+
+	dir_put(vn->parent);
+	pthread_rwlock_destroy(&vn->lock);
+	free(vn->pending);
+	free(vn);
+}
+
+/**
+ * This helper function returns the blocks a file of size bytes uses,
+ * a file always keeps its first block
+ *
+ * @param size - size of the file in bytes
+ *
+ * @return - number of blocks
+ */
+static int blocks_for(off_t size) {
+	return size == 0 ? 1 : GEO_BLOCKS(size);
+}
+
+/**
+ * This helper function finds the block holding the end of the data and the
+ * last block of the chain, which is further when blocks were preallocated.
+ * The chain is walked once per vnode.
+ *
+ * @param vn - the vnode of the file
+ *
+ * @return - void
+ */
+static void chain_init(vnode * vn) {
+	if (vn->tail_block != -1) {
+		return;
+	}
+	int data_blocks = blocks_for(vn->file_size - vn->pending_len);
+	uint32_t block = vn->location;
+	int count = 1;
+	vn->tail_block = block;
+	vn->tail_index = 0;
+	while (get_next_block(block) != EOF_BLOCK) {
+		block = get_next_block(block);
+		if (count < data_blocks) {
+			vn->tail_block = block;
+			vn->tail_index = count;
+		}
+		count++;
+	}
+	vn->chain_blocks = count;
+	vn->chain_last = block;
+}
+
+/**
+ * This function appends data to a file, holding it until it is flushed
+ *
+ * @param vn - the vnode of the file
+ * @param buffer - the data
+ * @param count - bytes of data
+ *
+ * @return - the bytes taken, less than count if the volume filled up
+ *         - -1 if nothing could be written
+ */
+int64_t vnode_write(vnode * vn, const char * buffer, int64_t count) {
+	int block_size = bytes_per_block;
+	int max = VNODE_DELAY_BLOCKS * block_size;
+	int64_t written = 0;
+
+	chain_init(vn);
+	while (written < count) {
+		if (vn->pending_len > 0 && vn->pending_off + vn->pending_len == max
+				&& vnode_flush(vn) == -1) {
+			break;
+		}
+		int read_tail = 0;
+		if (vn->pending_len == 0) {
+			// new held data lines up with the blocks of the file, the
+			// bytes already in the last block go in front of it
+			vn->pending_off = GEO_OFFSET_OF(vn->file_size);
+			read_tail = vn->pending_off > 0;
+		}
+
+		// at most what fits in pending, so n stays small for any count
+		int n = max - vn->pending_off - vn->pending_len;
+		if (count - written < n) {
+			n = count - written;
+		}
+		int end = vn->pending_off + vn->pending_len + n;
+
+		// the buffer grows by doubling and stays a whole number of blocks
+		if (end > vn->pending_cap) {
+			int cap = vn->pending_cap > 0 ? vn->pending_cap : 8 * block_size;
+			while (cap < end) {
+				cap *= 2;
+			}
+			if (cap > max) {
+				cap = max;
+			}
+			char * grown = realloc(vn->pending, cap);
+			if (grown == NULL) {
+				TRACE_ERROR("[ VNODE ] : Out of memory for the data of %s.\n", vn->file_name);
+				break;
+			}
+			vn->pending = grown;
+			vn->pending_cap = cap;
+		}
+
+		if (read_tail) {
+			elv_read(vn->pending, 1, vn->tail_block);
+		}
+
+		// free space is promised now so the flush can't run out of it,
+		// blocks already in the chain need no promise
+		int need = blocks_for(vn->file_size + n) - vn->chain_blocks;
+		if (need > vn->space_reserved) {
+			if (fat_reserve_space(need - vn->space_reserved) == -1) {
+				TRACE_WARN("[ VNODE ] : Volume is full, %s can't grow.\n", vn->file_name);
+				break;
+			}
+			vn->space_reserved = need;
+		}
+
+		memcpy(vn->pending + vn->pending_off + vn->pending_len, buffer + written, n);
+		wb_account(n);
+		vn->pending_len += n;
+		// vnode_size_of reads the size without the file lock
+		__atomic_store_n(&vn->file_size, vn->file_size + n, __ATOMIC_RELAXED);
+		written += n;
+	}
+
+	if (written > 0) {
+		// a write at the same size still changes the modification time
+		vn->dirty = 1;
+		wb_mark_dirty(vn);
+	}
+
+	// past the hard limit the writer pays: its own data goes out now and
+	// it waits for the flusher to bring the rest under the limit
+	if (wb_over_limit()) {
+		vnode_flush(vn);
+		wb_throttle();
+	}
+	return written > 0 || count == 0 ? written : -1;
+}
+
+/**
+ * This function gives the held data of a file its blocks and writes it.
+ * Blocks already in the chain are used first, the missing ones are
+ * allocated in one call, and every run of blocks is written at once.
+ *
+ * @param vn - the vnode of the file
+ *
+ * @return - 0 on success or if nothing is held, -1 if the data can't be written
+ */
+int vnode_flush(vnode * vn) {
+	if (vn->pending_len == 0) {
+		return 0;
+	}
+
+	int used = vn->pending_off + vn->pending_len;
+	int blocks = GEO_BLOCKS(used);
+	int first_index = GEO_BLOCK_OF(vn->file_size - vn->pending_len);
+	int ret = 0;
+
+	uint32_t * targets = malloc(blocks * sizeof(uint32_t));
+	if (targets == NULL) {
+		TRACE_ERROR("[ VNODE ] : Out of memory to flush %s.\n", vn->file_name);
+		return -1;
+	}
+
+	// the first block is the last one with data when it has room, then
+	// come the preallocated blocks after it
+	chain_init(vn);
+	uint32_t block = vn->tail_block;
+	int have = 0;
+	if (first_index == vn->tail_index) {
+		targets[have++] = block;
+	}
+	while (have < blocks && get_next_block(block) != EOF_BLOCK) {
+		block = get_next_block(block);
+		targets[have++] = block;
+	}
+	if (have < blocks) {
+		if (allocate_extent(vn->chain_last, blocks - have, &vn->reserve, targets + have) == -1) {
+			TRACE_ERROR("[ VNODE ] : Failed to allocate %d blocks for %s.\n", blocks - have, vn->file_name);
+			free(targets);
+			return -1;
+		}
+		vn->chain_blocks += blocks - have;
+		vn->chain_last = targets[blocks - 1];
+	}
+
+	// the end of the last block is written as zeros
+	memset(vn->pending + used, 0, GEO_BYTES(blocks) - used);
+
+	// one write for every run of blocks that follow each other on disk
+	int i = 0;
+	while (i < blocks) {
+		int j = i + 1;
+		while (j < blocks && targets[j] == targets[j - 1] + 1) {
+			j++;
+		}
+		if (elv_write(vn->pending + GEO_BYTES(i), j - i, targets[i]) != j - i) {
+			TRACE_ERROR("[ VNODE ] : Failed to write blocks of %s.\n", vn->file_name);
+			ret = -1;
+		}
+		i = j;
+	}
+	vn->tail_block = targets[blocks - 1];
+	vn->tail_index = first_index + blocks - 1;
+	free(targets);
+	// blocks buffered by readers of the file are stale
+	vn->data_gen++;
+
+	// the data has its blocks now, the promise is used up
+	fat_unreserve_space(vn->space_reserved);
+	vn->space_reserved = 0;
+	wb_account(-vn->pending_len);
+	vn->pending_len = 0;
+	vn->pending_off = 0;
+	return ret;
+}
+
+/**
+ * This function adds blocks to the end of a file so it can grow to
+ * offset + len bytes without allocating. The size does not change and
+ * the blocks are not cleared.
+ *
+ * @param vn - the vnode of the file
+ * @param offset - start of the range in bytes
+ * @param len - length of the range in bytes
+ *
+ * @return - 0 on success or if the blocks are there already
+ *         - -1 if the volume is full
+ */
+int vnode_fallocate(vnode * vn, off_t offset, off_t len) {
+	chain_init(vn);
+	int want = blocks_for(offset + len) - vn->chain_blocks;
+	if (want <= 0) {
+		return 0;
+	}
+
+	// blocks promised to held data of other files are not taken
+	if (fat_reserve_space(want) == -1) {
+		TRACE_WARN("[ VNODE ] : Volume is full, can't preallocate %s.\n", vn->file_name);
+		return -1;
+	}
+	uint32_t * extent = malloc(want * sizeof(uint32_t));
+	int ret = -1;
+	if (extent != NULL) {
+		ret = allocate_extent(vn->chain_last, want, &vn->reserve, extent);
+	}
+	fat_unreserve_space(want);
+	if (ret == -1) {
+		free(extent);
+		return -1;
+	}
+
+	vn->chain_blocks += want;
+	vn->chain_last = extent[want - 1];
+	free(extent);
+	update_fat_on_disk();
+	return 0;
+}
+
+/**
+ * This function drops the held data of a file that was cut to zero bytes
+ *
+ * @param vn - the vnode of the file
+ *
+ * @return - void
+ */
+void vnode_truncate(vnode * vn) {
+	fat_unreserve_space(vn->space_reserved);
+	vn->space_reserved = 0;
+	wb_account(-vn->pending_len);
+	vn->pending_len = 0;
+	vn->pending_off = 0;
+	vn->data_gen++;
+	__atomic_store_n(&vn->file_size, 0, __ATOMIC_RELAXED);
+	vn->dirty = 0;
+	// only the first block is left
+	vn->tail_block = vn->location;
+	vn->tail_index = 0;
+	vn->chain_blocks = 1;
+	vn->chain_last = vn->location;
+}
+
+/**
+ * This function takes the shared lock of a file to read it
+ *
+ * @param vn - the vnode of the file
+ *
+ * @return - void
+ */
+void vnode_read_lock(vnode * vn) {
+	pthread_rwlock_rdlock(&vn->lock);
+}
+
+/**
+ * This function takes the exclusive lock of a file to change it
+ *
+ * @param vn - the vnode of the file
+ *
+ * @return - void
+ */
+void vnode_write_lock(vnode * vn) {
+	pthread_rwlock_wrlock(&vn->lock);
+}
+
+/**
+ * This function takes the exclusive lock of a file if nobody holds it
+ *
+ * @param vn - the vnode of the file
+ *
+ * @return - 0 with the lock taken, -1 if the file is busy
+ */
+int vnode_try_write_lock(vnode * vn) {
+	return pthread_rwlock_trywrlock(&vn->lock) == 0 ? 0 : -1;
+}
+
+/**
+ * This function releases the lock taken by vnode_read_lock or vnode_write_lock
+ *
+ * @param vn - the vnode of the file
+ *
+ * @return - void
+ */
+void vnode_unlock(vnode * vn) {
+	pthread_rwlock_unlock(&vn->lock);
+}
@@ -0,0 +1,120 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: vnode.h
+*
+* Description: Table of open files. Every descriptor open on the
+*	same directory slot shares one vnode, so they all see the
+*	same size. A size change is kept in the vnode and written to
+*	the directory once, on fsync or when the last user closes it.
+*	Written data is held in the vnode with free space promised to
+*	it, its blocks are chosen in one extent when it is flushed.
+*	The table is thread safe and every vnode has its own lock.
+**************************************************************/
+#ifndef _VNODE_H
+#define _VNODE_H
+#include <stdint.h>
+#include <pthread.h>
+#include "mfs.h"
+#include "FAT.h"
+
+// number of hash buckets used to find the vnode of a directory slot
+#define VNODE_HASH_BUCKETS	64
+// most blocks of written data a vnode holds before it is flushed
+#define VNODE_DELAY_BLOCKS	4096
+
+// shared state of one open file
+typedef struct vnode
+	{
+	uint32_t parent_cluster;	// first block of the directory holding the file
+	int index;			// slot of the file in that directory
+	Directory_Entry * parent;	// the directory, referenced while the vnode lives
+	char file_name[NAME_MAX_LENGTH];	// file name
+	off_t file_size;		// file size in bytes, newer than the directory when dirty
+	int location;			// starting logical block in disk
+	fat_reservation reserve;	// blocks taken ahead for writes, under the write lock
+	int tail_block;			// block holding the end of the data, -1 until needed
+	int tail_index;			// position of tail_block in the chain
+	int chain_blocks;		// blocks in the chain, preallocated ones included
+	int chain_last;			// last block of the chain
+	char * pending;			// written data without blocks yet, block aligned
+	int pending_off;		// bytes of the tail block in front of the data
+	int pending_len;		// bytes of data in pending
+	int pending_cap;		// size of pending in bytes
+	int space_reserved;		// free blocks promised to pending
+	int wb_queued;			// 1 while the flusher queue holds the file
+	long wb_since;			// when the queued data was first written, in ms
+	struct vnode * wb_next;		// next file in the flusher queue
+	int dirty;			// 1 if file_size is not in the directory yet
+	unsigned long data_gen;		// bumped when data of the file is written to its blocks
+	int refcount;			// descriptors using the vnode
+	int closing;			// 1 while the last put writes it back
+	pthread_rwlock_t lock;		// readers of the file share it, a writer takes it alone
+	struct vnode * hash_next;	// next vnode in the same hash bucket
+	} vnode;
+
+// Returns the vnode of the file found by fs_lookup with one more reference,
+// creating it from the directory entry if the file is not open yet. A file
+// whose last user is closing it is waited for, so its new size is read.
+// Returns NULL if the entry is not an existing file.
+vnode * vnode_get(lookup_result * entry);
+
+// Returns the size of the file in a directory slot, newer than dir_size
+// while the file is open or has data queued for the flusher. It can be
+// called with the directory locked.
+off_t vnode_size_of(uint32_t parent_cluster, int index, off_t dir_size);
+
+// Returns 1 if the file in a directory slot has a vnode. A thread holding
+// the directory lock knows no vnode is created for the slot until it unlocks.
+int vnode_is_open(uint32_t parent_cluster, int index);
+
+// Adds a reference to a vnode that is already held.
+void vnode_hold(vnode * vn);
+
+// Drops a reference, the last one gives unused reserved blocks back,
+// writes a dirty size back and frees the vnode.
+void vnode_put(vnode * vn);
+
+// Flushes held data, writes the FAT so the new blocks are on disk, then a
+// dirty size and modification time to the directory.
+// The caller holds the write lock of the file, or the last reference.
+// Returns 0 on success, -1 if the directory can't be written.
+int vnode_sync(vnode * vn);
+
+// Appends count bytes to the file. The data is held in the vnode and
+// written by the flusher thread, or here when VNODE_DELAY_BLOCKS fill up
+// or the dirty bytes of all files reach their limit, so a count of many
+// gigabytes goes out in pieces of VNODE_DELAY_BLOCKS.
+// The caller holds the write lock.
+// Returns the bytes taken, -1 if nothing could be written.
+int64_t vnode_write(vnode * vn, const char * buffer, int64_t count);
+
+// Chooses blocks for the held data in one extent and writes it.
+// The caller holds the write lock of the file, or the last reference.
+// Returns 0 on success, -1 if the data can't be written.
+int vnode_flush(vnode * vn);
+
+// Adds blocks to the end of the file so it can grow to offset + len bytes
+// without allocating, the size does not change and the blocks are not
+// cleared. The caller holds the write lock. Returns 0, -1 if the volume is full.
+int vnode_fallocate(vnode * vn, off_t offset, off_t len);
+
+// Drops held data after the file was cut to zero bytes by fs_truncate_at.
+// The caller holds the write lock of the file.
+void vnode_truncate(vnode * vn);
+
+// Per file lock. It is taken before the lock of the directory holding the file.
+void vnode_read_lock(vnode * vn);
+void vnode_write_lock(vnode * vn);
+// Returns 0 with the write lock taken, -1 if another thread holds the file.
+int vnode_try_write_lock(vnode * vn);
+void vnode_unlock(vnode * vn);
+
+#endif
@@ -0,0 +1,325 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: writeback.c
+*
+* Description: Flusher thread for the dirty data held by open
+*	and recently closed files.
+**************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "fsLow.h"
+#include "writeback.h"
+#include "elevator.h"
+#include "FAT.h"
+#include "trace.h"
+
+// most files written by one pass of the flusher
+#define WB_BATCH	64
+
+// queued files, oldest data first. A queued file holds one reference
+// and leaves the queue only while the flusher has its write lock.
+static vnode * queue_head = NULL;
+static vnode * queue_tail = NULL;
+static int in_flight = 0;		// files taken off the queue, not written yet
+static int running = 0;
+static int stopping = 0;
+static int sync_requested = 0;
+static pthread_t flusher;
+static pthread_mutex_t wb_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wb_wake = PTHREAD_COND_INITIALIZER;	// the flusher waits on it
+static pthread_cond_t wb_done = PTHREAD_COND_INITIALIZER;	// writers and wb_sync wait on it
+
+// dirty bytes of every file, changed without the lock
+static long dirty_bytes = 0;
+
+/**
+ * This helper function returns a monotonic time in milliseconds
+ *
+ * @return - the time
+ */
+static long now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/**
+ * This helper function waits on a condition for at most ms milliseconds,
+ * the caller holds wb_mutex
+ *
+ * @param cond - the condition
+ * @param ms - the longest wait
+ *
+ * @return - void
+ */
+static void wait_ms(pthread_cond_t * cond, int ms) {
+	struct timespec until;
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_nsec += ms * 1000000L;
+	until.tv_sec += until.tv_nsec / 1000000000L;
+	until.tv_nsec %= 1000000000L;
+	pthread_cond_timedwait(cond, &wb_mutex, &until);
+}
+
+/**
+ * This helper function orders files by the block their data goes after,
+ * so one pass writes across the volume in one direction
+ *
+ * @param a - pointer to a vnode pointer
+ * @param b - pointer to a vnode pointer
+ *
+ * @return - negative, zero or positive like strcmp
+ */
+static int by_block(const void * a, const void * b) {
+	const vnode * va = *(vnode * const *) a;
+	const vnode * vb = *(vnode * const *) b;
+	return (va->tail_block > vb->tail_block) - (va->tail_block < vb->tail_block);
+}
+
+/**
+ * This helper function takes the files due for writing off the queue,
+ * the caller holds wb_mutex. A file whose lock is busy stays queued.
+ *
+ * @param batch - receives the files, each one write locked
+ * @param all - 1 to take every file, 0 for the ones older than WB_EXPIRE_MS
+ *
+ * @return - number of files taken
+ */
+static int take_due(vnode ** batch, int all) {
+	long now = now_ms();
+	int n = 0;
+	vnode * prev = NULL;
+	vnode * vn = queue_head;
+	while (vn != NULL && n < WB_BATCH) {
+		vnode * next = vn->wb_next;
+		if ((all || now - vn->wb_since >= WB_EXPIRE_MS) && vnode_try_write_lock(vn) == 0) {
+			if (prev == NULL) {
+				queue_head = next;
+			} else {
+				prev->wb_next = next;
+			}
+			if (queue_tail == vn) {
+				queue_tail = prev;
+			}
+			vn->wb_queued = 0;
+			vn->wb_next = NULL;
+			batch[n++] = vn;
+		} else {
+			prev = vn;
+		}
+		vn = next;
+	}
+	in_flight += n;
+	return n;
+}
+
+/**
+ * This thread function writes queued files when their data gets old, when
+ * the dirty bytes pass the background ratio, and on wb_sync and wb_exit
+ *
+ * @param arg - unused
+ *
+ * @return - NULL
+ */
+static void * flusher_main(void * arg) {
+	vnode * batch[WB_BATCH];
+	long background = (long) WB_DIRTY_LIMIT * WB_BACKGROUND_RATIO / 100;
+	int idle = 1;
+
+	// writeback gives way to the reads and writes callers wait for
+	LBAsetclass(IO_CLASS_ASYNC);
+
+	pthread_mutex_lock(&wb_mutex);
+	for (;;) {
+		int pressure = __sync_add_and_fetch(&dirty_bytes, 0) > background;
+		if (!stopping && !sync_requested && (idle || !pressure)) {
+			wait_ms(&wb_wake, WB_INTERVAL_MS);
+			pressure = __sync_add_and_fetch(&dirty_bytes, 0) > background;
+		}
+
+		int all = stopping || sync_requested || pressure;
+		int n = take_due(batch, all);
+		idle = n == 0;
+		if (n == 0) {
+			if (queue_head == NULL) {
+				if (stopping) {
+					break;
+				}
+				// the queue below is written on the next quiet wake up,
+				// then blocks freed since the last one give their space back
+				pthread_mutex_unlock(&wb_mutex);
+				if (elv_pending() > 0) {
+					elv_flush();
+				}
+				fat_discard_flush();
+				pthread_mutex_lock(&wb_mutex);
+				sync_requested = 0;
+				pthread_cond_broadcast(&wb_done);
+			} else if (stopping || sync_requested) {
+				// the files left are locked by their writers, try again soon
+				pthread_mutex_unlock(&wb_mutex);
+				usleep(1000);
+				pthread_mutex_lock(&wb_mutex);
+			}
+			continue;
+		}
+		pthread_mutex_unlock(&wb_mutex);
+
+		qsort(batch, n, sizeof(vnode *), by_block);
+		for (int i = 0; i < n; i++) {
+			vnode_flush(batch[i]);
+			vnode_unlock(batch[i]);
+			// the queue reference, the last one also writes the size
+			vnode_put(batch[i]);
+		}
+		// one sweep of the write queue for the whole batch
+		elv_flush();
+
+		pthread_mutex_lock(&wb_mutex);
+		in_flight -= n;
+		pthread_cond_broadcast(&wb_done);
+	}
+	pthread_mutex_unlock(&wb_mutex);
+
+	fs_thread_exit();
+	return NULL;
+}
+
+/**
+ * This function starts the flusher thread
+ *
+ * @return - 0 on success, -1 if the thread can't be created
+ */
+int wb_init(void) {
+	pthread_mutex_lock(&wb_mutex);
+	if (running) {
+		pthread_mutex_unlock(&wb_mutex);
+		return 0;
+	}
+	stopping = 0;
+	sync_requested = 0;
+	if (pthread_create(&flusher, NULL, flusher_main, NULL) != 0) {
+		pthread_mutex_unlock(&wb_mutex);
+		TRACE_ERROR("[ WRITEBACK ] : Failed to start the flusher, writes go to disk on close.\n");
+		return -1;
+	}
+	running = 1;
+	pthread_mutex_unlock(&wb_mutex);
+	return 0;
+}
+
+/**
+ * This function queues a file with dirty data for the flusher
+ *
+ * @param vn - the vnode of the file, write locked by the caller
+ *
+ * @return - void
+ */
+void wb_mark_dirty(vnode * vn) {
+	if (vn->wb_queued) {
+		return;
+	}
+	pthread_mutex_lock(&wb_mutex);
+	if (!running) {
+		// without the flusher the data is written on close
+		pthread_mutex_unlock(&wb_mutex);
+		return;
+	}
+	vn->wb_queued = 1;
+	vn->wb_since = now_ms();
+	vn->wb_next = NULL;
+	if (queue_tail == NULL) {
+		queue_head = vn;
+	} else {
+		queue_tail->wb_next = vn;
+	}
+	queue_tail = vn;
+	pthread_mutex_unlock(&wb_mutex);
+
+	// the flusher can't take the file before the caller unlocks it
+	vnode_hold(vn);
+}
+
+/**
+ * This function counts dirty bytes
+ *
+ * @param bytes - bytes added, negative when written or dropped
+ *
+ * @return - void
+ */
+void wb_account(long bytes) {
+	__sync_add_and_fetch(&dirty_bytes, bytes);
+}
+
+/**
+ * This function checks the hard limit of dirty bytes
+ *
+ * @return - 1 if the dirty bytes are over WB_DIRTY_LIMIT, 0 otherwise
+ */
+int wb_over_limit(void) {
+	return __sync_add_and_fetch(&dirty_bytes, 0) > WB_DIRTY_LIMIT;
+}
+
+/**
+ * This function makes a writer wait while the dirty bytes are over the limit
+ *
+ * @return - void
+ */
+void wb_throttle(void) {
+	pthread_mutex_lock(&wb_mutex);
+	while (running && wb_over_limit()) {
+		pthread_cond_signal(&wb_wake);
+		wait_ms(&wb_done, WB_INTERVAL_MS);
+	}
+	pthread_mutex_unlock(&wb_mutex);
+}
+
+/**
+ * This function writes every queued file and waits for it
+ *
+ * @return - void
+ */
+void wb_sync(void) {
+	pthread_mutex_lock(&wb_mutex);
+	while (running && (queue_head != NULL || in_flight > 0)) {
+		sync_requested = 1;
+		pthread_cond_signal(&wb_wake);
+		pthread_cond_wait(&wb_done, &wb_mutex);
+	}
+	pthread_mutex_unlock(&wb_mutex);
+}
+
+/**
+ * This function writes every queued file and stops the flusher thread
+ *
+ * @return - void
+ */
+void wb_exit(void) {
+	pthread_mutex_lock(&wb_mutex);
+	if (!running) {
+		pthread_mutex_unlock(&wb_mutex);
+		return;
+	}
+	stopping = 1;
+	pthread_cond_signal(&wb_wake);
+	pthread_mutex_unlock(&wb_mutex);
+
+	pthread_join(flusher, NULL);
+
+	pthread_mutex_lock(&wb_mutex);
+	running = 0;
+	stopping = 0;
+	pthread_mutex_unlock(&wb_mutex);
+}
@@ -0,0 +1,56 @@
+/**************************************************************
+* Class:  CSC-415-01 Summer 2023
+* Names: Tyler Fulinara, Rafael Sant Ana Leitao, Anthony Silva , Vinh Ngo Rafael Fabiani
+* Student IDs: 922002234, 920984945,
+922907645, 921919541,
+922965105
+* GitHub Name: rf922
+* Group Name: MKFS
+* Project: Basic File System
+*
+* File: writeback.h
+*
+* Description: Background writeback. Files with written data that
+*	has no blocks yet are queued, a flusher thread writes them
+*	when the data gets old or when the dirty bytes of all files
+*	pass a share of the limit. Writers only wait when the limit
+*	itself is reached.
+**************************************************************/
+#ifndef _WRITEBACK_H
+#define _WRITEBACK_H
+#include "vnode.h"
+
+// how often the flusher wakes up, in milliseconds
+#define WB_INTERVAL_MS		100
+// data older than this is written on the next wake up, in milliseconds
+#define WB_EXPIRE_MS		500
+// most dirty bytes held for all files together, writers wait above it
+#define WB_DIRTY_LIMIT		(16 * 1024 * 1024)
+// percent of WB_DIRTY_LIMIT above which the flusher writes every file
+#define WB_BACKGROUND_RATIO	25
+
+// Starts the flusher thread, called when the file system starts.
+// Returns 0 on success, -1 if the thread can't be created.
+int wb_init(void);
+
+// Queues a file that holds dirty data, the queue keeps a reference on it.
+// The caller holds the write lock of the file.
+void wb_mark_dirty(vnode * vn);
+
+// Counts dirty bytes added (positive) or written or dropped (negative).
+void wb_account(long bytes);
+
+// Waits while the dirty bytes are over WB_DIRTY_LIMIT. The caller has
+// already flushed its own file.
+void wb_throttle(void);
+
+// Returns 1 if the dirty bytes are over WB_DIRTY_LIMIT.
+int wb_over_limit(void);
+
+// Writes every queued file and waits until the queue is empty.
+void wb_sync(void);
+
+// Writes every queued file and stops the flusher thread.
+void wb_exit(void);
+
+#endif